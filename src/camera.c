@@ -0,0 +1,389 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <string.h>
+#include "rtsp_client.h"
+#include "rtpproxy.h"
+#include "camera.h"
+
+/* camera directory, built once from the config and never resized */
+struct camera_dir_t{
+	int count;
+	camera *cams;		/* count entries, index == position */
+	camera *def;		/* [rtsp] url, NULL if not configured */
+	camera *hash[CAMERA_HASH_SIZE];
+};
+
+static unsigned int 
+camera_hash(const char *id)
+{
+	unsigned int h = 5381;
+	while(*id) {
+		h = (h << 5) + h + (unsigned char)*id++;
+	}
+	return h & (CAMERA_HASH_SIZE-1);
+}
+
+static camera *
+camera_lookup(struct camera_dir_t *dir,const char *id)
+{
+	camera *cam = NULL;
+	for(cam = dir->hash[camera_hash(id)]; NULL != cam; cam = cam->next) {
+		if(0 == strcmp(cam->id,id))
+			return cam;
+	}
+	return NULL;
+}
+
+static void 
+camera_section_count(const char *section,void *ctx)
+{
+	if(0 == strncmp(section,CAMERA_SECTION_PREFIX,strlen(CAMERA_SECTION_PREFIX))){
+		(*(int *)ctx)++;
+	}
+}
+
+/* prometheus label value: backslash, double quote and newline escaped */
+static char *
+camera_label_new(const char *id)
+{
+	char *label = NULL;
+	size_t k = 0;
+
+	if(NULL == id || '\0' == id[0])
+		return osip_strdup("default");
+	label = (char *)osip_malloc(2 * strlen(id) + 1);
+	if(NULL == label)
+		return NULL;
+	for(; '\0' != *id; id++) {
+		if('\\' == *id || '"' == *id || '\n' == *id)
+			label[k++] = '\\';
+		label[k++] = ('\n' == *id) ? 'n' : *id;
+	}
+	label[k] = '\0';
+	return label;
+}
+
+static camera *
+camera_add(core *co,const char *id,const char *url,const char *username,const char *password,
+	int prestart,int linger,const char *transport)
+{
+	struct camera_dir_t *dir = co->cameras;
+	camera *cam = &dir->cams[dir->count];
+	
+	memset(cam,0,sizeof(camera));
+	cam->index = dir->count;
+	cam->id = osip_strdup(id);
+	cam->label = camera_label_new(id);
+	cam->url = osip_strdup(url);
+	cam->username = osip_strdup(username);
+	cam->password = osip_strdup(password);
+	cam->prestart = prestart;
+	cam->linger = linger;
+	cam->interleaved = (NULL != transport && 0 == strcasecmp(transport,"tcp"));
+	cam->multicast = (NULL != transport && 0 == strcasecmp(transport,"multicast"));
+	camera_rtsp_reset(cam);
+	dir->count++;
+	return cam;
+}
+
+static void 
+camera_section_load(const char *section,void *ctx)
+{
+	core *co = (core *)ctx;
+	struct camera_dir_t *dir = co->cameras;
+	const char *id = section + strlen(CAMERA_SECTION_PREFIX);
+	char *url = NULL;
+	camera *cam = NULL;
+	unsigned int h;
+
+	if(0 != strncmp(section,CAMERA_SECTION_PREFIX,strlen(CAMERA_SECTION_PREFIX)))
+		return;
+	url = cfg_get_string(co->cfg,section,"url",NULL);
+	if('\0' == *id || NULL == url){
+		log(co,LOG_ERR,"[%s] needs an id and an url,ignored\n",section);
+		return;
+	}
+	if(NULL != camera_lookup(dir,id)){
+		log(co,LOG_ERR,"[%s] duplicated,ignored\n",section);
+		return;
+	}
+	cam = camera_add(co,id,url,
+		cfg_get_string(co->cfg,section,"username",NULL),
+		cfg_get_string(co->cfg,section,"password",NULL),
+		cfg_get_int(co->cfg,section,"prestart",co->rtsp_prestart),
+		cfg_get_int(co->cfg,section,"linger",co->rtsp_linger),
+		cfg_get_string(co->cfg,section,"transport",co->rtsp_transport));
+	h = camera_hash(cam->id);
+	cam->next = dir->hash[h];
+	dir->hash[h] = cam;
+	log(co,LOG_INFO,"camera(%d) %s=%s prestart=%d linger=%d interleaved=%d multicast=%d\n",
+		cam->index,cam->id,cam->url,cam->prestart,cam->linger,cam->interleaved,cam->multicast);
+}
+
+int 
+camera_init(core *co)
+{
+	struct camera_dir_t *dir = NULL;
+	int n = 0;
+
+	cfg_for_each_section(co->cfg,camera_section_count,&n);
+	if(NULL != co->rtsp_url)
+		n++;
+	if(n <= 0)
+		return -1;
+	
+	dir = (struct camera_dir_t *)osip_malloc(sizeof(struct camera_dir_t));
+	if(NULL == dir)
+		return -1;
+	memset(dir,0,sizeof(struct camera_dir_t));
+	dir->cams = (camera *)osip_malloc(sizeof(camera) * n);
+	if(NULL == dir->cams){
+		osip_free(dir);
+		return -1;
+	}
+	co->cameras = dir;
+
+	/* default camera first, index 0 */
+	if(NULL != co->rtsp_url){
+		dir->def = camera_add(co,"",co->rtsp_url,co->rtsp_username,co->rtsp_password,
+			co->rtsp_prestart,co->rtsp_linger,co->rtsp_transport);
+	}
+	cfg_for_each_section(co->cfg,camera_section_load,co);
+	if(dir->count <= 0)
+		return -1;
+	return 0;
+}
+
+int 
+camera_exit(core *co)
+{
+	struct camera_dir_t *dir = co->cameras;
+	camera *cam = NULL;
+	int i;
+	
+	if(NULL == dir)
+		return 0;
+	for(i = 0; i < dir->count; i++) {
+		cam = &dir->cams[i];
+		free_rtsp_client(cam->client);
+		osip_free(cam->id);
+		osip_free(cam->label);
+		osip_free(cam->url);
+		osip_free(cam->username);
+		osip_free(cam->password);
+	}
+	osip_free(dir->cams);
+	osip_free(dir);
+	co->cameras = NULL;
+	return 0;
+}
+
+int 
+camera_count(core *co)
+{
+	if(NULL == co->cameras)
+		return 0;
+	return co->cameras->count;
+}
+
+camera *
+camera_get(core *co,int index)
+{
+	if(NULL == co->cameras || index < 0 || index >= co->cameras->count)
+		return NULL;
+	return &co->cameras->cams[index];
+}
+
+/* metrics label, the default camera has no id */
+const char *
+camera_label(camera *cam)
+{
+	if(NULL == cam || NULL == cam->label)
+		return "default";
+	return cam->label;
+}
+
+/* request-uri user@host, then user, then the default camera */
+camera *
+camera_find(core *co,const char *user,const char *host)
+{
+	struct camera_dir_t *dir = co->cameras;
+	char id[HOST_BUFF_DEFAULT_LEN] = {0};
+	camera *cam = NULL;
+	
+	if(NULL == dir)
+		return NULL;
+	if(NULL != user && '\0' != *user){
+		if(NULL != host){
+			snprintf(id,sizeof(id)-1,"%s@%s",user,host);
+			cam = camera_lookup(dir,id);
+		}
+		if(NULL == cam){
+			cam = camera_lookup(dir,user);
+		}
+	}
+	if(NULL == cam){
+		cam = dir->def;
+	}
+	return cam;
+}
+
+camera *
+camera_of_call(core *co,int callid)
+{
+	sipcall *call = core_sipcall_get(co,callid);
+	
+	return NULL == call ? NULL : camera_get(co,call->camera);
+}
+
+int 
+camera_call_join(core *co,int callid,camera *cam)
+{
+	sipcall *call = core_sipcall_get(co,callid);
+
+	if(NULL == cam || NULL == call)
+		return -1;
+	if(cam->index == call->camera)
+		return 0;
+	if(call->camera >= 0)
+		return -1;
+	call->camera = cam->index;
+	cam->refcount++;
+	cam->idle_since = 0;
+	log(co,LOG_DEBUG,"call(%d-%d) join camera(%d) %s refcount=%d\n",
+		call->slot,callid,cam->index,cam->url,cam->refcount);
+	return 0;
+}
+
+/* 
+* the last call on a camera tears down its rtsp session and sockets,
+* a warm camera only pauses it.
+*/
+int 
+camera_call_leave(core *co,int callid)
+{
+	camera *cam = NULL;
+	sipcall *call = core_sipcall_get(co,callid);
+
+	if(NULL == call)
+		return -1;
+	cam = camera_get(co,call->camera);
+	call->camera = -1;
+	if(NULL == cam)
+		return -1;
+	
+	cam->refcount--;
+	log(co,LOG_DEBUG,"call(%d-%d) leave camera(%d) %s refcount=%d\n",
+		call->slot,callid,cam->index,cam->url,cam->refcount);
+	if(cam->refcount <= 0){
+		cam->refcount = 0;
+		if(cam->prestart || cam->linger > 0){
+			rtsp_pause(co,cam);
+			cam->idle_since = time(NULL);
+		}else{
+			rtsp_stop(co,cam);
+			stream_camera_stop(co,cam);
+		}
+	}
+	return cam->refcount;
+}
+
+void 
+camera_rtsp_reset(camera *cam)
+{
+	int i;
+	
+	memset(&cam->rtsp,0,sizeof(cam->rtsp));
+	for(i = 0; i < stream_max; i++) {
+		cam->rtsp.fds[i] = -1;
+		cam->rtsp.payload[i].media_format = -1;
+	}
+}
+
+static void 
+camera_warmed(core *co,camera *cam,int status)
+{
+	log(co,LOG_INFO,"camera(%d) %s warm session %d\n",cam->index,cam->url,status);
+	if(200 != status){
+		cam->warm_retry = time(NULL) + CAMERA_WARM_RETRY;
+	}
+}
+
+/* DESCRIBE/SETUP ahead of the first call, PLAY waits for a caller */
+static int 
+camera_warm(core *co,camera *cam)
+{
+	int ret = 0;
+	
+	/* without rtpproxy the camera streams straight to one caller */
+	if(0 == core_rtpproxy_get(co))
+		return -1;
+	ret = stream_camera_open(co,cam);
+	if(0 != ret)
+		return ret;
+	cam->idle_since = time(NULL);
+	return rtsp_open(co,cam,
+		co->sip_localip,ntohs(cam->rtsp.local[stream_video_rtp].sin_port),
+		co->sip_localip,ntohs(cam->rtsp.local[stream_audio_rtp].sin_port),
+		camera_warmed);
+}
+
+int 
+camera_prestart(core *co)
+{
+	camera *cam = NULL;
+	int i;
+	
+	for(i = 0; i < camera_count(co); i++) {
+		cam = camera_get(co,i);
+		if(cam->prestart && 0 != camera_warm(co,cam)){
+			log(co,LOG_NOTICE,"camera(%d) %s prestart failed\n",cam->index,cam->url);
+			cam->warm_retry = time(NULL) + CAMERA_WARM_RETRY;
+		}
+	}
+	return 0;
+}
+
+/* once a second: expire lingering sessions, reopen lost warm ones */
+void 
+camera_automatic_action(core *co)
+{
+	time_t now = time(NULL);
+	camera *cam = NULL;
+	int i;
+	
+	for(i = 0; i < camera_count(co); i++) {
+		cam = camera_get(co,i);
+		if(cam->refcount > 0)
+			continue;
+		if(cam->prestart){
+			if(!rtsp_alive(cam) && now >= cam->warm_retry){
+				cam->warm_retry = now + CAMERA_WARM_RETRY;
+				camera_warm(co,cam);
+			}
+		}else if(cam->idle_since > 0 && now - cam->idle_since >= cam->linger){
+			log(co,LOG_INFO,"camera(%d) %s idle for %ds,stop\n",cam->index,cam->url,cam->linger);
+			cam->idle_since = 0;
+			rtsp_stop(co,cam);
+			stream_camera_stop(co,cam);
+		}
+	}
+}
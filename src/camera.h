@@ -0,0 +1,76 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+ 
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+#include <time.h>
+#include "rtsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAMERA_HASH_SIZE		(256)		/* power of 2 */
+#define CAMERA_SECTION_PREFIX	"camera:"	/* [camera:<id>] */
+#define CAMERA_WARM_RETRY		(10)		/* seconds between prestart attempts */
+
+/* 
+* one rtsp upstream, shared by every sip call on it.
+* id is the sip request-uri user (or user@host), the default
+* camera from [rtsp] has no id and takes any unknown user.
+*/
+typedef struct camera_t {
+	int index;			/* directory slot, also the relay key */
+	char *id;
+	char *label;		/* id as a metrics label value */
+	char *url;
+	char *username;
+	char *password;
+	int refcount;		/* sip calls on this camera */
+	int prestart;		/* keep the rtsp session open without calls */
+	int linger;			/* seconds the session outlives its last call */
+	int interleaved;	/* rtp over the rtsp tcp connection */
+	int multicast;		/* join the camera's multicast group */
+	time_t idle_since;	/* last call left, 0: in use or closed */
+	time_t warm_retry;	/* next prestart attempt */
+	rtsp_client_t *client;
+	rtspserver rtsp;		/* rtpproxy camera side */
+	struct camera_t *next;	/* hash chain */
+} camera;
+
+int camera_init(core *co);
+int camera_exit(core *co);
+int camera_count(core *co);
+camera *camera_get(core *co,int index);
+const char *camera_label(camera *cam);
+camera *camera_find(core *co,const char *user,const char *host);
+camera *camera_of_call(core *co,int callid);
+int camera_call_join(core *co,int callid,camera *cam);
+int camera_call_leave(core *co,int callid);
+void camera_rtsp_reset(camera *cam);
+int camera_prestart(core *co);
+void camera_automatic_action(core *co);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
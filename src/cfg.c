@@ -681,6 +681,15 @@ void cfg_clean_section(Cfg *cfg, const char *section)
 	cfg->modified++;
 }
 
+void cfg_for_each_section(Cfg *cfg, void (*cb)(const char *section, void *ctx), void *ctx)
+{
+	CfgList *elem;
+	if( NULL == cfg || NULL == cb ) return ;
+	for(elem=cfg->sections;elem!=NULL;elem=elem->next){
+		cb(((CfgSection*)elem->data)->name,ctx);
+	}
+}
+
 int cfg_needs_commit(const Cfg *cfg)
 {
 	return cfg->modified>0;
@@ -145,6 +145,12 @@ int cfg_has_section(Cfg *cfg, const char *section);
  * @ingroup misc
 **/
 void cfg_clean_section(Cfg *cfg, const char *section);
+/**
+ * Calls cb once for every section name, in file order.
+ *
+ * @ingroup misc
+**/
+void cfg_for_each_section(Cfg *cfg, void (*cb)(const char *section, void *ctx), void *ctx);
 
 
 /*tells whether uncommited (with cfg_sync()) modifications exist*/
@@ -21,7 +21,9 @@
 #include <time.h>
 #include "rtsp_client.h"
 #include "rtpproxy.h"
+#include "camera.h"
 #include "core.h"
+#include "sip.h"
 #include "log.h"
 
 int 
@@ -35,23 +37,26 @@ core_remote_addr_set(core *co,int callid,stream_mode mode,b2b_side side,
 	}
 
 	if(side_sip == side){ /* sip */
-		int i = -1;
-		for(i = 0; i < co->maxcalls; i++) {
-			if(callid == co->sipcall[i].callid ){
-				if(NULL != host){
-					co->sipcall[i].remote[mode].sin_addr.s_addr = inet_addr(host);
-				}
-				if(port > 0){
-					co->sipcall[i].remote[mode].sin_port = htons(port);
-				}
-			}
+		sipcall *call = core_sipcall_get(co,callid);
+		if(NULL == call){
+			return -1;
+		}
+		if(NULL != host){
+			call->remote[mode].sin_addr.s_addr = inet_addr(host);
+		}
+		if(port > 0){
+			call->remote[mode].sin_port = htons(port);
 		}
 	}else{ /* rtsp */
+		camera *cam = camera_of_call(co,callid);
+		if(NULL == cam){
+			return -1;
+		}
 		if(NULL != host){
-			co->rtsp.remote[mode].sin_addr.s_addr = inet_addr(host);
+			cam->rtsp.remote[mode].sin_addr.s_addr = inet_addr(host);
 		}
 		if(port > 0){
-			co->rtsp.remote[mode].sin_port = htons(port);
+			cam->rtsp.remote[mode].sin_port = htons(port);
 		}
 	}
 	
@@ -72,17 +77,18 @@ core_remote_addr_get(core *co,int callid,stream_mode mode,b2b_side side,
 	}
 
 	if(side_sip == side){ /* sip */
-		int i = -1;
-		for(i = 0; i < co->maxcalls; i++) {
-			if(callid == co->sipcall[i].callid ){
-				tmp_host = inet_ntoa(co->sipcall[i].remote[mode].sin_addr);
-				tmp_port = ntohs(co->sipcall[i].remote[mode].sin_port);
-				break;
-			}
+		sipcall *call = core_sipcall_get(co,callid);
+		if(NULL != call){
+			tmp_host = inet_ntoa(call->remote[mode].sin_addr);
+			tmp_port = ntohs(call->remote[mode].sin_port);
 		}
 	}else{ /* rtsp */
-		tmp_host = inet_ntoa(co->rtsp.remote[mode].sin_addr);
-		tmp_port = ntohs(co->rtsp.remote[mode].sin_port);
+		camera *cam = camera_of_call(co,callid);
+		if(NULL == cam){
+			return -1;
+		}
+		tmp_host = inet_ntoa(cam->rtsp.remote[mode].sin_addr);
+		tmp_port = ntohs(cam->rtsp.remote[mode].sin_port);
 	}
 	
 	if(NULL != host && host_len > 0){
@@ -108,29 +114,31 @@ core_payload_set(core *co,int callid,stream_mode mode,b2b_side side,
 	}
 
 	if(side_sip == side){ /* sip */
-		int i = -1;
-		for(i = 0; i < co->maxcalls; i++) {
-			if(callid == co->sipcall[i].callid){
-				if(NULL != mime_type){
-					strncpy(co->sipcall[i].payload[mode].mime_type,mime_type,
-						sizeof(co->sipcall[i].payload[mode].mime_type)-1);
-				}
-				if(media_format >= 0){
-					co->sipcall[i].payload[mode].media_format = media_format;
-				}
-				log(co,LOG_DEBUG, "call(%d-%d) stream(%d) payload_set %d:%s\n",
-					i,co->sipcall[i].callid, mode, 
-					co->sipcall[i].payload[mode].media_format,co->sipcall[i].payload[mode].mime_type);
-				break;
-			}
+		sipcall *call = core_sipcall_get(co,callid);
+		if(NULL == call){
+			return -1;
+		}
+		if(NULL != mime_type){
+			strncpy(call->payload[mode].mime_type,mime_type,
+				sizeof(call->payload[mode].mime_type)-1);
+		}
+		if(media_format >= 0){
+			call->payload[mode].media_format = media_format;
 		}
+		log(co,LOG_DEBUG, "call(%d-%d) stream(%d) payload_set %d:%s\n",
+			call->slot,call->callid, mode, 
+			call->payload[mode].media_format,call->payload[mode].mime_type);
 	}else{ /* rtsp */
+		camera *cam = camera_of_call(co,callid);
+		if(NULL == cam){
+			return -1;
+		}
 		if(NULL != mime_type){
-			strncpy(co->rtsp.payload[mode].mime_type,mime_type,
-				sizeof(co->rtsp.payload[mode].mime_type)-1);
+			strncpy(cam->rtsp.payload[mode].mime_type,mime_type,
+				sizeof(cam->rtsp.payload[mode].mime_type)-1);
 		}
 		if(media_format >= 0){
-			co->rtsp.payload[mode].media_format = media_format;
+			cam->rtsp.payload[mode].media_format = media_format;
 		}
 	}
 
@@ -148,24 +156,25 @@ core_payload_get(core *co,int callid,stream_mode mode,b2b_side side,
 	}
 
 	if(side_sip == side){ /* sip */
-		int i = -1;
-		for(i = 0; i < co->maxcalls; i++) {
-			if(callid == co->sipcall[i].callid ){
-				if(NULL != mime_type && mime_type_len > 0){
-					strncpy(mime_type,co->sipcall[i].payload[mode].mime_type,mime_type_len);
-				}
-				if(NULL != media_format){
-					*media_format = co->sipcall[i].payload[mode].media_format;
-				}
-				break;
+		sipcall *call = core_sipcall_get(co,callid);
+		if(NULL != call){
+			if(NULL != mime_type && mime_type_len > 0){
+				strncpy(mime_type,call->payload[mode].mime_type,mime_type_len);
+			}
+			if(NULL != media_format){
+				*media_format = call->payload[mode].media_format;
 			}
 		}
 	}else{ /* rtsp */
+		camera *cam = camera_of_call(co,callid);
+		if(NULL == cam){
+			return -1;
+		}
 		if(NULL != mime_type && mime_type_len > 0){
-			strncpy(mime_type,co->rtsp.payload[mode].mime_type,mime_type_len);
+			strncpy(mime_type,cam->rtsp.payload[mode].mime_type,mime_type_len);
 		}
 		if(NULL != media_format){
-			*media_format = co->rtsp.payload[mode].media_format;
+			*media_format = cam->rtsp.payload[mode].media_format;
 		}
 	}
 	
@@ -185,17 +194,18 @@ core_local_addr_get(core *co,int callid,stream_mode mode, b2b_side side,
 		return -1;
 	}
 	if(side_sip == side){ /* sip */
-		int i = -1;
-		for(i = 0; i < co->maxcalls; i++) {
-			if( callid == co->sipcall[i].callid ){
-				tmp_host = inet_ntoa(co->sipcall[i].local[mode].sin_addr);
-				tmp_port = ntohs(co->sipcall[i].local[mode].sin_port);
-				break;
-			}
+		sipcall *call = core_sipcall_get(co,callid);
+		if(NULL != call){
+			tmp_host = inet_ntoa(call->local[mode].sin_addr);
+			tmp_port = ntohs(call->local[mode].sin_port);
 		}
 	}else{ /* rtsp */
-		tmp_host = inet_ntoa(co->rtsp.local[mode].sin_addr);
-		tmp_port = ntohs(co->rtsp.local[mode].sin_port);
+		camera *cam = camera_of_call(co,callid);
+		if(NULL == cam){
+			return -1;
+		}
+		tmp_host = inet_ntoa(cam->rtsp.local[mode].sin_addr);
+		tmp_port = ntohs(cam->rtsp.local[mode].sin_port);
 	}
 
 	if(NULL != host && host_len > 0){
@@ -227,20 +237,230 @@ core_rtp_end_port_get(core *co)
 	return co->rtp_end_port;
 }
 
-int 
-core_rtp_current_port_get(core *co)
+#define SIPCALL_AT(co,slot)	(&(co)->sipcall_slabs[(slot) / SIPCALL_SLAB][(slot) % SIPCALL_SLAB])
+#define CALLHASH_MIN		(16)
+
+/* 
+* callid => sipcall slot: linear probing over a table at most half
+* full, deletion shifts the run back so no tombstones are needed.
+*/
+static unsigned int 
+callhash_home(core *co,int callid)
 {
-	return co->rtp_current_port;
+	return ((unsigned int)callid * 2654435761u) & (co->callhash_size - 1);
 }
 
-int 
-core_rtp_current_port_set(core *co, int port)
+static int 
+callhash_find(core *co,int callid)
+{
+	unsigned int h;
+	int slot;
+	
+	if(NULL == co->callhash || callid < 0)
+		return -1;
+	for(h = callhash_home(co,callid); ; h = (h + 1) & (co->callhash_size - 1)) {
+		slot = co->callhash[h];
+		if(CALLHASH_EMPTY == slot)
+			return -1;
+		if(callid == SIPCALL_AT(co,slot)->callid)
+			return slot;
+	}
+}
+
+static void 
+callhash_insert(core *co,int slot)
+{
+	unsigned int h = callhash_home(co,SIPCALL_AT(co,slot)->callid);
+	
+	while(CALLHASH_EMPTY != co->callhash[h]) {
+		h = (h + 1) & (co->callhash_size - 1);
+	}
+	co->callhash[h] = slot;
+}
+
+static void 
+callhash_remove(core *co,int callid)
+{
+	unsigned int mask = co->callhash_size - 1;
+	unsigned int h, next, home;
+	
+	for(h = callhash_home(co,callid); ; h = (h + 1) & mask) {
+		if(CALLHASH_EMPTY == co->callhash[h])
+			return;
+		if(callid == SIPCALL_AT(co,co->callhash[h])->callid)
+			break;
+	}
+	/* pull back every later entry of the run that may move into the hole */
+	for(next = (h + 1) & mask; CALLHASH_EMPTY != co->callhash[next]; next = (next + 1) & mask) {
+		home = callhash_home(co,SIPCALL_AT(co,co->callhash[next])->callid);
+		if(((next - home) & mask) >= ((next - h) & mask)){
+			co->callhash[h] = co->callhash[next];
+			h = next;
+		}
+	}
+	co->callhash[h] = CALLHASH_EMPTY;
+}
+
+/* room for one more call at most half full, doubles and rehashes */
+static int 
+callhash_reserve(core *co,int calls)
 {
-	if(port >= co->rtp_start_port && port <= co->rtp_end_port){
-		co->rtp_current_port = port;
+	int *old = co->callhash;
+	int old_size = co->callhash_size;
+	int size = old_size;
+	int i;
+
+	while(size < 2 * calls) size <<= 1;
+	if(size == old_size)
 		return 0;
+	co->callhash = (int *)osip_malloc(sizeof(int) * size);
+	if(NULL == co->callhash){
+		co->callhash = old;
+		return -1;
 	}
-	return -1;
+	co->callhash_size = size;
+	for(i = 0; i < size; i++) {
+		co->callhash[i] = CALLHASH_EMPTY;
+	}
+	for(i = 0; i < old_size; i++) {
+		if(CALLHASH_EMPTY != old[i])
+			callhash_insert(co,old[i]);
+	}
+	osip_free(old);
+	return 0;
+}
+
+static void 
+sipcall_clear(core *co,int slot)
+{
+	sipcall *call = SIPCALL_AT(co,slot);
+	int i;
+	
+	memset(call,0,sizeof(sipcall));
+	call->slot = slot;
+	call->callid = -1;
+	call->camera = -1;
+	for(i = 0; i < stream_max; i++) {
+		call->payload[i].media_format = -1;
+	}
+}
+
+/* first empty directory entry gets a slab, its slots go on the free stack lowest first */
+static int 
+sipcall_slab_alloc(core *co)
+{
+	int s, slot, end;
+
+	for(s = 0; s < co->sipcall_nslabs; s++) {
+		if(NULL == co->sipcall_slabs[s])
+			break;
+	}
+	if(s == co->sipcall_nslabs)
+		return -1;
+	co->sipcall_slabs[s] = (sipcall *)osip_malloc(sizeof(sipcall) * SIPCALL_SLAB);
+	if(NULL == co->sipcall_slabs[s])
+		return -1;
+	co->slab_used[s] = 0;
+	end = (s + 1) * SIPCALL_SLAB;
+	if(end > co->maxcalls)
+		end = co->maxcalls;
+	for(slot = end - 1; slot >= s * SIPCALL_SLAB; slot--) {
+		sipcall_clear(co,slot);
+		co->freeslot[co->nfreeslot++] = slot;
+	}
+	if(co->sipcall_top < end)
+		co->sipcall_top = end;
+	log(co,LOG_DEBUG,"call table slab %d allocated,top=%d\n",s,co->sipcall_top);
+	return 0;
+}
+
+/* 
+* an empty slab goes away once another slab's worth of slots is free,
+* so a call count hovering at a slab boundary does not churn memory.
+*/
+static void 
+sipcall_slab_trim(core *co,int s)
+{
+	int i, n;
+
+	if(0 != co->slab_used[s] || co->nfreeslot < 2 * SIPCALL_SLAB)
+		return;
+	for(i = 0, n = 0; i < co->nfreeslot; i++) {
+		if(co->freeslot[i] / SIPCALL_SLAB != s)
+			co->freeslot[n++] = co->freeslot[i];
+	}
+	co->nfreeslot = n;
+	osip_free(co->sipcall_slabs[s]);
+	co->sipcall_slabs[s] = NULL;
+	while(co->sipcall_top > 0 && NULL == co->sipcall_slabs[(co->sipcall_top - 1) / SIPCALL_SLAB]) {
+		co->sipcall_top = ((co->sipcall_top - 1) / SIPCALL_SLAB) * SIPCALL_SLAB;
+	}
+	log(co,LOG_DEBUG,"call table slab %d released,top=%d\n",s,co->sipcall_top);
+}
+
+/* take a free slot for callid, -1: table full */
+static int 
+sipcall_alloc(core *co,int callid,int dialogid)
+{
+	sipcall *call = NULL;
+	int slot;
+	
+	if(core_sipcallnum_get(co) >= co->maxcalls)
+		return -1;
+	if(co->nfreeslot <= 0 && sipcall_slab_alloc(co) < 0)
+		return -1;
+	if(callhash_reserve(co,core_sipcallnum_get(co) + 1) < 0)
+		return -1;
+	slot = co->freeslot[--co->nfreeslot];
+	call = SIPCALL_AT(co,slot);
+	call->callid = callid;
+	call->dialogid = dialogid;
+	co->slab_used[slot / SIPCALL_SLAB]++;
+	callhash_insert(co,slot);
+	core_sipcallnum_add(co);
+	return slot;
+}
+
+static void 
+sipcall_free(core *co,int slot)
+{
+	sipcall_clear(co,slot);
+	co->freeslot[co->nfreeslot++] = slot;
+	co->slab_used[slot / SIPCALL_SLAB]--;
+	core_sipcallnum_sub(co);
+	sipcall_slab_trim(co,slot / SIPCALL_SLAB);
+}
+
+/* slot of callid, -1: no such call */
+int 
+core_sipcall_slot(core *co,int callid)
+{
+	return callhash_find(co,callid);
+}
+
+/* handle of callid, valid until the call is released */
+sipcall *
+core_sipcall_get(core *co,int callid)
+{
+	int slot = callhash_find(co,callid);
+	
+	return slot < 0 ? NULL : SIPCALL_AT(co,slot);
+}
+
+/* slot of the table, NULL: its slab is not allocated */
+sipcall *
+core_sipcall_at(core *co,int slot)
+{
+	if(slot < 0 || slot >= co->sipcall_top || NULL == co->sipcall_slabs[slot / SIPCALL_SLAB])
+		return NULL;
+	return SIPCALL_AT(co,slot);
+}
+
+/* scans over slots stop here */
+int 
+core_sipcall_top(core *co)
+{
+	return co->sipcall_top;
 }
 
 int 
@@ -250,14 +470,24 @@ core_sipclients_init(core *co)
 	if(co->maxcalls <= 0 ){
 		co->maxcalls = DEFAULT_MAX_SIPCALLS;
 	}
-	co->sipcall = (sipcall *)osip_malloc(sizeof(sipcall) * (co->maxcalls));
-	if( NULL == co->sipcall) {
+	/* only the directory is sized by maxcalls, slabs follow the calls */
+	co->sipcall_nslabs = (co->maxcalls + SIPCALL_SLAB - 1) / SIPCALL_SLAB;
+	co->sipcall_slabs = (sipcall **)osip_malloc(sizeof(sipcall *) * co->sipcall_nslabs);
+	co->slab_used = (int *)osip_malloc(sizeof(int) * co->sipcall_nslabs);
+	co->freeslot = (int *)osip_malloc(sizeof(int) * co->maxcalls);
+	co->callhash_size = CALLHASH_MIN;
+	co->callhash = (int *)osip_malloc(sizeof(int) * co->callhash_size);
+	if( NULL == co->sipcall_slabs || NULL == co->slab_used ||
+		NULL == co->freeslot || NULL == co->callhash ) {
 		return -1;
 	}
-	for(i = 0; i < co->maxcalls; i++) {
-		memset(&co->sipcall[i],0,sizeof(sipcall));
-		co->sipcall[i].callid = -1;
+	memset(co->sipcall_slabs,0,sizeof(sipcall *) * co->sipcall_nslabs);
+	memset(co->slab_used,0,sizeof(int) * co->sipcall_nslabs);
+	for(i = 0; i < co->callhash_size; i++) {
+		co->callhash[i] = CALLHASH_EMPTY;
 	}
+	co->nfreeslot = 0;
+	co->sipcall_top = 0;
 	return 0;
 }
 
@@ -268,33 +498,36 @@ core_init(core *co)
 	co->rtpproxy = 1;
 	co->rtp_start_port = 9000;
 	co->rtp_end_port = 9100;
-	co->rtp_current_port = co->rtp_start_port;
+	co->rtp_port_quarantine = 5;
 	co->symmetric_rtp = 1;
 	co->expiry = 3600;
 	co->session_timeout = 60;
 	co->log_level = LOG_ERR;
-
-	co->log_queue = (osip_fifo_t *)osip_malloc(sizeof(osip_fifo_t));
-	if(co->log_queue == NULL){
-		return -1;
-	}
-  
-	osip_fifo_init(co->log_queue);
+	co->epfd = -1;
+	co->log_fd = STDERR_FILENO;
 	return 0;
 }
 
 int 
 core_exit(core *co)
 {
+	int i;
+
 	log(co,LOG_NOTICE,"program has terminated.\n");
 
-	if(co->log_fd != NULL && co->log_fd != stderr){
-		fclose(co->log_fd);
-	}
+	log_exit(co);
 	
+	camera_exit(co);
+	if(co->epfd >= 0)
+		close(co->epfd);
 	cfg_destroy(co->cfg);
-	osip_fifo_free(co->log_queue);
-	osip_free(co->sipcall);
+	for(i = 0; i < co->sipcall_nslabs; i++) {
+		osip_free(co->sipcall_slabs[i]);
+	}
+	osip_free(co->sipcall_slabs);
+	osip_free(co->slab_used);
+	osip_free(co->callhash);
+	osip_free(co->freeslot);
 	return 0;
 }
 
@@ -309,20 +542,38 @@ core_show(core *co)
 	int i = -1;
 	stream_dir dir = stream_sendrecv;
 	char dir_str[32]={0};
-
-	for(i = 0; i < co->maxcalls; i++) {
-		if(-1 == co->sipcall[i].callid) 	continue;
+	camera *cam = NULL;
+	rtspserver none;
+	rtspserver *rtsp = NULL;
+	sipcall *call = NULL;
+	int slabs = 0;
+
+	for(i = 0; i < co->sipcall_nslabs; i++) {
+		if(NULL != co->sipcall_slabs[i]) slabs++;
+	}
+	log(co,LOG_INFO,"call table %d/%d calls,%d slabs of %d,top=%d\n",
+		core_sipcallnum_get(co),co->maxcalls,slabs,SIPCALL_SLAB,co->sipcall_top);
+	memset(&none,0,sizeof(none));
+	for(i = 0; i < co->sipcall_top; i++) {
+		call = core_sipcall_at(co,i);
+		if(NULL == call || -1 == call->callid) 	continue;
+		cam = camera_get(co,call->camera);
+		rtsp = (NULL != cam) ? &cam->rtsp : &none;
+		if(NULL != cam){
+			log(co,LOG_INFO,"call(%d-%d) camera(%d) %s refcount=%d\n",
+				i,call->callid,cam->index,cam->url,cam->refcount);
+		}
 
 		/* audio */
-		ip1 = (&co->sipcall[i].remote[stream_audio_rtp])->sin_addr.s_addr;
-		ip2 = (&co->sipcall[i].local[stream_audio_rtp])->sin_addr.s_addr;
-		ip3 = (&co->rtsp.local[stream_audio_rtp])->sin_addr.s_addr;
-		ip4 = (&co->rtsp.remote[stream_audio_rtp])->sin_addr.s_addr;
-		port1 = ntohs((&co->sipcall[i].remote[stream_audio_rtp])->sin_port);
-		port2 = ntohs((&co->sipcall[i].local[stream_audio_rtp])->sin_port);
-		port3 = ntohs((&co->rtsp.local[stream_audio_rtp])->sin_port);
-		port4 = ntohs((&co->rtsp.remote[stream_audio_rtp])->sin_port);
-		dir = core_sipcall_dir_get(co,co->sipcall[i].callid,stream_audio_rtp);
+		ip1 = (&call->remote[stream_audio_rtp])->sin_addr.s_addr;
+		ip2 = (&call->local[stream_audio_rtp])->sin_addr.s_addr;
+		ip3 = (&rtsp->local[stream_audio_rtp])->sin_addr.s_addr;
+		ip4 = (&rtsp->remote[stream_audio_rtp])->sin_addr.s_addr;
+		port1 = ntohs((&call->remote[stream_audio_rtp])->sin_port);
+		port2 = ntohs((&call->local[stream_audio_rtp])->sin_port);
+		port3 = ntohs((&rtsp->local[stream_audio_rtp])->sin_port);
+		port4 = ntohs((&rtsp->remote[stream_audio_rtp])->sin_port);
+		dir = core_sipcall_dir_get(co,call->callid,stream_audio_rtp);
 		if(stream_sendonly == dir || stream_inactive == dir) {
 			strncpy(dir_str,"==",sizeof(dir_str)-1);
 		}else{
@@ -330,32 +581,32 @@ core_show(core *co)
 		}
 		log(co,LOG_INFO,
 			"call(%d-%d) %d.%d.%d.%d:%d %s %d.%d.%d.%d:%d(%d:%s)-%d.%d.%d.%d:%d(%d:%s) %s %d.%d.%d.%d:%d\n",
-			i,co->sipcall[i].callid,
+			i,call->callid,
 			(ip1 >> 0)&0x000000FF,(ip1 >> 8)&0x000000FF,(ip1 >> 16)&0x000000FF,(ip1 >> 24)&0x000000FF,
 			port1,
 			dir_str,
 			(ip2 >> 0)&0x000000FF,(ip2 >> 8)&0x000000FF,(ip2 >> 16)&0x000000FF,(ip2 >> 24)&0x000000FF,
 			port2,
-			co->sipcall[i].payload[stream_audio_rtp].media_format,
-			co->sipcall[i].payload[stream_audio_rtp].mime_type,
+			call->payload[stream_audio_rtp].media_format,
+			call->payload[stream_audio_rtp].mime_type,
 			(ip3 >> 0)&0x000000FF,(ip3 >> 8)&0x000000FF,(ip3 >> 16)&0x000000FF,(ip3 >> 24)&0x000000FF,
 			port3,
-			co->rtsp.payload[stream_audio_rtp].media_format,
-			co->rtsp.payload[stream_audio_rtp].mime_type,
+			rtsp->payload[stream_audio_rtp].media_format,
+			rtsp->payload[stream_audio_rtp].mime_type,
 			dir_str,
 			(ip4 >> 0)&0x000000FF,(ip4 >> 8)&0x000000FF,(ip4 >> 16)&0x000000FF,(ip4 >> 24)&0x000000FF,
 			port4);
 
 		/* video */
-		ip5 = (&co->sipcall[i].remote[stream_video_rtp])->sin_addr.s_addr;
-		ip6 = (&co->sipcall[i].local[stream_video_rtp])->sin_addr.s_addr;
-		ip7 = (&co->rtsp.local[stream_video_rtp])->sin_addr.s_addr;
-		ip8 = (&co->rtsp.remote[stream_video_rtp])->sin_addr.s_addr;
-		port5 = ntohs((&co->sipcall[i].remote[stream_video_rtp])->sin_port);
-		port6 = ntohs((&co->sipcall[i].local[stream_video_rtp])->sin_port);
-		port7 = ntohs((&co->rtsp.local[stream_video_rtp])->sin_port);
-		port8 = ntohs((&co->rtsp.remote[stream_video_rtp])->sin_port);
-		dir = core_sipcall_dir_get(co,co->sipcall[i].callid,stream_video_rtp);
+		ip5 = (&call->remote[stream_video_rtp])->sin_addr.s_addr;
+		ip6 = (&call->local[stream_video_rtp])->sin_addr.s_addr;
+		ip7 = (&rtsp->local[stream_video_rtp])->sin_addr.s_addr;
+		ip8 = (&rtsp->remote[stream_video_rtp])->sin_addr.s_addr;
+		port5 = ntohs((&call->remote[stream_video_rtp])->sin_port);
+		port6 = ntohs((&call->local[stream_video_rtp])->sin_port);
+		port7 = ntohs((&rtsp->local[stream_video_rtp])->sin_port);
+		port8 = ntohs((&rtsp->remote[stream_video_rtp])->sin_port);
+		dir = core_sipcall_dir_get(co,call->callid,stream_video_rtp);
 		if(stream_sendonly == dir || stream_inactive == dir) {
 			strncpy(dir_str,"==",sizeof(dir_str)-1);
 		}else{
@@ -363,22 +614,23 @@ core_show(core *co)
 		}
 		log(co,LOG_INFO,
 			"call(%d-%d) %d.%d.%d.%d:%d %s %d.%d.%d.%d:%d(%d:%s)-%d.%d.%d.%d:%d(%d:%s) %s %d.%d.%d.%d:%d\n",
-			i,co->sipcall[i].callid,
+			i,call->callid,
 			(ip5 >> 0)&0x000000FF,(ip5 >> 8)&0x000000FF,(ip5 >> 16)&0x000000FF,(ip5 >> 24)&0x000000FF,
 			port5,
 			dir_str,
 			(ip6 >> 0)&0x000000FF,(ip6 >> 8)&0x000000FF,(ip6 >> 16)&0x000000FF,(ip6 >> 24)&0x000000FF,
 			port6,
-			co->sipcall[i].payload[stream_video_rtp].media_format,
-			co->sipcall[i].payload[stream_video_rtp].mime_type,
+			call->payload[stream_video_rtp].media_format,
+			call->payload[stream_video_rtp].mime_type,
 			(ip7 >> 0)&0x000000FF,(ip7 >> 8)&0x000000FF,(ip7 >> 16)&0x000000FF,(ip7 >> 24)&0x000000FF,
 			port7,
-			co->rtsp.payload[stream_video_rtp].media_format,
-			co->rtsp.payload[stream_video_rtp].mime_type,
+			rtsp->payload[stream_video_rtp].media_format,
+			rtsp->payload[stream_video_rtp].mime_type,
 			dir_str,
 			(ip8 >> 0)&0x000000FF,(ip8 >> 8)&0x000000FF,(ip8 >> 16)&0x000000FF,(ip8 >> 24)&0x000000FF,
 			port8);
 	}
+	streams_show(co);
 	
 	return 0;
 }
@@ -413,13 +665,12 @@ core_sipcall_release(core *co,int callid)
 {
 	int i = -1;
 	stream_call_stop(co, callid);
+	camera_call_leave(co, callid);
 	
-	for(i = 0; i < co->maxcalls; i++) {
-		if(callid == co->sipcall[i].callid){
-			memset(&co->sipcall[i],0,sizeof(sipcall));
-			co->sipcall[i].callid = -1;
-			core_sipcallnum_sub(co);
-		}
+	i = callhash_find(co,callid);
+	if(i >= 0){
+		callhash_remove(co,callid);
+		sipcall_free(co,i);
 	}
 	return 0;
 }
@@ -436,56 +687,50 @@ core_sipcall_set(core *co,struct eXosip_t *context,eXosip_event_t *je)
 	int when_callfull = co->when_callfull;
 	
 	/* find */
-	for(i = 0; i < co->maxcalls; i++) {
-		if(callid == co->sipcall[i].callid){
-			return 0;
-		}
+	if(callhash_find(co,callid) >= 0){
+		return 0;
 	}
 
+	/* new set */
+	if(sipcall_alloc(co,callid,dialogid) >= 0){
+		return 0;
+	}
+	
 	if( !when_callfull ) {
 		
-		/* new set */
-		for(i = 0; i < co->maxcalls; i++) {
-			if( -1 == co->sipcall[i].callid){
-				co->sipcall[i].callid = callid;
-				co->sipcall[i].dialogid = dialogid;
-				core_sipcallnum_add(co);
-				return 0;
-			}
-		}
-		
 		log(co,LOG_NOTICE,"maxcalls %d:%d full!\n",co->maxcalls,core_sipcallnum_get(co));
 		return -1;
 		
 	}else{ //when_callfull
 	
-		/* new set */
-		for(i = 0; i < co->maxcalls; i++) {
-			if( -1 == co->sipcall[i].callid){
-				co->sipcall[i].callid = callid;
-				co->sipcall[i].dialogid = dialogid;
-				core_sipcallnum_add(co);
-				return 0;
-			}else{
-				if(oldest_callid > co->sipcall[i].callid || -1 == oldest_callid){
-					oldest_callid = co->sipcall[i].callid;
-					oldest_dialogid = co->sipcall[i].dialogid;
-					oldest_index = i;
-				}
+		/* full, the only scan of the table */
+		for(i = 0; i < co->sipcall_top; i++) {
+			sipcall *call = core_sipcall_at(co,i);
+			if(NULL == call || -1 == call->callid)
+				continue;
+			if(oldest_callid > call->callid || -1 == oldest_callid){
+				oldest_callid = call->callid;
+				oldest_dialogid = call->dialogid;
+				oldest_index = i;
 			}
 		}
 		
 		/* no space,replace oldest */
-		if(oldest_index >= 0 && oldest_index < co->maxcalls){
+		if(oldest_index >= 0){
 			int ret = -1;
 			eXosip_lock(context);
 			ret = eXosip_call_terminate(context,oldest_callid,oldest_dialogid);
 			eXosip_unlock(context);
 			log(co,LOG_DEBUG,"eXosip_call_terminate call(%d-%d:%d)=%d\n",
 				oldest_index,oldest_callid,oldest_dialogid,ret);
+			sip_pending_remove(oldest_callid);
+			stream_call_stop(co,oldest_callid);
+			camera_call_leave(co,oldest_callid);
 			
-			co->sipcall[oldest_index].callid = callid;
-			co->sipcall[oldest_index].dialogid = dialogid;
+			callhash_remove(co,oldest_callid);
+			SIPCALL_AT(co,oldest_index)->callid = callid;
+			SIPCALL_AT(co,oldest_index)->dialogid = dialogid;
+			callhash_insert(co,oldest_index);
 			log(co,LOG_NOTICE,"maxcalls %d full,replace oldest call(%d-%d:%d) to call(%d-%d:%d)\n",
 				co->maxcalls,oldest_index,oldest_callid,oldest_dialogid,oldest_index,callid,dialogid);
 			
@@ -499,43 +744,36 @@ core_sipcall_set(core *co,struct eXosip_t *context,eXosip_event_t *je)
 int 
 core_audiodir_set(core *co,int callid,stream_dir dir)
 {
-	int i = -1;
-
-	for(i = 0; i < co->maxcalls; i++) {
-		if(callid == co->sipcall[i].callid){
-			co->sipcall[i].audio_dir = dir;
-		}
-	}
+	sipcall *call = core_sipcall_get(co,callid);
 
+	if(NULL == call)
+		return -1;
+	call->audio_dir = dir;
 	return 0;
 }
 
 int 
 core_videodir_set(core *co,int callid,stream_dir dir)
 {
-	int i = -1;
+	sipcall *call = core_sipcall_get(co,callid);
 
-	for(i = 0; i < co->maxcalls; i++) {
-		if(callid == co->sipcall[i].callid){
-			co->sipcall[i].video_dir = dir;
-		}
-	}
+	if(NULL == call)
+		return -1;
+	call->video_dir = dir;
 	return 0;
 }
 
 stream_dir 
 core_sipcall_dir_get(core *co,int callid,stream_mode mode)
 {
-	int i = -1;
+	sipcall *call = core_sipcall_get(co,callid);
 
-	for(i = 0; i < co->maxcalls; i++) {
-		if(callid == co->sipcall[i].callid){
-			if(stream_audio_rtp == mode || stream_audio_rtcp == mode) {	
-				return co->sipcall[i].audio_dir;
-			}
-			if(stream_video_rtp == mode || stream_video_rtcp == mode) {	
-				return co->sipcall[i].video_dir;
-			}
+	if(NULL != call){
+		if(stream_audio_rtp == mode || stream_audio_rtcp == mode) {	
+			return call->audio_dir;
+		}
+		if(stream_video_rtp == mode || stream_video_rtcp == mode) {	
+			return call->video_dir;
 		}
 	}
 	return stream_sendrecv;
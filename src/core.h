@@ -36,6 +36,9 @@
 #define UA_STRING  PROG_NAME " v" PROG_VER
 
 #define DEFAULT_MAX_SIPCALLS		(3)
+#define SIPCALL_SLAB			(16)	/* calls per slab of the call table */
+#define MAX_RTP_BATCH			(64)
+#define CALLHASH_EMPTY			(-1)
 
 typedef enum{
 	stream_audio_rtp = 0,
@@ -78,8 +81,10 @@ typedef struct rtspserver_t {
 	struct sockaddr_in	 local[stream_max];
 } rtspserver;
 typedef struct sipcall_t {
+	int	slot;		/* table handle, stable while the call lives */
 	int	callid;		
 	int	dialogid;	
+	int	camera;		/* camera index, -1: none */
 	int fds[stream_max];
 	payload_type payload[stream_max];
 	struct sockaddr_in	 remote[stream_max];
@@ -102,9 +107,13 @@ typedef struct core_t {
 	
 	/* debug */
 	char *log_file;
-	FILE *log_fd;
+	int log_fd;
 	int log_level; /* 0-7 , 0:EMERG, 7:DEBUG */
-	osip_fifo_t *log_queue;
+	int log_ring_size;	/* records of the log ring, full: lines are dropped */
+	int log_max_size;	/* bytes, rotate log_file past it, 0:never */
+	int log_max_files;	/* rotated files kept, log_file.1 newest */
+	int log_binary;	/* raw arguments, rendered by sip2rtsp_logdecode */
+	struct log_ring_t *log_ring;
 	struct osip_thread *log_thread;
 	
 	/* sip */
@@ -120,7 +129,18 @@ typedef struct core_t {
 	int expiry;
 	int maxcalls;
 	int when_callfull;
-	sipcall	*sipcall;
+	/* 
+	* call table: slot j is sipcall_slabs[j / SIPCALL_SLAB][j % SIPCALL_SLAB].
+	* slabs come and go with the live calls, scans stop at sipcall_top.
+	*/
+	sipcall	**sipcall_slabs;
+	int *slab_used;		/* live calls per slab */
+	int sipcall_nslabs;	/* directory size, covers maxcalls */
+	int sipcall_top;	/* end of the last allocated slab */
+	int *callhash;		/* callid => sipcall slot, CALLHASH_EMPTY if unused */
+	int callhash_size;	/* power of 2, at least 2 * live calls */
+	int *freeslot;		/* unused slots of allocated slabs */
+	int nfreeslot;
 	
 	/* rtsp */
 	char *rtsp_localip;
@@ -128,15 +148,34 @@ typedef struct core_t {
 	char *rtsp_username;
 	char *rtsp_password;
 	int session_timeout;
+	int rtsp_prestart;	/* default of [camera:<id>] prestart */
+	int rtsp_linger;	/* default of [camera:<id>] linger */
+	char *rtsp_transport;	/* default of [camera:<id>] transport, udp, tcp or multicast */
+	struct camera_dir_t *cameras;
+	int epfd;	/* signaling reactor: sip event socket, rtsp control connections */
+	char *stats_listen;	/* prometheus metrics, host:port or unix:/path */
+	int stats_fd;
 	
 	/* rtpproxy */
 	int symmetric_rtp;
+	int rtp_batch;	/* >1: recvmmsg/sendmmsg up to rtp_batch datagrams per wakeup */
+	char *rtp_backend;	/* relay thread: epoll or io_uring */
 	int rtpproxy;
 	int rtp_start_port;
 	int rtp_end_port;
-	int rtp_current_port;
+	int rtp_port_quarantine;	/* seconds a released port pair stays unused */
+	struct port_pool_t *port_pool;
+	int rtp_prebind;	/* bound pairs kept ready per side, 0:bind at call setup */
+	struct sock_prepool_t *prepool;
+	int rtp_shared_port;	/* >0: sip side media of every call on 4 sockets from here */
+	int rtcp_mux;	/* accept a=rtcp-mux offers, ask rtsp servers for RTCP-mux */
+	int rtp_gop_cache;	/* KB of camera video kept from the last keyframe, 0:off */
+	int rtp_keyframe_interval;	/* ms between pli/fir to one camera, 0:never ask */
+	int rtp_mtu;	/* >0: camera h264/h265 cut to fit this ip mtu on the sip side */
+	int rtp_send_queue;	/* datagrams per call stream waiting for a full socket, 0:drop */
 	int	sipcallnum;
-	rtspserver rtsp;
+	struct relay_t *relay;
+	struct osip_thread *relay_thread;
 
 } core;
 
@@ -163,8 +202,6 @@ int core_local_addr_get(core *co,int callid,stream_mode mode, b2b_side side,
 int core_rtpproxy_get(core *co);
 int core_rtp_start_port_get(core *co);
 int core_rtp_end_port_get(core *co);
-int core_rtp_current_port_get(core *co);
-int core_rtp_current_port_set(core *co, int port);
 int core_init(core *co);
 int core_show(core *co);
 int core_exit(core *co);
@@ -173,6 +210,10 @@ int core_sipcallnum_get(core *co);
 int core_sipcallnum_add(core *co);
 int core_sipcallnum_sub(core *co);
 int core_sipcall_release(core *co,int callid);
+int core_sipcall_slot(core *co,int callid);
+sipcall *core_sipcall_at(core *co,int slot);
+int core_sipcall_top(core *co);
+sipcall *core_sipcall_get(core *co,int callid);
 int core_sipcall_set(core *co,struct eXosip_t *context,eXosip_event_t *je);
 int core_audiodir_set(core *co,int callid,stream_dir dir);
 int core_videodir_set(core *co,int callid,stream_dir dir);
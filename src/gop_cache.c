@@ -0,0 +1,182 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <osip2/osip_mt.h>
+#include "gop_cache.h"
+
+#define GOP_CACHE_AVG_PACKET	(256)	/* index entries per byte of the bound */
+
+typedef enum {
+	gop_wait = 0,	/* no keyframe since the last reset or overflow */
+	gop_key,		/* parameter sets and keyframe coming in */
+	gop_frames		/* later frames of the group */
+} gop_state;
+
+typedef struct gop_packet_t {
+	size_t off;
+	size_t len;
+} gop_packet;
+
+struct gop_cache_t {
+	h26x_codec codec;
+	gop_state state;
+	size_t size;		/* bound in bytes */
+	size_t used;
+	int max;			/* bound in packets */
+	int count;
+	unsigned long gen;	/* bumped whenever the group starts over */
+	char *data;
+	gop_packet *packets;
+};
+
+gop_cache *
+gop_cache_new(size_t bytes)
+{
+	gop_cache *gc = (gop_cache *)osip_malloc(sizeof(gop_cache));
+
+	if(NULL == gc)
+		return NULL;
+	memset(gc,0,sizeof(gop_cache));
+	gc->size = bytes;
+	gc->max = (int)(bytes / GOP_CACHE_AVG_PACKET);
+	if(gc->max < 1)
+		gc->max = 1;
+	return gc;
+}
+
+static void 
+gop_cache_release(gop_cache *gc)
+{
+	osip_free(gc->data);
+	osip_free(gc->packets);
+	gc->data = NULL;
+	gc->packets = NULL;
+	gc->used = 0;
+	gc->count = 0;
+	gc->gen++;
+	gc->state = gop_wait;
+}
+
+void 
+gop_cache_free(gop_cache *gc)
+{
+	if(NULL == gc)
+		return;
+	gop_cache_release(gc);
+	osip_free(gc);
+}
+
+/* camera (re)started or gone: forget the group, h26x_none also frees the buffer */
+void 
+gop_cache_reset(gop_cache *gc,h26x_codec codec)
+{
+	if(NULL == gc)
+		return;
+	gc->codec = codec;
+	if(h26x_none == codec){
+		gop_cache_release(gc);
+		return;
+	}
+	gc->used = 0;
+	gc->count = 0;
+	gc->gen++;
+	gc->state = gop_wait;
+}
+
+/* one camera video rtp packet, in arrival order */
+void 
+gop_cache_add(gop_cache *gc,const char *pkt,size_t len)
+{
+	const unsigned char *payload = NULL;
+	size_t plen = 0;
+	h26x_kind kind;
+
+	if(NULL == gc || h26x_none == gc->codec)
+		return;
+	payload = h26x_rtp_payload(pkt,len,&plen);
+	kind = h26x_payload_kind(gc->codec,payload,plen);
+	if(h26x_param == kind || h26x_key == kind){
+		if(gop_key != gc->state){
+			gc->used = 0;
+			gc->count = 0;
+			gc->gen++;
+			gc->state = gop_key;
+		}
+	}else if(gop_wait == gc->state){
+		return;
+	}else if(h26x_slice == kind){
+		gc->state = gop_frames;
+	}
+
+	if(NULL == gc->data){
+		gc->data = (char *)osip_malloc(gc->size);
+		gc->packets = (gop_packet *)osip_malloc(sizeof(gop_packet) * gc->max);
+		if(NULL == gc->data || NULL == gc->packets){
+			gop_cache_release(gc);
+			return;
+		}
+	}
+	if(gc->count == gc->max || gc->used + len > gc->size){
+		/* half a group would only hand out a picture that breaks */
+		gc->used = 0;
+		gc->count = 0;
+		gc->gen++;
+		gc->state = gop_wait;
+		return;
+	}
+	memcpy(gc->data + gc->used,pkt,len);
+	gc->packets[gc->count].off = gc->used;
+	gc->packets[gc->count].len = len;
+	gc->count++;
+	gc->used += len;
+}
+
+/* packets to hand a new viewer, 0 while no keyframe is held */
+int 
+gop_cache_count(const gop_cache *gc)
+{
+	if(NULL == gc || gop_wait == gc->state)
+		return 0;
+	return gc->count;
+}
+
+size_t 
+gop_cache_bytes(const gop_cache *gc)
+{
+	return (NULL == gc || gop_wait == gc->state) ? 0 : gc->used;
+}
+
+/* changes when the packets handed out so far are no longer the first ones */
+unsigned long 
+gop_cache_gen(const gop_cache *gc)
+{
+	return (NULL == gc) ? 0 : gc->gen;
+}
+
+const char *
+gop_cache_packet(const gop_cache *gc,int k,size_t *len)
+{
+	if(k < 0 || k >= gop_cache_count(gc))
+		return NULL;
+	*len = gc->packets[k].len;
+	return gc->data + gc->packets[k].off;
+}
@@ -0,0 +1,53 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __GOP_CACHE_H__
+#define __GOP_CACHE_H__
+
+#include <stddef.h>
+#include "h26x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* rtp packets of one camera video stream from the latest parameter sets
+* and keyframe up to the newest packet, so a viewer that joins late gets
+* a decodable picture at once. a group that outgrows the bound is dropped
+* and the cache waits for the next keyframe. relay thread only, no locking;
+* the buffer is allocated with the first keyframe and freed by a reset.
+*/
+typedef struct gop_cache_t gop_cache;
+
+gop_cache *gop_cache_new(size_t bytes);
+void gop_cache_free(gop_cache *gc);
+void gop_cache_reset(gop_cache *gc,h26x_codec codec);
+void gop_cache_add(gop_cache *gc,const char *pkt,size_t len);
+int gop_cache_count(const gop_cache *gc);
+size_t gop_cache_bytes(const gop_cache *gc);
+unsigned long gop_cache_gen(const gop_cache *gc);
+const char *gop_cache_packet(const gop_cache *gc,int k,size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
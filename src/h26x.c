@@ -0,0 +1,130 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "h26x.h"
+
+#define RTP_FIXED_LEN	(12)
+
+/* rtpmap encoding name, "H264/90000" */
+h26x_codec 
+h26x_codec_of(const char *mime_type)
+{
+	if(NULL == mime_type)
+		return h26x_none;
+	if(0 == strncasecmp(mime_type,"H264",4))
+		return h26x_h264;
+	if(0 == strncasecmp(mime_type,"H265",4) || 0 == strncasecmp(mime_type,"HEVC",4))
+		return h26x_h265;
+	return h26x_none;
+}
+
+/* payload after csrcs and header extension, padding cut off, NULL: none */
+const unsigned char *
+h26x_rtp_payload(const char *pkt,size_t len,size_t *plen)
+{
+	const unsigned char *p = (const unsigned char *)pkt;
+	size_t off, pad = 0;
+
+	if(len <= RTP_FIXED_LEN || 2 != (p[0] >> 6))
+		return NULL;
+	off = RTP_FIXED_LEN + (p[0] & 0x0F) * 4;
+	if((p[0] & 0x10) != 0){
+		if(off + 4 > len)
+			return NULL;
+		off += 4 + (((size_t)p[off+2] << 8) | p[off+3]) * 4;
+	}
+	if((p[0] & 0x20) != 0)
+		pad = p[len-1];
+	if(off + pad >= len)
+		return NULL;
+	*plen = len - off - pad;
+	return p + off;
+}
+
+static h26x_kind 
+h264_nal_kind(unsigned char type)
+{
+	switch(type) {
+	case 5:
+		return h26x_key;
+	case 7:
+	case 8:
+		return h26x_param;
+	case 1:
+		return h26x_slice;
+	default:
+		return h26x_other;
+	}
+}
+
+static h26x_kind 
+h265_nal_kind(unsigned char type)
+{
+	if(type >= 16 && type <= 21)
+		return h26x_key;
+	if(type >= 32 && type <= 34)
+		return h26x_param;
+	if(type <= 9)
+		return h26x_slice;
+	return h26x_other;
+}
+
+/* 
+* what an rtp payload starts: a single nal unit, the first fragment of
+* one (fu-a/fu), or the strongest of an aggregate (stap-a/ap).
+*/
+h26x_kind 
+h26x_payload_kind(h26x_codec codec,const unsigned char *payload,size_t len)
+{
+	h26x_kind kind = h26x_other, k;
+	size_t off, n, hdr;
+	unsigned char type;
+
+	if(NULL == payload)
+		return h26x_other;
+	hdr = (h26x_h265 == codec) ? 2 : 1;
+	if(h26x_none == codec || len <= hdr)
+		return h26x_other;
+	type = (h26x_h265 == codec) ? (payload[0] >> 1) & 0x3F : payload[0] & 0x1F;
+
+	/* fragmentation unit: only the start carries the slice type */
+	if((h26x_h264 == codec && 28 == type) || (h26x_h265 == codec && 49 == type)){
+		if(0 == (payload[hdr] & 0x80))
+			return h26x_other;
+		type = payload[hdr] & ((h26x_h265 == codec) ? 0x3F : 0x1F);
+		return (h26x_h265 == codec) ? h265_nal_kind(type) : h264_nal_kind(type);
+	}
+	/* aggregation: 16 bit size before each nal unit */
+	if((h26x_h264 == codec && 24 == type) || (h26x_h265 == codec && 48 == type)){
+		for(off = hdr; off + 2 < len; off += 2 + n) {
+			n = ((size_t)payload[off] << 8) | payload[off+1];
+			if(0 == n || off + 2 + n > len)
+				break;
+			type = (h26x_h265 == codec) ? (payload[off+2] >> 1) & 0x3F : payload[off+2] & 0x1F;
+			k = (h26x_h265 == codec) ? h265_nal_kind(type) : h264_nal_kind(type);
+			if(k > kind)
+				kind = k;
+		}
+		return kind;
+	}
+	return (h26x_h265 == codec) ? h265_nal_kind(type) : h264_nal_kind(type);
+}
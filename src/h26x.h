@@ -0,0 +1,55 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __H26X_H__
+#define __H26X_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* just enough of rfc6184 (h264) and rfc7798 (h265) payloads to tell
+* parameter sets and keyframes from other slices.
+*/
+typedef enum {
+	h26x_none = 0,	/* not a video codec we look into */
+	h26x_h264,
+	h26x_h265
+} h26x_codec;
+
+typedef enum {
+	h26x_other = 0,	/* sei, aud, fragment continuation: belongs to the current frame */
+	h26x_slice,		/* non-idr slice start */
+	h26x_param,		/* vps/sps/pps */
+	h26x_key		/* idr (h265: irap) slice start */
+} h26x_kind;
+
+h26x_codec h26x_codec_of(const char *mime_type);
+const unsigned char *h26x_rtp_payload(const char *pkt,size_t len,size_t *plen);
+h26x_kind h26x_payload_kind(h26x_codec codec,const unsigned char *payload,size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,9 +25,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include "log.h"
+#include "log_format.h"
 
-#define BUFF_SIZE        (2048)
+#define BUFF_SIZE        (2048)	/* one record, longer lines are cut */
+#define LOG_RING_DEFAULT	(1024)	/* records */
+#define LOG_WRITEV_MAX		(64)
+
+/* 
+* bounded MPSC ring of preformatted lines. a producer claims slot pos
+* when its seq == pos, formats in place and publishes seq = pos + 1;
+* the writer thread hands runs of published slots to writev and frees
+* them with seq = pos + size. full ring: the line is dropped and counted.
+*/
+typedef struct log_record_t {
+	unsigned long seq;
+	int len;
+	char text[BUFF_SIZE];
+} log_record;
+
+/* a log() call site of the binary format */
+typedef struct log_site_t {
+	const char *file;
+	int line;
+	const char *format;
+} log_site;
+
+struct log_ring_t {
+	log_record *records;
+	unsigned long mask;
+	unsigned long head __attribute__((aligned(64)));	/* next slot to claim, producers */
+	unsigned long tail __attribute__((aligned(64)));	/* next slot to write, writer only */
+	unsigned long dropped;	/* since the last report */
+	unsigned long dropped_total;
+	unsigned long written;	/* bytes in the current file */
+	int sleeping;	/* writer waits on efd */
+	int quit;
+	int efd;
+
+	/* binary format: site ids, and which ones the current file defines */
+	log_site sites[LOG_BIN_SITES];
+	unsigned int nsites;
+	unsigned char defined[LOG_BIN_SITES];
+};
 
 static const char *
 log_strlevel(int level)
@@ -56,66 +100,476 @@ log_strlevel(int level)
 	return NULL;
 }
 
+static void 
+log_wakeup(struct log_ring_t *ring)
+{
+	uint64_t one = 1;
+
+	if(__atomic_load_n(&ring->sleeping,__ATOMIC_SEQ_CST) &&
+		__atomic_exchange_n(&ring->sleeping,0,__ATOMIC_SEQ_CST)){
+		if(write(ring->efd,&one,sizeof(one)) < 0){
+			/* counter saturated, the writer is awake anyway */
+		}
+	}
+}
+
+/* id of a call site, assigned on its first binary record, 0: table full */
+static unsigned int 
+log_site_id(struct log_ring_t *ring,unsigned int *site,const char *file,int line,const char *format)
+{
+	unsigned int id = __atomic_load_n(site,__ATOMIC_ACQUIRE);
+	unsigned int expected = 0;
+
+	if(0 != id)
+		return id;
+	id = __atomic_add_fetch(&ring->nsites,1,__ATOMIC_RELAXED);
+	if(id >= LOG_BIN_SITES)
+		return 0;
+	ring->sites[id].file = file;
+	ring->sites[id].line = line;
+	ring->sites[id].format = format;
+	if(!__atomic_compare_exchange_n(site,&expected,id,0,__ATOMIC_RELEASE,__ATOMIC_ACQUIRE))
+		id = expected;	/* another thread won, our slot stays unused */
+	return id;
+}
+
+#define LOG_BIN_PUT(out,end,val) \
+	if((out) + sizeof(val) > (end)) break; \
+	memcpy((out),&(val),sizeof(val)); \
+	(out) += sizeof(val)
+
+/* 
+* raw arguments instead of text: numbers as 8 bytes, strings copied,
+* cut when the record is full (the decoder marks it).
+*/
+static int 
+log_bin_encode(char *buf,int size,unsigned int id,int level,const char *format,va_list args)
+{
+	log_bin_head *head = (log_bin_head *)buf;
+	char *out = buf + sizeof(log_bin_head);
+	char *end = buf + size;
+	struct timespec ts;
+	log_spec spec;
+	const char *p = format;
+	const char *str = NULL;
+	int64_t v;
+	double d;
+	uint16_t n;
+	va_list ap;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	head->type = LOG_BIN_EVENT;
+	head->level = level;
+	head->id = id;
+	head->ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	va_copy(ap,args);
+	while(NULL != (p = log_spec_next(p,&spec))) {
+		p += spec.len;
+		if('%' == spec.conv)
+			continue;
+		if(spec.star_width){
+			v = va_arg(ap,int);
+			LOG_BIN_PUT(out,end,v);
+		}
+		if(spec.star_precision){
+			v = va_arg(ap,int);
+			LOG_BIN_PUT(out,end,v);
+		}
+		if(log_spec_is_int(&spec)){
+			switch(spec.length) {
+				case log_len_l:
+					v = log_spec_is_unsigned(&spec) ? (int64_t)va_arg(ap,unsigned long) : va_arg(ap,long);
+					break;
+				case log_len_ll:
+					v = va_arg(ap,long long);
+					break;
+				case log_len_z:
+					v = va_arg(ap,size_t);
+					break;
+				case log_len_j:
+					v = va_arg(ap,intmax_t);
+					break;
+				case log_len_t:
+					v = va_arg(ap,ptrdiff_t);
+					break;
+				case log_len_hh:
+					v = log_spec_is_unsigned(&spec) ? (unsigned char)va_arg(ap,int) : (signed char)va_arg(ap,int);
+					break;
+				case log_len_h:
+					v = log_spec_is_unsigned(&spec) ? (unsigned short)va_arg(ap,int) : (short)va_arg(ap,int);
+					break;
+				default:
+					v = log_spec_is_unsigned(&spec) ? (int64_t)va_arg(ap,unsigned int) : va_arg(ap,int);
+					break;
+			}
+			LOG_BIN_PUT(out,end,v);
+		}else if(log_spec_is_double(&spec)){
+			d = log_len_L == spec.length ? (double)va_arg(ap,long double) : va_arg(ap,double);
+			LOG_BIN_PUT(out,end,d);
+		}else if('s' == spec.conv){
+			str = va_arg(ap,const char *);
+			if(NULL == str)
+				str = "(null)";
+			if(out + sizeof(n) >= end)
+				break;
+			n = strnlen(str,end - out - sizeof(n));
+			memcpy(out,&n,sizeof(n));
+			memcpy(out + sizeof(n),str,n);
+			out += sizeof(n) + n;
+		}else if('p' == spec.conv){
+			v = (int64_t)(intptr_t)va_arg(ap,void *);
+			LOG_BIN_PUT(out,end,v);
+		}else if('n' == spec.conv){
+			(void)va_arg(ap,int *);
+		}else{
+			break;	/* unknown conversion, the rest would be misread */
+		}
+	}
+	va_end(ap);
+	head->len = out - buf;
+	return head->len;
+}
+
 void
-log_write(core *co, const char *file,int line,int level, const char *format, ...)
+log_write(core *co, const char *file,int line,unsigned int *site,int level, const char *format, ...)
 {
 	int lg;
 	va_list ap;
-	char *buf = NULL;
+	struct log_ring_t *ring = co->log_ring;
+	log_record *rec = NULL;
+	unsigned long pos, seq;
+	unsigned int id = 0;
 	char fmt[]="%s|%s:%d ";
 
 	if(level > co->log_level)
 		return;
-	buf = (char *)malloc(BUFF_SIZE*sizeof(char));
-	if(NULL == buf){
-		printf("malloc NULL\n");
-	}
-	
 	va_start(ap, format);
+	if(NULL == ring){	/* before log_init */
+		fprintf(stderr, fmt, log_strlevel(level),file,line);
+		vfprintf(stderr, format, ap);
+		va_end(ap);
+		return;
+	}
 
-	lg=snprintf(buf, BUFF_SIZE, fmt, log_strlevel(level),file,line);
-	if(lg < BUFF_SIZE){
-		lg+=vsnprintf(buf+lg, BUFF_SIZE-lg, format, ap);
+	if(co->log_binary){
+		id = log_site_id(ring,site,file,line,format);
+		if(0 == id){
+			__atomic_fetch_add(&ring->dropped,1,__ATOMIC_RELAXED);
+			va_end(ap);
+			return;
+		}
+	}
+
+	pos = __atomic_load_n(&ring->head,__ATOMIC_RELAXED);
+	for(;;) {
+		rec = &ring->records[pos & ring->mask];
+		seq = __atomic_load_n(&rec->seq,__ATOMIC_ACQUIRE);
+		if(seq == pos){
+			if(__atomic_compare_exchange_n(&ring->head,&pos,pos + 1,1,
+				__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+				break;
+		}else if((long)(seq - pos) < 0){	/* writer still owes this slot */
+			__atomic_fetch_add(&ring->dropped,1,__ATOMIC_RELAXED);
+			va_end(ap);
+			return;
+		}else{
+			pos = __atomic_load_n(&ring->head,__ATOMIC_RELAXED);
+		}
+	}
+
+	if(co->log_binary){
+		rec->len = log_bin_encode(rec->text,BUFF_SIZE,id,level,format,ap);
+	}else{
+		lg=snprintf(rec->text, BUFF_SIZE, fmt, log_strlevel(level),file,line);
+		if(lg < BUFF_SIZE){
+			lg+=vsnprintf(rec->text+lg, BUFF_SIZE-lg, format, ap);
+		}
+		rec->len = lg < BUFF_SIZE ? lg : BUFF_SIZE - 1;
 	}
-	buf[BUFF_SIZE-1]='\0';
-	osip_fifo_add(co->log_queue,buf);
-	
 	va_end(ap);
+	__atomic_store_n(&rec->seq,pos + 1,__ATOMIC_SEQ_CST);
+	log_wakeup(ring);
+}
+
+static int 
+log_open(core *co,int flags)
+{
+	if(NULL == co->log_file || '\0' == co->log_file[0])
+		return STDERR_FILENO;
+	return open(co->log_file,O_WRONLY | O_CREAT | O_APPEND | flags,0644);
+}
+
+/* whole iov array, across short writes */
+static void 
+log_flush(core *co,struct iovec *iov,int n)
+{
+	struct log_ring_t *ring = co->log_ring;
+	ssize_t ret;
+
+	while(n > 0) {
+		ret = writev(co->log_fd,iov,n);
+		if(ret < 0){
+			if(EINTR == errno)
+				continue;
+			return;
+		}
+		ring->written += ret;
+		while(n > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n > 0){
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+/* a fresh file: binary ones open with the magic and define sites again */
+static void 
+log_file_start(core *co)
+{
+	struct log_ring_t *ring = co->log_ring;
+	struct iovec iov;
+
+	if(!co->log_binary)
+		return;
+	memset(ring->defined,0,sizeof(ring->defined));
+	iov.iov_base = LOG_BIN_MAGIC;
+	iov.iov_len = LOG_BIN_MAGIC_LEN;
+	log_flush(co,&iov,1);
+}
+
+/* LOG_BIN_DEF of site id, once per file before its first event */
+static void 
+log_bin_define(core *co,unsigned int id)
+{
+	struct log_ring_t *ring = co->log_ring;
+	log_site *site = &ring->sites[id];
+	log_bin_head head;
+	struct iovec iov[4];
+	uint32_t line = site->line;
+
+	if(ring->defined[id])
+		return;
+	ring->defined[id] = 1;
+	memset(&head,0,sizeof(head));
+	head.type = LOG_BIN_DEF;
+	head.id = id;
+	iov[0].iov_base = &head;
+	iov[0].iov_len = sizeof(head);
+	iov[1].iov_base = &line;
+	iov[1].iov_len = sizeof(line);
+	iov[2].iov_base = (char *)site->file;
+	iov[2].iov_len = strlen(site->file) + 1;
+	iov[3].iov_base = (char *)site->format;
+	iov[3].iov_len = strnlen(site->format,UINT16_MAX - 64) + 1;
+	head.len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
+	log_flush(co,iov,4);
 }
 
 int 
 log_init(core *co)
 {
-	co->log_fd = NULL;
+	struct log_ring_t *ring = NULL;
+	unsigned long size = 1;
+	unsigned long i;
 	
+	co->log_fd = STDERR_FILENO;
 	if(co->log_level > 0){
-		if(co->log_file != NULL){
-			co->log_fd = fopen(co->log_file,"w+");
+		co->log_fd = log_open(co,O_TRUNC);
+		if(co->log_fd < 0){
+			printf("open %s failed:%s\n",co->log_file,strerror(errno));
+			co->log_fd = STDERR_FILENO;
 		}
 	}
+
+	if(co->log_ring_size <= 0)
+		co->log_ring_size = LOG_RING_DEFAULT;
+	while(size < (unsigned long)co->log_ring_size)
+		size <<= 1;
+	ring = (struct log_ring_t *)osip_malloc(sizeof(struct log_ring_t));
+	if(NULL == ring)
+		return -1;
+	memset(ring,0,sizeof(struct log_ring_t));
+	ring->records = (log_record *)osip_malloc(sizeof(log_record) * size);
+	ring->efd = eventfd(0,EFD_CLOEXEC);
+	if(NULL == ring->records || ring->efd < 0){
+		if(ring->efd >= 0)  close(ring->efd);
+		osip_free(ring->records);
+		osip_free(ring);
+		return -1;
+	}
+	for(i = 0; i < size; i++) {
+		ring->records[i].seq = i;
+	}
+	ring->mask = size - 1;
+	co->log_ring = ring;
+
+	if(co->log_binary && STDERR_FILENO == co->log_fd){
+		printf("binary log needs a logfile,text on stderr\n");
+		co->log_binary = 0;
+	}
+	log_file_start(co);
 	return 0;
 }
+
+/* move to <file>.1, older ones up to <file>.<logfiles>, start a new file */
+static void 
+log_rotate(core *co)
+{
+	char from[FILENAME_MAX];
+	char to[FILENAME_MAX];
+	int i, fd;
+
+	if(STDERR_FILENO == co->log_fd)
+		return;
+	for(i = co->log_max_files - 1; i > 0; i--) {
+		snprintf(from,sizeof(from),"%s.%d",co->log_file,i);
+		snprintf(to,sizeof(to),"%s.%d",co->log_file,i + 1);
+		rename(from,to);
+	}
+	if(co->log_max_files > 0){
+		snprintf(to,sizeof(to),"%s.1",co->log_file);
+		rename(co->log_file,to);
+	}
+	fd = log_open(co,O_TRUNC);
+	if(fd < 0)
+		return;		/* keep writing the old one */
+	close(co->log_fd);
+	co->log_fd = fd;
+	co->log_ring->written = 0;
+	log_file_start(co);
+}
+
+/* binary record built by the writer thread itself */
+static int 
+log_bin_direct(char *buf,int size,struct log_ring_t *ring,unsigned int *site,
+	const char *file,int line,int level,const char *format,...)
+{
+	unsigned int id = log_site_id(ring,site,file,line,format);
+	va_list ap;
+	int len;
+
+	if(0 == id)
+		return 0;
+	va_start(ap,format);
+	len = log_bin_encode(buf,size,id,level,format,ap);
+	va_end(ap);
+	return len;
+}
+
+/* lines lost to a full ring since the last call */
+static void 
+log_dropped_report(core *co)
+{
+	struct log_ring_t *ring = co->log_ring;
+	static unsigned int site = 0;
+	struct iovec iov;
+	char buf[128];
+	unsigned long dropped;
+
+	if(0 == __atomic_load_n(&ring->dropped,__ATOMIC_RELAXED))
+		return;
+	dropped = __atomic_exchange_n(&ring->dropped,0,__ATOMIC_RELAXED);
+	__atomic_store_n(&ring->dropped_total,ring->dropped_total + dropped,__ATOMIC_RELAXED);
+	iov.iov_base = buf;
+	if(co->log_binary){
+		iov.iov_len = log_bin_direct(buf,sizeof(buf),ring,&site,__FILE__,__LINE__,LOG_WARNING,
+			"%lu log lines dropped,ring full\n",dropped);
+		if(0 == iov.iov_len)
+			return;
+		log_bin_define(co,((log_bin_head *)buf)->id);
+	}else{
+		iov.iov_len = snprintf(buf,sizeof(buf),"%s|%s:%d %lu log lines dropped,ring full\n",
+			log_strlevel(LOG_WARNING),__FILE__,__LINE__,dropped);
+	}
+	log_flush(co,&iov,1);
+}
+
+unsigned long 
+log_dropped(core *co)
+{
+	if(NULL == co->log_ring)
+		return 0;
+	return __atomic_load_n(&co->log_ring->dropped_total,__ATOMIC_RELAXED) +
+		__atomic_load_n(&co->log_ring->dropped,__ATOMIC_RELAXED);
+}
 	
 void *
 log_loop(void *arg)
 {
 	core *co= (core *)arg;
-	char *buf = NULL;
-	FILE *fd = stderr;
-	
-	if(NULL != co->log_fd){
-		fd = co->log_fd;
-	}
+	struct log_ring_t *ring = co->log_ring;
+	struct iovec iov[LOG_WRITEV_MAX];
+	log_record *rec = NULL;
+	uint64_t val;
+	int n, k;
 	
 	for(;;) {
-		buf = (char *)osip_fifo_get(co->log_queue);
-		if( NULL != buf){
-			fprintf(fd,"%s",buf);
-			fflush(fd);
-			free(buf);
+		if(co->log_max_size > 0 && ring->written >= (unsigned long)co->log_max_size)
+			log_rotate(co);
+		log_dropped_report(co);
+		for(n = 0; n < LOG_WRITEV_MAX; n++) {
+			rec = &ring->records[(ring->tail + n) & ring->mask];
+			if(__atomic_load_n(&rec->seq,__ATOMIC_ACQUIRE) != ring->tail + n + 1)
+				break;
+			iov[n].iov_base = rec->text;
+			iov[n].iov_len = rec->len;
+		}
+		if(n > 0){
+			for(k = 0; co->log_binary && k < n; k++) {
+				log_bin_define(co,((log_bin_head *)iov[k].iov_base)->id);
+			}
+			log_flush(co,iov,n);
+			for(k = 0; k < n; k++, ring->tail++) {
+				__atomic_store_n(&ring->records[ring->tail & ring->mask].seq,
+					ring->tail + ring->mask + 1,__ATOMIC_RELEASE);
+			}
+			continue;
+		}
+		if(__atomic_load_n(&ring->quit,__ATOMIC_ACQUIRE))
+			break;
+
+		/* announce the nap, then look once more before blocking */
+		__atomic_store_n(&ring->sleeping,1,__ATOMIC_SEQ_CST);
+		rec = &ring->records[ring->tail & ring->mask];
+		if(__atomic_load_n(&rec->seq,__ATOMIC_SEQ_CST) == ring->tail + 1 ||
+			__atomic_load_n(&ring->quit,__ATOMIC_SEQ_CST)){
+			__atomic_store_n(&ring->sleeping,0,__ATOMIC_RELAXED);
+			continue;
 		}
+		if(read(ring->efd,&val,sizeof(val)) < 0 && EINTR != errno)
+			break;
 	}
 	return NULL;
 }
 
+/* drain what is queued, stop the writer thread */
+void 
+log_exit(core *co)
+{
+	struct log_ring_t *ring = co->log_ring;
+
+	if(NULL != ring){
+		__atomic_store_n(&ring->quit,1,__ATOMIC_SEQ_CST);
+		__atomic_store_n(&ring->sleeping,1,__ATOMIC_SEQ_CST);
+		log_wakeup(ring);
+		if(NULL != co->log_thread){
+			osip_thread_join(co->log_thread);
+			osip_free(co->log_thread);
+			co->log_thread = NULL;
+		}
+		co->log_ring = NULL;
+		close(ring->efd);
+		osip_free(ring->records);
+		osip_free(ring);
+	}
+	if(co->log_fd >= 0 && STDERR_FILENO != co->log_fd){
+		close(co->log_fd);
+	}
+	co->log_fd = STDERR_FILENO;
+}
 
@@ -34,13 +34,17 @@
 #define LOG_INFO        6       /* informational */
 #define LOG_DEBUG       7       /* debug-level messages */
 
-void log_write(core *, const char *, int,int, const char *, ...);
+void log_write(core *, const char *, int,unsigned int *,int, const char *, ...);
 
 int log_init(core *co);
 void *log_loop(void *arg);
+void log_exit(core *co);
+unsigned long log_dropped(core *co);
 
+/* log_site_: call site id of the binary log, format must be a literal */
 #define	log(co, level, format, args...){	\
-	log_write(co,__FILE__,__LINE__, level, format, ## args); \
+	static unsigned int log_site_ = 0;	\
+	log_write(co,__FILE__,__LINE__,&log_site_, level, format, ## args); \
 }
 
 #endif
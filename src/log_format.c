@@ -0,0 +1,121 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <string.h>
+#include "log_format.h"
+
+/* 
+* next conversion at or after p, NULL when the format ends.
+* shared by the binary log encoder and sip2rtsp_logdecode so both
+* walk the arguments the same way.
+*/
+const char *
+log_spec_next(const char *p,log_spec *spec)
+{
+	const char *q = NULL;
+
+	p = strchr(p,'%');
+	if(NULL == p)
+		return NULL;
+	memset(spec,0,sizeof(log_spec));
+	spec->start = p;
+	q = p + 1;
+	while('\0' != *q && NULL != strchr("-+ #0'",*q))
+		q++;
+	if('*' == *q){
+		spec->star_width = 1;
+		q++;
+	}
+	while(*q >= '0' && *q <= '9')
+		q++;
+	if('.' == *q){
+		q++;
+		if('*' == *q){
+			spec->star_precision = 1;
+			q++;
+		}
+		while(*q >= '0' && *q <= '9')
+			q++;
+	}
+	switch(*q) {
+		case 'h':
+			spec->length = log_len_h;
+			if('h' == *++q){
+				spec->length = log_len_hh;
+				q++;
+			}
+			break;
+		case 'l':
+			spec->length = log_len_l;
+			if('l' == *++q){
+				spec->length = log_len_ll;
+				q++;
+			}
+			break;
+		case 'q':
+			spec->length = log_len_ll;
+			q++;
+			break;
+		case 'z':
+			spec->length = log_len_z;
+			q++;
+			break;
+		case 'j':
+			spec->length = log_len_j;
+			q++;
+			break;
+		case 't':
+			spec->length = log_len_t;
+			q++;
+			break;
+		case 'L':
+			spec->length = log_len_L;
+			q++;
+			break;
+		default:
+			break;
+	}
+	if('\0' == *q){		/* dangling '%', print as is */
+		spec->conv = '%';
+		spec->len = q - p;
+		return p;
+	}
+	spec->conv = *q;
+	spec->len = q + 1 - p;
+	return p;
+}
+
+int 
+log_spec_is_int(const log_spec *spec)
+{
+	return NULL != strchr("diouxXc",spec->conv);
+}
+
+int 
+log_spec_is_unsigned(const log_spec *spec)
+{
+	return NULL != strchr("ouxX",spec->conv);
+}
+
+int 
+log_spec_is_double(const log_spec *spec)
+{
+	return NULL != strchr("eEfFgGaA",spec->conv);
+}
@@ -0,0 +1,84 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __LOG_FORMAT_H__
+#define __LOG_FORMAT_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* binary log ([debug] logformat=binary): the file starts with LOG_BIN_MAGIC,
+* then records of a log_bin_head and a payload. a LOG_BIN_DEF record names
+* a call site (line, file\0, format\0) before the first LOG_BIN_EVENT of
+* that id in the file; an event carries only the raw arguments, 8 bytes
+* per number, uint16 length + bytes per string. sip2rtsp_logdecode renders
+* the text offline. host byte order.
+*/
+#define LOG_BIN_MAGIC		"S2RLOG1\n"
+#define LOG_BIN_MAGIC_LEN	(8)
+#define LOG_BIN_DEF			(1)
+#define LOG_BIN_EVENT		(2)
+#define LOG_BIN_SITES		(1024)	/* log() call sites with an id */
+
+typedef struct log_bin_head_t {
+	uint16_t len;		/* whole record */
+	uint8_t type;
+	uint8_t level;
+	uint32_t id;		/* call site */
+	uint64_t ts;		/* ns since the epoch */
+} __attribute__((packed)) log_bin_head;
+
+/* printf conversion lengths */
+typedef enum {
+	log_len_none = 0,
+	log_len_hh,
+	log_len_h,
+	log_len_l,
+	log_len_ll,
+	log_len_z,
+	log_len_j,
+	log_len_t,
+	log_len_L
+} log_len;
+
+/* one %... of a format string */
+typedef struct log_spec_t {
+	const char *start;	/* the '%' */
+	int len;			/* through conv */
+	int star_width;		/* '*': an int argument comes first */
+	int star_precision;
+	log_len length;
+	char conv;			/* '%' for a literal percent */
+} log_spec;
+
+const char *log_spec_next(const char *p,log_spec *spec);
+int log_spec_is_int(const log_spec *spec);
+int log_spec_is_unsigned(const log_spec *spec);
+int log_spec_is_double(const log_spec *spec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
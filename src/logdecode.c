@@ -0,0 +1,240 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+/*
+* sip2rtsp_logdecode [file ...]
+* renders a [debug] logformat=binary log as text, stdin without files.
+* rotated files decode on their own, each one defines its call sites.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_format.h"
+
+#define DECODE_SPEC_LEN	(64)
+
+typedef struct decode_site_t {
+	char *file;
+	int line;
+	char *format;
+} decode_site;
+
+static const char *levels[] = {
+	"EMERG","ALERT","CRIT","ERR","WARN","NOTI","INFO","DBUG"
+};
+
+/* next raw argument, 0: record cut short */
+static int 
+decode_take(const char **p,const char *end,void *val,size_t len)
+{
+	if(*p + len > end)
+		return 0;
+	memcpy(val,*p,len);
+	*p += len;
+	return 1;
+}
+
+/* 
+* the spec with '*' replaced by the recorded values and the length 
+* modifier replaced by what the 8 byte value needs
+*/
+static int 
+decode_spec(const log_spec *spec,const char **p,const char *end,char *out,size_t size)
+{
+	const char *s = spec->start;
+	const char *conv = spec->start + spec->len - 1;
+	size_t n = 0;
+	int64_t star;
+
+	for(; s < conv && n + 24 < size; s++) {
+		if('*' == *s){
+			if(!decode_take(p,end,&star,sizeof(star)))
+				return -1;
+			n += snprintf(out + n,size - n,"%d",(int)star);
+		}else if(NULL == strchr("hlqzjtL",*s)){
+			out[n++] = *s;
+		}
+	}
+	if(log_spec_is_int(spec) && 'c' != spec->conv){
+		out[n++] = 'l';
+		out[n++] = 'l';
+	}
+	out[n++] = *conv;
+	out[n] = '\0';
+	return 0;
+}
+
+static void 
+decode_event(FILE *out,const decode_site *site,int level,uint64_t ts,const char *p,const char *end)
+{
+	char spec_str[DECODE_SPEC_LEN];
+	char tbuf[32];
+	char *str = NULL;
+	const char *fmt = site->format;
+	const char *q = NULL;
+	log_spec spec;
+	time_t sec = ts / 1000000000ULL;
+	struct tm tm;
+	int64_t v;
+	double d;
+	uint16_t n;
+
+	localtime_r(&sec,&tm);
+	strftime(tbuf,sizeof(tbuf),"%Y-%m-%d %H:%M:%S",&tm);
+	fprintf(out,"%s.%06u %s|%s:%d ",tbuf,(unsigned int)(ts % 1000000000ULL / 1000),
+		level >= 0 && level <= 7 ? levels[level] : "?",site->file,site->line);
+
+	while(NULL != (q = log_spec_next(fmt,&spec))) {
+		fwrite(fmt,1,q - fmt,out);
+		fmt = q + spec.len;
+		if('%' == spec.conv){
+			if(2 == spec.len)
+				fputc('%',out);
+			else
+				fwrite(spec.start,1,spec.len,out);
+			continue;
+		}
+		if(decode_spec(&spec,&p,end,spec_str,sizeof(spec_str)) < 0)
+			goto cut;
+		if(log_spec_is_int(&spec)){
+			if(!decode_take(&p,end,&v,sizeof(v)))
+				goto cut;
+			if('c' == spec.conv)
+				fprintf(out,spec_str,(int)v);
+			else if(log_spec_is_unsigned(&spec))
+				fprintf(out,spec_str,(unsigned long long)v);
+			else
+				fprintf(out,spec_str,(long long)v);
+		}else if(log_spec_is_double(&spec)){
+			if(!decode_take(&p,end,&d,sizeof(d)))
+				goto cut;
+			fprintf(out,spec_str,d);
+		}else if('s' == spec.conv){
+			if(!decode_take(&p,end,&n,sizeof(n)) || p + n > end)
+				goto cut;
+			str = (char *)malloc(n + 1);
+			if(NULL == str)
+				goto cut;
+			memcpy(str,p,n);
+			str[n] = '\0';
+			p += n;
+			fprintf(out,spec_str,str);
+			free(str);
+		}else if('p' == spec.conv){
+			if(!decode_take(&p,end,&v,sizeof(v)))
+				goto cut;
+			fprintf(out,spec_str,(void *)(intptr_t)v);
+		}else if('n' != spec.conv){
+			goto cut;
+		}
+	}
+	fputs(fmt,out);
+	return;
+cut:
+	fputs("<cut>\n",out);
+}
+
+static int 
+decode_file(FILE *in,const char *name,FILE *out)
+{
+	decode_site sites[LOG_BIN_SITES];
+	char magic[LOG_BIN_MAGIC_LEN];
+	log_bin_head head;
+	char *payload = NULL;
+	const char *p = NULL;
+	size_t len;
+	uint32_t line;
+	int ret = 0;
+	int i;
+
+	memset(sites,0,sizeof(sites));
+	if(1 != fread(magic,sizeof(magic),1,in) || 0 != memcmp(magic,LOG_BIN_MAGIC,LOG_BIN_MAGIC_LEN)){
+		fprintf(stderr,"%s: not a binary sip2rtsp log\n",name);
+		return -1;
+	}
+	payload = (char *)malloc(UINT16_MAX);
+	if(NULL == payload)
+		return -1;
+	while(1 == fread(&head,sizeof(head),1,in)) {
+		if(head.len < sizeof(head) || head.id >= LOG_BIN_SITES){
+			fprintf(stderr,"%s: corrupt record at %ld\n",name,ftell(in));
+			ret = -1;
+			break;
+		}
+		len = head.len - sizeof(head);
+		if(len > 0 && 1 != fread(payload,len,1,in)){
+			fprintf(stderr,"%s: truncated record\n",name);	/* killed while writing */
+			break;
+		}
+		if(LOG_BIN_DEF == head.type){
+			p = payload;
+			if(len < sizeof(line) + 2 || '\0' != payload[len - 1])
+				continue;
+			memcpy(&line,p,sizeof(line));
+			p += sizeof(line);
+			free(sites[head.id].file);
+			free(sites[head.id].format);
+			sites[head.id].line = line;
+			sites[head.id].file = strdup(p);
+			sites[head.id].format = strdup(p + strlen(p) + 1);
+		}else if(LOG_BIN_EVENT == head.type){
+			if(NULL == sites[head.id].format){
+				fprintf(out,"<site %u undefined>\n",head.id);
+				continue;
+			}
+			decode_event(out,&sites[head.id],head.level,head.ts,payload,payload + len);
+		}
+	}
+	for(i = 0; i < LOG_BIN_SITES; i++) {
+		free(sites[i].file);
+		free(sites[i].format);
+	}
+	free(payload);
+	return ret;
+}
+
+int 
+main(int argc,char *argv[])
+{
+	FILE *in = NULL;
+	int ret = 0;
+	int i;
+
+	if(argc < 2)
+		return decode_file(stdin,"stdin",stdout) < 0 ? 1 : 0;
+	for(i = 1; i < argc; i++) {
+		if(0 == strcmp(argv[i],"-h") || 0 == strcmp(argv[i],"--help")){
+			printf("usage: %s [binary log file ...]\n",argv[0]);
+			return 0;
+		}
+		in = fopen(argv[i],"rb");
+		if(NULL == in){
+			perror(argv[i]);
+			ret = 1;
+			continue;
+		}
+		if(decode_file(in,argv[i],stdout) < 0)
+			ret = 1;
+		fclose(in);
+	}
+	return ret;
+}
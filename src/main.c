@@ -25,6 +25,7 @@
 #include "rtpproxy.h"
 #include "sip.h"
 #include "log.h"
+#include "stats.h"
 
 static void 
 usage(void)
@@ -87,6 +88,14 @@ main(int argc, char *argv[])
 	}
 	co.log_level = cfg_get_int(co.cfg,"debug","level", LOG_ERR);
 	co.log_file = cfg_get_string(co.cfg,"debug","logfile", NULL);		
+	co.log_ring_size = cfg_get_int(co.cfg,"debug","logring", 1024);
+	co.log_max_size = cfg_get_int(co.cfg,"debug","logsize", 0) * 1024 * 1024;
+	co.log_max_files = cfg_get_int(co.cfg,"debug","logfiles", 3);
+	co.log_binary = (0 == strcmp(cfg_get_string(co.cfg,"debug","logformat", "text"),"binary"));
+	if(co.log_max_size < 0) {	/* logsize past 2047 */
+		printf("log_max_size invalid\n");
+		co.log_max_size = 0;
+	}
 	co.contact = cfg_get_string(co.cfg,"sip","contact", NULL);
 	co.expiry = cfg_get_int(co.cfg,"sip","expiry", 3600);
 	co.firewallip = cfg_get_string(co.cfg,"sip","firewallip", NULL);
@@ -104,6 +113,9 @@ main(int argc, char *argv[])
 	co.rtsp_username = cfg_get_string(co.cfg,"rtsp","username", NULL);
 	co.rtsp_password = cfg_get_string(co.cfg,"rtsp","password", NULL);
 	co.session_timeout = cfg_get_int(co.cfg,"rtsp","session_timeout", 60);
+	co.rtsp_prestart = cfg_get_int(co.cfg,"rtsp","prestart", 0);
+	co.rtsp_linger = cfg_get_int(co.cfg,"rtsp","linger", 0);
+	co.rtsp_transport = cfg_get_string(co.cfg,"rtsp","transport", "udp");
 	co.rtpproxy = cfg_get_int(co.cfg,"rtp","proxy", 1);
 	co.rtp_start_port = cfg_get_int(co.cfg,"rtp","start_port", 9000);
 	co.rtp_end_port = cfg_get_int(co.cfg,"rtp","end_port", 9100);
@@ -115,14 +127,51 @@ main(int argc, char *argv[])
 		co.rtp_start_port = 9000;
 		co.rtp_end_port = 9100;
 	}	
-	co.rtp_current_port = co.rtp_start_port;
+	co.rtp_port_quarantine = cfg_get_int(co.cfg,"rtp","port_quarantine", 5);
+	co.rtp_prebind = cfg_get_int(co.cfg,"rtp","prebind", 8);
+	co.rtp_shared_port = cfg_get_int(co.cfg,"rtp","shared_port", 0);
+	if(co.rtp_shared_port < 0 || co.rtp_shared_port % 2 != 0 ||
+		co.rtp_shared_port + stream_max > 65535 ||
+		(co.rtp_shared_port > 0 && co.rtp_shared_port + stream_max > co.rtp_start_port &&
+		co.rtp_shared_port < co.rtp_end_port)) {
+		printf("rtp_shared_port %d invalid\n",co.rtp_shared_port);
+		co.rtp_shared_port = 0;
+	}
 	co.symmetric_rtp = cfg_get_int(co.cfg,"rtp","symmetric", 1);
-	if(!co.proxy || !co.fromuser || !co.rtsp_url) {
+	co.rtcp_mux = cfg_get_int(co.cfg,"rtp","rtcp_mux", 1);
+	co.rtp_gop_cache = cfg_get_int(co.cfg,"rtp","gop_cache", 1024);
+	if(co.rtp_gop_cache < 0) {
+		printf("rtp_gop_cache %d invalid\n",co.rtp_gop_cache);
+		co.rtp_gop_cache = 0;
+	}
+	co.rtp_keyframe_interval = cfg_get_int(co.cfg,"rtp","keyframe_interval", 500);
+	co.rtp_mtu = cfg_get_int(co.cfg,"rtp","mtu", 0);
+	co.rtp_send_queue = cfg_get_int(co.cfg,"rtp","send_queue", 128);
+	if(co.rtp_send_queue < 0) {
+		printf("rtp_send_queue %d invalid\n",co.rtp_send_queue);
+		co.rtp_send_queue = 0;
+	}
+	if(co.rtp_mtu != 0 && (co.rtp_mtu < 576 || co.rtp_mtu > 9000)) {
+		printf("rtp_mtu %d invalid\n",co.rtp_mtu);
+		co.rtp_mtu = 0;
+	}
+	co.rtp_batch = cfg_get_int(co.cfg,"rtp","batch", 0);
+	if(co.rtp_batch < 0 || co.rtp_batch > MAX_RTP_BATCH) {
+		printf("rtp_batch %d invalid\n",co.rtp_batch);
+		co.rtp_batch = MAX_RTP_BATCH;
+	}
+	co.rtp_backend = cfg_get_string(co.cfg,"rtp","backend", "epoll");
+	co.stats_listen = cfg_get_string(co.cfg,"stats","listen", NULL);
+	co.stats_fd = -1;
+	if(!co.proxy || !co.fromuser) {
 		usage();
 		return -1;
 	}
 
-	log_init(&co);
+	if( 0 != log_init(&co) ) {
+		printf("log_init failed\n");
+		return -1;
+	}
 	
 	/* INIT Log File and Log LEVEL  */ 
 	co.log_thread = osip_thread_create(20000, log_loop, &co);
@@ -148,13 +197,31 @@ main(int argc, char *argv[])
 		"rtsp_username=%s\n"
 		"rtsp_password=%s\n"
 		"session_timeout=%d\n"
+		"rtsp_prestart=%d\n"
+		"rtsp_linger=%d\n"
+		"rtsp_transport=%s\n"
 		"rtpproxy=%d\n"
 		"rtp_start_port=%d\n"
 		"rtp_end_port=%d\n"
+		"rtp_port_quarantine=%d\n"
+		"rtp_prebind=%d\n"
+		"rtp_shared_port=%d\n"
 		"symmetric_rtp=%d\n"
+		"rtcp_mux=%d\n"
+		"rtp_gop_cache=%d\n"
+		"rtp_keyframe_interval=%d\n"
+		"rtp_mtu=%d\n"
+		"rtp_send_queue=%d\n"
+		"rtp_batch=%d\n"
+		"rtp_backend=%s\n"
+		"stats_listen=%s\n"
 		"cfg_file=%s\n"
 		"log_file=%s\n"
-		"log_level=%d\n",
+		"log_level=%d\n"
+		"log_ring_size=%d\n"
+		"log_max_size=%d\n"
+		"log_max_files=%d\n"
+		"log_binary=%d\n",
 		UA_STRING,
 		co.proxy,
 		co.outboundproxy,
@@ -172,13 +239,39 @@ main(int argc, char *argv[])
 		co.rtsp_username,
 		co.rtsp_password,
 		co.session_timeout,
+		co.rtsp_prestart,
+		co.rtsp_linger,
+		co.rtsp_transport,
 		co.rtpproxy,
 		co.rtp_start_port,
 		co.rtp_end_port,
+		co.rtp_port_quarantine,
+		co.rtp_prebind,
+		co.rtp_shared_port,
 		co.symmetric_rtp,
+		co.rtcp_mux,
+		co.rtp_gop_cache,
+		co.rtp_keyframe_interval,
+		co.rtp_mtu,
+		co.rtp_send_queue,
+		co.rtp_batch,
+		co.rtp_backend,
+		co.stats_listen ? co.stats_listen : "",
 		co.cfg_file,
 		co.log_file,
-		co.log_level);
+		co.log_level,
+		co.log_ring_size,
+		co.log_max_size,
+		co.log_max_files,
+		co.log_binary);
+
+	ret = camera_init(&co);
+	if( 0 != ret ) {
+		log(&co,LOG_ERR,"no camera,set [rtsp] url or a [" CAMERA_SECTION_PREFIX "<id>] section!\n");
+		usage();
+		return -1;
+	}
+	log(&co,LOG_INFO,"%d camera(s)\n",camera_count(&co));
 
 	ret = sip_init(&co);
 	if( 0 != ret ) {
@@ -191,14 +284,19 @@ main(int argc, char *argv[])
 		log(&co,LOG_ERR,"streams_init failed!\n");
 		return -1;
 	}
+	if( 0 != stats_init(&co) ) {
+		log(&co,LOG_WARNING,"stats_init failed,metrics off!\n");
+	}
+	camera_prestart(&co);
 
 	/* main loop */
 	sip_uas_loop(&co);
 
 	/* exit */
+	stats_exit(&co);
 	streams_stop(&co);
 	core_exit(&co);
 	
 	return ret;
 }
-
\ No newline at end of file
+
@@ -0,0 +1,195 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <osip2/osip_mt.h>
+#include "port_pool.h"
+
+#define PORT_POOL_WORD_BITS	(64)
+
+typedef enum {
+	port_pair_free = 0,
+	port_pair_used,
+	port_pair_quarantined
+} port_pair_state;
+
+typedef struct port_quarantine_t {
+	int pair;
+	time_t until;
+} port_quarantine;
+
+struct port_pool_t {
+	int start_port;
+	int npairs;
+	int quarantine;		/* seconds */
+	int nwords;
+	uint64_t *bits;		/* 1: pair free */
+	uint64_t *summary;	/* 1: bits word has a free pair */
+	unsigned char *state;
+	port_quarantine *fifo;	/* npairs entries, released in time order */
+	int fifo_head;
+	int fifo_count;
+	int used;
+	unsigned long allocs;
+	unsigned long exhausted;
+};
+
+static void 
+port_pool_set_free(port_pool *pool,int pair)
+{
+	int w = pair / PORT_POOL_WORD_BITS;
+
+	pool->bits[w] |= 1ULL << (pair % PORT_POOL_WORD_BITS);
+	pool->summary[w / PORT_POOL_WORD_BITS] |= 1ULL << (w % PORT_POOL_WORD_BITS);
+	pool->state[pair] = port_pair_free;
+}
+
+/* quarantine over: back to the bitmap */
+static void 
+port_pool_expire(port_pool *pool,time_t now)
+{
+	port_quarantine *q = NULL;
+
+	while(pool->fifo_count > 0) {
+		q = &pool->fifo[pool->fifo_head];
+		if(q->until > now)
+			break;
+		port_pool_set_free(pool,q->pair);
+		pool->fifo_head = (pool->fifo_head + 1) % pool->npairs;
+		pool->fifo_count--;
+	}
+}
+
+port_pool *
+port_pool_new(int start_port,int end_port,int quarantine)
+{
+	port_pool *pool = NULL;
+	int nsummary;
+	int i;
+
+	if(start_port <= 0 || end_port <= start_port)
+		return NULL;
+	pool = (port_pool *)osip_malloc(sizeof(port_pool));
+	if(NULL == pool)
+		return NULL;
+	memset(pool,0,sizeof(port_pool));
+	pool->start_port = start_port;
+	pool->npairs = (end_port - start_port + 1) / 2;
+	pool->quarantine = quarantine > 0 ? quarantine : 0;
+	pool->nwords = (pool->npairs + PORT_POOL_WORD_BITS - 1) / PORT_POOL_WORD_BITS;
+	nsummary = (pool->nwords + PORT_POOL_WORD_BITS - 1) / PORT_POOL_WORD_BITS;
+	pool->bits = (uint64_t *)osip_malloc(sizeof(uint64_t) * pool->nwords);
+	pool->summary = (uint64_t *)osip_malloc(sizeof(uint64_t) * nsummary);
+	pool->state = (unsigned char *)osip_malloc(pool->npairs);
+	pool->fifo = (port_quarantine *)osip_malloc(sizeof(port_quarantine) * pool->npairs);
+	if(NULL == pool->bits || NULL == pool->summary || NULL == pool->state || NULL == pool->fifo){
+		port_pool_free(pool);
+		return NULL;
+	}
+	memset(pool->bits,0,sizeof(uint64_t) * pool->nwords);
+	memset(pool->summary,0,sizeof(uint64_t) * nsummary);
+	for(i = 0; i < pool->npairs; i++) {
+		port_pool_set_free(pool,i);
+	}
+	return pool;
+}
+
+void 
+port_pool_free(port_pool *pool)
+{
+	if(NULL == pool)
+		return;
+	osip_free(pool->bits);
+	osip_free(pool->summary);
+	osip_free(pool->state);
+	osip_free(pool->fifo);
+	osip_free(pool);
+}
+
+/* even port of a free pair, -1: every pair used or quarantined */
+int 
+port_pool_alloc(port_pool *pool,time_t now)
+{
+	int s, w, pair;
+	int nsummary = (pool->nwords + PORT_POOL_WORD_BITS - 1) / PORT_POOL_WORD_BITS;
+
+	port_pool_expire(pool,now);
+	for(s = 0; s < nsummary; s++) {
+		if(0 != pool->summary[s])
+			break;
+	}
+	if(s == nsummary){
+		pool->exhausted++;
+		return -1;
+	}
+	w = s * PORT_POOL_WORD_BITS + __builtin_ctzll(pool->summary[s]);
+	pair = w * PORT_POOL_WORD_BITS + __builtin_ctzll(pool->bits[w]);
+	pool->bits[w] &= pool->bits[w] - 1;
+	if(0 == pool->bits[w])
+		pool->summary[s] &= ~(1ULL << (w % PORT_POOL_WORD_BITS));
+	pool->state[pair] = port_pair_used;
+	pool->used++;
+	pool->allocs++;
+	return pool->start_port + 2 * pair;
+}
+
+/* 
+* even port of an allocated pair; ports outside the range or not handed
+* out (shared, multicast) are ignored so callers need not tell them apart.
+*/
+int 
+port_pool_release(port_pool *pool,int port,time_t now)
+{
+	port_quarantine *q = NULL;
+	int pair;
+
+	if(NULL == pool || port < pool->start_port || (port - pool->start_port) % 2 != 0)
+		return -1;
+	pair = (port - pool->start_port) / 2;
+	if(pair >= pool->npairs || port_pair_used != pool->state[pair])
+		return -1;
+	pool->used--;
+	if(0 == pool->quarantine){
+		port_pool_set_free(pool,pair);
+		return 0;
+	}
+	q = &pool->fifo[(pool->fifo_head + pool->fifo_count) % pool->npairs];
+	q->pair = pair;
+	q->until = now + pool->quarantine;
+	pool->fifo_count++;
+	pool->state[pair] = port_pair_quarantined;
+	return 0;
+}
+
+void 
+port_pool_usage_get(port_pool *pool,time_t now,port_pool_usage *usage)
+{
+	memset(usage,0,sizeof(port_pool_usage));
+	if(NULL == pool)
+		return;
+	port_pool_expire(pool,now);
+	usage->total = pool->npairs;
+	usage->used = pool->used;
+	usage->quarantined = pool->fifo_count;
+	usage->free = pool->npairs - pool->used - pool->fifo_count;
+	usage->allocs = pool->allocs;
+	usage->exhausted = pool->exhausted;
+}
@@ -0,0 +1,59 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __PORT_POOL_H__
+#define __PORT_POOL_H__
+
+#include <time.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* rtp/rtcp port pairs of [rtp] start_port..end_port, even port first.
+* free pairs are bits of a two level bitmap, so an allocation is a couple
+* of ctz; released pairs wait quarantine seconds in a fifo before they are
+* handed out again, so late packets of the old call do not reach a new one.
+* signaling thread only, no locking.
+*/
+typedef struct port_pool_t port_pool;
+
+typedef struct port_pool_usage_t {
+	int total;		/* pairs */
+	int used;
+	int quarantined;
+	int free;
+	unsigned long allocs;
+	unsigned long exhausted;	/* allocations that found nothing */
+} port_pool_usage;
+
+port_pool *port_pool_new(int start_port,int end_port,int quarantine);
+void port_pool_free(port_pool *pool);
+int port_pool_alloc(port_pool *pool,time_t now);
+int port_pool_release(port_pool *pool,int port,time_t now);
+void port_pool_usage_get(port_pool *pool,time_t now,port_pool_usage *usage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "relay_uring.h"
+
+/* multishot recvmsg and provided buffer rings: linux 6.0 headers */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_RECV_MULTISHOT)
+#define RELAY_URING		1
+#endif
+#endif
+#endif
+
+#ifdef RELAY_URING
+
+#define RELAY_URING_BGID	(0)		/* the one provided buffer group */
+
+struct relay_uring_t {
+	int fd;
+
+	/* submission ring, sqes are published on submit */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	/* completion ring */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	size_t sqes_len;
+
+	/* provided buffers: nbufs of buflen, handed back with relay_uring_buf_put */
+	struct io_uring_buf_ring *br;
+	size_t br_len;
+	unsigned short br_tail;
+	unsigned int nbufs;
+	unsigned int buflen;
+	char *bufs;
+	struct msghdr recv_msg;	/* layout of a multishot recvmsg buffer */
+};
+
+static int
+uring_setup(unsigned int entries,struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int
+uring_enter(int fd,unsigned int to_submit,unsigned int min_complete,unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,NULL,0);
+}
+
+static int
+uring_register(int fd,unsigned int opcode,void *arg,unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+}
+
+static int
+uring_map(relay_uring *u,struct io_uring_params *p)
+{
+	unsigned int *array;
+	unsigned int i;
+
+	u->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	u->cq_ring_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if(p->features & IORING_FEAT_SINGLE_MMAP){
+		if(u->cq_ring_len > u->sq_ring_len)
+			u->sq_ring_len = u->cq_ring_len;
+		u->cq_ring_len = u->sq_ring_len;
+	}
+	u->sq_ring = mmap(NULL,u->sq_ring_len,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQ_RING);
+	if(MAP_FAILED == u->sq_ring){
+		u->sq_ring = NULL;
+		return -1;
+	}
+	if(p->features & IORING_FEAT_SINGLE_MMAP){
+		u->cq_ring = u->sq_ring;
+	}else{
+		u->cq_ring = mmap(NULL,u->cq_ring_len,PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_CQ_RING);
+		if(MAP_FAILED == u->cq_ring){
+			u->cq_ring = NULL;
+			return -1;
+		}
+	}
+	u->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = (struct io_uring_sqe *)mmap(NULL,u->sqes_len,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQES);
+	if(MAP_FAILED == (void *)u->sqes){
+		u->sqes = NULL;
+		return -1;
+	}
+
+	u->sq_head = (unsigned int *)((char *)u->sq_ring + p->sq_off.head);
+	u->sq_tail = (unsigned int *)((char *)u->sq_ring + p->sq_off.tail);
+	u->sq_mask = *(unsigned int *)((char *)u->sq_ring + p->sq_off.ring_mask);
+	u->sq_entries = p->sq_entries;
+	u->sq_local_tail = *u->sq_tail;
+	array = (unsigned int *)((char *)u->sq_ring + p->sq_off.array);
+	for(i = 0; i < p->sq_entries; i++) {
+		array[i] = i;	/* sqe i always sits in slot i */
+	}
+	u->cq_head = (unsigned int *)((char *)u->cq_ring + p->cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_ring + p->cq_off.tail);
+	u->cq_mask = *(unsigned int *)((char *)u->cq_ring + p->cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p->cq_off.cqes);
+	return 0;
+}
+
+/* nbufs a power of 2, at most 32768 */
+static int
+uring_bufs_init(relay_uring *u,unsigned int nbufs,unsigned int buflen)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int bid;
+
+	u->nbufs = nbufs;
+	u->buflen = buflen;
+	u->br_len = nbufs * sizeof(struct io_uring_buf);
+	u->br = (struct io_uring_buf_ring *)mmap(NULL,u->br_len,PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(MAP_FAILED == (void *)u->br){
+		u->br = NULL;
+		return -1;
+	}
+	u->bufs = (char *)osip_malloc(nbufs * buflen);
+	if(NULL == u->bufs)
+		return -1;
+
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries = nbufs;
+	reg.bgid = RELAY_URING_BGID;
+	if(uring_register(u->fd,IORING_REGISTER_PBUF_RING,&reg,1) < 0)
+		return -1;
+	u->br_tail = 0;
+	for(bid = 0; bid < nbufs; bid++) {
+		relay_uring_buf_put(u,bid);
+	}
+
+	/* recvmsg out header, then the source address, then the datagram */
+	memset(&u->recv_msg,0,sizeof(u->recv_msg));
+	u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+	return 0;
+}
+
+int
+relay_uring_init(core *co,relay_uring **pring,unsigned int entries,
+	unsigned int nbufs,unsigned int buflen)
+{
+	struct io_uring_params p;
+	relay_uring *u = NULL;
+
+	*pring = NULL;
+	u = (relay_uring *)osip_malloc(sizeof(relay_uring));
+	if(NULL == u)
+		return -1;
+	memset(u,0,sizeof(relay_uring));
+
+	/* fan-out completes many sends per receive */
+	memset(&p,0,sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 4 * entries;
+	u->fd = uring_setup(entries,&p);
+	if(u->fd < 0){
+		log(co,LOG_ERR,"io_uring setup(%u) failed:%s\n",entries,strerror(errno));
+		osip_free(u);
+		return -1;
+	}
+	if(0 != uring_map(u,&p)){
+		log(co,LOG_ERR,"io_uring mmap failed:%s\n",strerror(errno));
+		relay_uring_free(u);
+		return -1;
+	}
+	if(0 != uring_bufs_init(u,nbufs,buflen)){
+		log(co,LOG_ERR,"io_uring %u provided buffers failed:%s\n",nbufs,strerror(errno));
+		relay_uring_free(u);
+		return -1;
+	}
+	log(co,LOG_INFO,"io_uring sq=%u cq=%u bufs=%u*%u features=0x%x\n",
+		p.sq_entries,p.cq_entries,nbufs,buflen,p.features);
+	*pring = u;
+	return 0;
+}
+
+void
+relay_uring_free(relay_uring *u)
+{
+	if(NULL == u)
+		return;
+	if(u->fd >= 0)
+		close(u->fd);
+	if(NULL != u->sqes)
+		munmap(u->sqes,u->sqes_len);
+	if(NULL != u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring,u->cq_ring_len);
+	if(NULL != u->sq_ring)
+		munmap(u->sq_ring,u->sq_ring_len);
+	if(NULL != u->br)
+		munmap(u->br,u->br_len);
+	osip_free(u->bufs);
+	osip_free(u);
+}
+
+/* publish the filled sqes, returns how many the kernel has not consumed */
+static unsigned int
+uring_sq_publish(relay_uring *u)
+{
+	__atomic_store_n(u->sq_tail,u->sq_local_tail,__ATOMIC_RELEASE);
+	return u->sq_local_tail - __atomic_load_n(u->sq_head,__ATOMIC_ACQUIRE);
+}
+
+int
+relay_uring_submit(relay_uring *u)
+{
+	unsigned int n = uring_sq_publish(u);
+
+	if(0 == n)
+		return 0;
+	return uring_enter(u->fd,n,0,0);
+}
+
+/* a zeroed sqe, NULL only if the kernel could not take a full ring */
+static struct io_uring_sqe *
+uring_sqe_get(relay_uring *u)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if(u->sq_local_tail - __atomic_load_n(u->sq_head,__ATOMIC_ACQUIRE) >= u->sq_entries){
+		relay_uring_submit(u);
+		if(u->sq_local_tail - __atomic_load_n(u->sq_head,__ATOMIC_ACQUIRE) >= u->sq_entries)
+			return NULL;
+	}
+	sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+	memset(sqe,0,sizeof(*sqe));
+	u->sq_local_tail++;
+	return sqe;
+}
+
+int
+relay_uring_recv_multishot(relay_uring *u,int fd,uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(u);
+
+	if(NULL == sqe)
+		return -1;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)&u->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RELAY_URING_BGID;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int
+relay_uring_poll_multishot(relay_uring *u,int fd,uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(u);
+
+	if(NULL == sqe)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+/* msg and what it points to must stay put until the completion */
+int
+relay_uring_sendmsg(relay_uring *u,int fd,const struct msghdr *msg,uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(u);
+
+	if(NULL == sqe)
+		return -1;
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+/* every request on fd, submitted at once so fd may be closed right after */
+int
+relay_uring_cancel_fd(relay_uring *u,int fd,uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(u);
+
+	if(NULL == sqe)
+		return -1;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = user_data;
+	return relay_uring_submit(u);
+}
+
+/* submit what is pending, wait for at least one completion, reap up to max */
+int
+relay_uring_wait(relay_uring *u,relay_uring_cqe *cqes,int max)
+{
+	unsigned int head = *u->cq_head;
+	unsigned int tail = __atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE);
+	unsigned int n = uring_sq_publish(u);
+	struct io_uring_cqe *cqe = NULL;
+	int count = 0;
+
+	if(head == tail || n > 0){
+		if(uring_enter(u->fd,n,head == tail ? 1 : 0,IORING_ENTER_GETEVENTS) < 0 &&
+			EINTR != errno && EBUSY != errno && EAGAIN != errno){
+			return -1;
+		}
+		tail = __atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE);
+	}
+	while(head != tail && count < max) {
+		cqe = &u->cqes[head & u->cq_mask];
+		cqes[count].user_data = cqe->user_data;
+		cqes[count].res = cqe->res;
+		cqes[count].flags = cqe->flags;
+		count++;
+		head++;
+	}
+	__atomic_store_n(u->cq_head,head,__ATOMIC_RELEASE);
+	return count;
+}
+
+int
+relay_uring_cqe_more(const relay_uring_cqe *cqe)
+{
+	return 0 != (cqe->flags & IORING_CQE_F_MORE);
+}
+
+/*
+* one multishot recvmsg completion: the datagram and its source.
+* returns the payload length, or -1 without a buffer. *bid is set
+* whenever the completion carries one, it goes back with buf_put.
+*/
+int
+relay_uring_recv_get(relay_uring *u,const relay_uring_cqe *cqe,
+	char **payload,struct sockaddr_in *from,unsigned int *bid)
+{
+	struct io_uring_recvmsg_out *out = NULL;
+	char *buf = NULL;
+	size_t skip;
+	int len;
+
+	if(!(cqe->flags & IORING_CQE_F_BUFFER))
+		return -1;
+	*bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	skip = sizeof(*out) + u->recv_msg.msg_namelen + u->recv_msg.msg_controllen;
+	if(cqe->res < 0 || (size_t)cqe->res < skip || *bid >= u->nbufs)
+		return 0;
+	buf = u->bufs + *bid * u->buflen;
+	out = (struct io_uring_recvmsg_out *)buf;
+	if(NULL != from){
+		memset(from,0,sizeof(*from));
+		memcpy(from,buf + sizeof(*out),
+			out->namelen < sizeof(*from) ? out->namelen : sizeof(*from));
+	}
+	*payload = buf + skip;
+	len = (int)out->payloadlen;
+	if(len > cqe->res - (int)skip)
+		len = cqe->res - (int)skip;	/* MSG_TRUNC */
+	return len;
+}
+
+void
+relay_uring_buf_put(relay_uring *u,unsigned int bid)
+{
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+
+	b->addr = (uint64_t)(uintptr_t)(u->bufs + bid * u->buflen);
+	b->len = u->buflen;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail,u->br_tail,__ATOMIC_RELEASE);
+}
+
+#else	/* RELAY_URING */
+
+int
+relay_uring_init(core *co,relay_uring **pring,unsigned int entries,
+	unsigned int nbufs,unsigned int buflen)
+{
+	*pring = NULL;
+	log(co,LOG_ERR,"io_uring not available in this build\n");
+	return -1;
+}
+
+void relay_uring_free(relay_uring *ring) {}
+int relay_uring_recv_multishot(relay_uring *ring,int fd,uint64_t user_data) { return -1; }
+int relay_uring_poll_multishot(relay_uring *ring,int fd,uint64_t user_data) { return -1; }
+int relay_uring_sendmsg(relay_uring *ring,int fd,const struct msghdr *msg,uint64_t user_data) { return -1; }
+int relay_uring_cancel_fd(relay_uring *ring,int fd,uint64_t user_data) { return -1; }
+int relay_uring_submit(relay_uring *ring) { return -1; }
+int relay_uring_wait(relay_uring *ring,relay_uring_cqe *cqes,int max) { return -1; }
+int relay_uring_cqe_more(const relay_uring_cqe *cqe) { return 0; }
+int relay_uring_recv_get(relay_uring *ring,const relay_uring_cqe *cqe,
+	char **payload,struct sockaddr_in *from,unsigned int *bid) { return -1; }
+void relay_uring_buf_put(relay_uring *ring,unsigned int bid) {}
+
+#endif	/* RELAY_URING */
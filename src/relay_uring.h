@@ -0,0 +1,62 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __RELAY_URING_H__
+#define __RELAY_URING_H__
+
+#include <sys/socket.h>
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* io_uring for the media relay, raw syscalls (no liburing).
+* one submission/completion ring plus one provided buffer ring that
+* multishot recvmsg picks its buffers from. used by the relay thread only.
+*/
+typedef struct relay_uring_t relay_uring;
+
+typedef struct relay_uring_cqe_t {
+	uint64_t user_data;
+	int res;
+	unsigned int flags;
+} relay_uring_cqe;
+
+int relay_uring_init(core *co,relay_uring **pring,unsigned int entries,
+	unsigned int nbufs,unsigned int buflen);
+void relay_uring_free(relay_uring *ring);
+int relay_uring_recv_multishot(relay_uring *ring,int fd,uint64_t user_data);
+int relay_uring_poll_multishot(relay_uring *ring,int fd,uint64_t user_data);
+int relay_uring_sendmsg(relay_uring *ring,int fd,const struct msghdr *msg,uint64_t user_data);
+int relay_uring_cancel_fd(relay_uring *ring,int fd,uint64_t user_data);
+int relay_uring_submit(relay_uring *ring);
+int relay_uring_wait(relay_uring *ring,relay_uring_cqe *cqes,int max);
+int relay_uring_cqe_more(const relay_uring_cqe *cqe);
+int relay_uring_recv_get(relay_uring *ring,const relay_uring_cqe *cqe,
+	char **payload,struct sockaddr_in *from,unsigned int *bid);
+void relay_uring_buf_put(relay_uring *ring,unsigned int bid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
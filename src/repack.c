@@ -0,0 +1,344 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <osip2/osip_mt.h>
+#include "repack.h"
+
+#define REPACK_MAX_OUT		(256)	/* packets out of one push */
+#define REPACK_MAX_LIMIT	(9000)	/* largest packet out, the held aggregate */
+#define REPACK_MAX_PACKET	(65535)	/* camera packets in, up to an interleaved frame */
+#define REPACK_ARENA		(2 * REPACK_MAX_PACKET)
+#define REPACK_MIN_CHUNK	(64)	/* less room per fragment: forward as is */
+
+typedef struct repack_out_t {
+	size_t off;
+	size_t len;
+} repack_out;
+
+struct repack_t {
+	h26x_codec codec;
+	size_t limit;		/* largest rtp packet out */
+	int started;
+	uint16_t in_seq;	/* last camera sequence number */
+	uint16_t out_seq;	/* last sequence number out */
+
+	/* single nal units held for an aggregate: [16 bit size][nal] each */
+	unsigned char held_hdr[REPACK_MAX_LIMIT];
+	size_t held_hl;
+	unsigned char held[REPACK_MAX_LIMIT];
+	size_t held_len;
+	int held_count;
+	int held_marker;
+	uint32_t held_ts;
+
+	unsigned char arena[REPACK_ARENA];
+	size_t used;
+	repack_out out[REPACK_MAX_OUT];
+	int nout;
+	int full;			/* an output did not fit the arena */
+};
+
+repack *
+repack_new(size_t limit)
+{
+	repack *rp = (repack *)osip_malloc(sizeof(repack));
+
+	if(NULL == rp)
+		return NULL;
+	memset(rp,0,sizeof(repack));
+	rp->limit = (limit > REPACK_MAX_LIMIT) ? REPACK_MAX_LIMIT : limit;
+	return rp;
+}
+
+void 
+repack_free(repack *rp)
+{
+	osip_free(rp);
+}
+
+/* camera (re)started: new sequence space and codec, nothing held */
+void 
+repack_reset(repack *rp,h26x_codec codec)
+{
+	if(NULL == rp)
+		return;
+	rp->codec = codec;
+	rp->started = 0;
+	rp->held_count = 0;
+	rp->held_len = 0;
+	rp->nout = 0;
+	rp->used = 0;
+}
+
+/* one packet out: header hdr[0..hl) with the next sequence number, then a and b */
+static int 
+repack_emit(repack *rp,const unsigned char *hdr,size_t hl,int marker,
+	const unsigned char *a,size_t alen,const unsigned char *b,size_t blen)
+{
+	unsigned char *o = rp->arena + rp->used;
+	uint16_t seq;
+
+	if(rp->nout == REPACK_MAX_OUT || rp->used + hl + alen + blen > REPACK_ARENA){
+		rp->full = 1;
+		return -1;
+	}
+	memcpy(o,hdr,hl);
+	o[0] &= ~0x20;	/* padding stays with the camera packet */
+	o[1] = (o[1] & 0x7F) | (marker ? 0x80 : 0);
+	seq = htons(++rp->out_seq);
+	memcpy(o + 2,&seq,sizeof(seq));
+	if(alen > 0) memcpy(o + hl,a,alen);
+	if(blen > 0) memcpy(o + hl + alen,b,blen);
+	rp->out[rp->nout].off = rp->used;
+	rp->out[rp->nout].len = hl + alen + blen;
+	rp->nout++;
+	rp->used += hl + alen + blen;
+	return 0;
+}
+
+/* as received but renumbered */
+static int 
+repack_raw(repack *rp,const unsigned char *pkt,size_t len)
+{
+	unsigned char b0 = pkt[0], b1 = pkt[1];
+	int ret = repack_emit(rp,pkt,len,b1 & 0x80,NULL,0,NULL,0);
+
+	if(0 == ret)
+		rp->arena[rp->out[rp->nout-1].off] = b0;
+	return ret;
+}
+
+static size_t 
+repack_nal_hdr(repack *rp)
+{
+	return (h26x_h265 == rp->codec) ? 2 : 1;
+}
+
+static void 
+repack_flush(repack *rp)
+{
+	unsigned char agg[2];
+	const unsigned char *nal = rp->held + 2;
+	size_t off, n;
+
+	if(0 == rp->held_count)
+		return;
+	if(1 == rp->held_count){
+		repack_emit(rp,rp->held_hdr,rp->held_hl,rp->held_marker,nal,rp->held_len - 2,NULL,0);
+	}else if(h26x_h265 == rp->codec){
+		/* ap: layer and tid of the first unit */
+		agg[0] = (nal[0] & 0x81) | (48 << 1);
+		agg[1] = nal[1];
+		repack_emit(rp,rp->held_hdr,rp->held_hl,rp->held_marker,agg,2,rp->held,rp->held_len);
+	}else{
+		/* stap-a: f of any unit, the highest nri */
+		agg[0] = 24;
+		for(off = 0; off + 2 < rp->held_len; off += 2 + n) {
+			n = ((size_t)rp->held[off] << 8) | rp->held[off+1];
+			agg[0] |= rp->held[off+2] & 0x80;
+			if((rp->held[off+2] & 0x60) > (agg[0] & 0x60))
+				agg[0] = (agg[0] & ~0x60) | (rp->held[off+2] & 0x60);
+		}
+		repack_emit(rp,rp->held_hdr,rp->held_hl,rp->held_marker,agg,1,rp->held,rp->held_len);
+	}
+	rp->held_count = 0;
+	rp->held_len = 0;
+}
+
+/* add a single nal unit to the aggregate if the result still fits, 1: held */
+static int 
+repack_hold(repack *rp,const unsigned char *hdr,size_t hl,uint32_t ts,int marker,
+	const unsigned char *nal,size_t nlen)
+{
+	size_t base = (rp->held_count > 0) ? rp->held_hl : hl;
+
+	if(base + repack_nal_hdr(rp) + rp->held_len + 2 + nlen > rp->limit)
+		return 0;
+	if(0 == rp->held_count){
+		memcpy(rp->held_hdr,hdr,hl);
+		rp->held_hl = hl;
+		rp->held_ts = ts;
+	}
+	rp->held[rp->held_len] = (unsigned char)(nlen >> 8);
+	rp->held[rp->held_len+1] = (unsigned char)nlen;
+	memcpy(rp->held + rp->held_len + 2,nal,nlen);
+	rp->held_len += 2 + nlen;
+	rp->held_count++;
+	rp->held_marker = marker;
+	return 1;
+}
+
+/* 
+* data of one nal unit as fragments: ind is the fu indicator (h265: payload
+* header), type the unit type, start/end whether data begins/ends the unit.
+*/
+static void 
+repack_fu(repack *rp,const unsigned char *hdr,size_t hl,int marker,
+	const unsigned char *ind,unsigned char type,int start,int end,
+	const unsigned char *data,size_t dlen)
+{
+	size_t ilen = repack_nal_hdr(rp);
+	size_t chunk = rp->limit - hl - ilen - 1;
+	unsigned char prefix[3];
+	size_t off, piece;
+	int last;
+
+	memcpy(prefix,ind,ilen);
+	for(off = 0; off < dlen; off += piece) {
+		piece = (dlen - off > chunk) ? chunk : dlen - off;
+		last = (off + piece == dlen);
+		prefix[ilen] = type | ((0 == off && start) ? 0x80 : 0) | ((last && end) ? 0x40 : 0);
+		repack_emit(rp,hdr,hl,marker && last,prefix,ilen + 1,data + off,piece);
+	}
+}
+
+/* a whole nal unit: as is when it fits, else fragments */
+static void 
+repack_nal(repack *rp,const unsigned char *hdr,size_t hl,int marker,
+	const unsigned char *nal,size_t nlen)
+{
+	unsigned char ind[2];
+	size_t nh = repack_nal_hdr(rp);
+
+	if(hl + nlen <= rp->limit || nlen <= nh){
+		repack_emit(rp,hdr,hl,marker,nal,nlen,NULL,0);
+		return;
+	}
+	if(h26x_h265 == rp->codec){
+		ind[0] = (nal[0] & 0x81) | (49 << 1);
+		ind[1] = nal[1];
+		repack_fu(rp,hdr,hl,marker,ind,(nal[0] >> 1) & 0x3F,1,1,nal + 2,nlen - 2);
+	}else{
+		ind[0] = (nal[0] & 0xE0) | 28;
+		repack_fu(rp,hdr,hl,marker,ind,nal[0] & 0x1F,1,1,nal + 1,nlen - 1);
+	}
+}
+
+/* 
+* one camera rtp packet in; returns the packets out (0: held or dropped),
+* -1: not a codec we cut, forward the packet unchanged.
+*/
+int 
+repack_push(repack *rp,const char *pkt,size_t len)
+{
+	const unsigned char *p = (const unsigned char *)pkt;
+	const unsigned char *payload = NULL;
+	size_t plen = 0, hl, nh, off, n, used;
+	uint16_t seq, gap, out_seq;
+	uint32_t ts;
+	unsigned char type;
+	int marker, single, fu, agg, held, nout;
+
+	if(NULL == rp || h26x_none == rp->codec || len > REPACK_MAX_PACKET || len < 12)
+		return -1;
+	rp->nout = 0;
+	rp->used = 0;
+
+	/* renumber, keeping the camera's gaps so the peer still sees its losses */
+	seq = ((uint16_t)p[2] << 8) | p[3];
+	if(!rp->started){
+		rp->started = 1;
+		rp->out_seq = seq - 1;
+	}else{
+		gap = seq - rp->in_seq;
+		if(0 == gap || gap >= 0x8000)
+			return 0;	/* duplicate or late */
+		if(gap < 1000)
+			rp->out_seq += gap - 1;
+	}
+	rp->in_seq = seq;
+
+	memcpy(&ts,p + 4,sizeof(ts));
+	marker = p[1] & 0x80;
+	payload = h26x_rtp_payload(pkt,len,&plen);
+	nh = repack_nal_hdr(rp);
+	if(NULL == payload || plen <= nh + 1 || rp->limit <= (size_t)(payload - p) + nh + REPACK_MIN_CHUNK){
+		repack_flush(rp);
+		repack_raw(rp,p,len);
+		return rp->nout;
+	}
+	hl = payload - p;
+	if(h26x_h265 == rp->codec){
+		type = (payload[0] >> 1) & 0x3F;
+		single = type < 48;
+		agg = (48 == type);
+		fu = (49 == type);
+	}else{
+		type = payload[0] & 0x1F;
+		single = type >= 1 && type <= 23;
+		agg = (24 == type);
+		fu = (28 == type);
+	}
+	if(rp->held_count > 0 && (!single || ts != rp->held_ts || hl + plen > rp->limit))
+		repack_flush(rp);
+
+	/* what this packet adds; a cut that does not fit goes out renumbered only */
+	nout = rp->nout;
+	used = rp->used;
+	out_seq = rp->out_seq;
+	rp->full = 0;
+	if(single && hl + plen <= rp->limit){
+		held = repack_hold(rp,p,hl,ts,marker,payload,plen);
+		if(!held && rp->held_count > 0){
+			repack_flush(rp);
+			held = repack_hold(rp,p,hl,ts,marker,payload,plen);
+		}
+		if(!held){
+			repack_emit(rp,p,hl,marker,payload,plen,NULL,0);
+		}else if(marker){
+			/* the access unit is complete, nothing more will join */
+			repack_flush(rp);
+		}
+	}else if(single){
+		repack_nal(rp,p,hl,marker,payload,plen);
+	}else if(fu && hl + plen > rp->limit){
+		/* a fragment over the limit: cut again, s/e only where the camera had them */
+		repack_fu(rp,p,hl,marker,payload,payload[nh] & ((h26x_h265 == rp->codec) ? 0x3F : 0x1F),
+			payload[nh] & 0x80,payload[nh] & 0x40,payload + nh + 1,plen - nh - 1);
+	}else if(agg && hl + plen > rp->limit){
+		for(off = nh; off + 2 < plen; off += 2 + n) {
+			n = ((size_t)payload[off] << 8) | payload[off+1];
+			if(0 == n || off + 2 + n > plen)
+				break;
+			repack_nal(rp,p,hl,marker && off + 2 + n >= plen,payload + off + 2,n);
+		}
+	}else{
+		repack_raw(rp,p,len);
+	}
+	if(rp->full){
+		rp->nout = nout;
+		rp->used = used;
+		rp->out_seq = out_seq;
+		repack_raw(rp,p,len);
+	}
+	return rp->nout;
+}
+
+const char *
+repack_packet(const repack *rp,int k,size_t *len)
+{
+	if(k < 0 || k >= rp->nout)
+		return NULL;
+	*len = rp->out[k].len;
+	return (const char *)rp->arena + rp->out[k].off;
+}
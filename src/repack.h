@@ -0,0 +1,51 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __REPACK_H__
+#define __REPACK_H__
+
+#include <stddef.h>
+#include "h26x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* h264/h265 rtp of one camera re-cut for the sip side: nal units and
+* fragments over the packet limit become fu-a/fu fragments (rfc6184,
+* rfc7798), single nal units of one timestamp that fit together go out
+* as one stap-a/ap. sequence numbers are renumbered so the output stays
+* gapless except where the camera's own stream had a gap. relay thread
+* only; the output of a push is valid until the next push.
+*/
+typedef struct repack_t repack;
+
+repack *repack_new(size_t limit);
+void repack_free(repack *rp);
+void repack_reset(repack *rp,h26x_codec codec);
+int repack_push(repack *rp,const char *pkt,size_t len);
+const char *repack_packet(const repack *rp,int k,size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,12 +18,267 @@
  *              larkguo@gmail.com
  */
  
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* recvmmsg, sendmmsg */
+#endif
+#include <stddef.h>
 #include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "rtsp_client.h"
+#include "camera.h"
 #include "rtpproxy.h"
+#include "relay_uring.h"
+#include "stats.h"
+#include "port_pool.h"
+#include "gop_cache.h"
+#include "repack.h"
+#include "send_queue.h"
+
+#define RELAY_MAX_EVENTS	(64)
+#define RELAY_QUEUE_LEN		(256)	/* power of 2 */
+#define RTP_BIND_TRIES		(8)		/* pool pairs tried per stream */
+#define RTP_PREBIND_STEP	(4)		/* pairs bound per refill call */
+
+/* epoll_data: side | mode << 4 | call (sip side) or camera (rtsp side) index << 8 */
+#define RELAY_KEY(index,mode,side)	(((uint64_t)(index) << 8) | ((mode) << 4) | (side))
+#define RELAY_KEY_SIDE(key)		((b2b_side)((key) & 0x0F))
+#define RELAY_KEY_MODE(key)		((stream_mode)(((key) >> 4) & 0x0F))
+#define RELAY_KEY_INDEX(key)	((int)((key) >> 8))
+#define RELAY_KEY_WAKEUP		RELAY_KEY(0,0,side_max)
+#define RELAY_KEY_SHARED(mode)	RELAY_KEY(1,mode,side_max)
+#define RELAY_BATCH_HIST		(7)		/* 1,2-3,4-7,...,32-63,64 */
+
+/* 
+* [rtp] backend=io_uring: camera sockets receive through multishot 
+* recvmsg, fan-out sends are sqes. user_data: kind << 56 | fd << 32 | key
+* for receives, kind << 56 | send slot for sends.
+*/
+#define RELAY_URING_ENTRIES		(1024)
+#define RELAY_URING_BUFS		(1024)	/* power of 2 */
+#define RELAY_URING_SENDS		(4096)	/* sends in flight */
+#define RELAY_UD(kind,fd,key)	(((uint64_t)(kind) << 56) | ((uint64_t)(fd) << 32) | (uint32_t)(key))
+#define RELAY_UD_KIND(ud)		((int)((ud) >> 56))
+#define RELAY_UD_FD(ud)			((int)(((ud) >> 32) & 0xFFFFFF))
+#define RELAY_UD_KEY(ud)		((uint64_t)((ud) & 0xFFFFFFFF))
+
+typedef enum{
+	relay_ud_none = 0,	/* cancels */
+	relay_ud_epoll,		/* relay epoll fd readable: commands, sip side */
+	relay_ud_recv,		/* camera socket datagram */
+	relay_ud_send,		/* fan-out send done */
+}relay_ud_kind;
+
+/* one fan-out send in flight, keeps what the sqe points at */
+typedef struct relay_usend_t{
+	struct msghdr msg;
+	struct iovec iov[2];
+	struct sockaddr_in to;
+	char hdr[RTP_HEADER_LEN];
+	unsigned int bid;	/* provided buffer holding the payload */
+	int index;			/* call slot and stream, for the counters */
+	int callid;			/* the call a full socket queues the datagram for */
+	stream_mode mode;
+}relay_usend;
+
+/* 
+* per camera and per call stream counters, written by the relay thread 
+* only (plain add, relaxed store), read relaxed by the metrics endpoint.
+*/
+typedef struct relay_stat_t{
+	unsigned long packets_in;
+	unsigned long bytes_in;
+	unsigned long packets_out;
+	unsigned long bytes_out;
+	unsigned long bad_rtp;		/* camera: rtp version or payload type mismatch */
+	unsigned long send_errors;
+	unsigned long eagain_drops;	/* socket buffer full, [rtp] send_queue 0 */
+	unsigned long queued;		/* sent after waiting in the send queue */
+	unsigned long queue_drops;	/* not queued: frame dropped or waiting for a keyframe */
+	unsigned long resyncs;		/* send queue flushed to wait for a keyframe */
+	time_t last_in;
+}relay_stat;
+
+#define RELAY_STAT_ADD(field,n)	__atomic_store_n(&(field),(field) + (n),__ATOMIC_RELAXED)
+#define RELAY_STAT_GET(field)	__atomic_load_n(&(field),__ATOMIC_RELAXED)
+
+/* upstream keyframe requests of one camera */
+typedef struct relay_keyframe_t{
+	uint32_t ssrc;		/* camera video ssrc, learned from its rtp */
+	long last_ms;		/* last request sent, monotonic */
+	uint8_t fir_seq;
+	unsigned long sent;
+	unsigned long suppressed;	/* within [rtp] keyframe_interval of the last one */
+	unsigned long failed;		/* no ssrc or rtcp address yet, or sendto failed */
+	unsigned long gop_packets;	/* gop cache size, published for streams_show */
+	unsigned long gop_bytes;
+}relay_keyframe;
+
+typedef enum{
+	relay_fb_pli = 0,
+	relay_fb_fir,
+	relay_fb_nack,
+	relay_fb_max
+}relay_fb;
+
+/* relay side slot of the call table */
+typedef struct relay_call_t{
+	sipcall call;
+	relay_stat stats[stream_max];
+	uint32_t peer_ssrc[stream_max];	/* [rtp] shared_port: learned per stream */
+	send_queue *sendq[stream_max];	/* created when the socket first fills */
+	int out_armed[stream_max];		/* EPOLLOUT on the socket registered as this mode */
+	int burst;				/* walking the gop cache, live video waits for it */
+	int burst_next;			/* next cached packet */
+	unsigned long burst_gen;	/* of the group being walked */
+}relay_call;
+
+#define RELAY_CALL(r,j)	(&(r)->slabs[(j) / SIPCALL_SLAB][(j) % SIPCALL_SLAB])
+
+typedef enum{
+	relay_cmd_call_set = 0,	/* (re)INVITE answered: sockets, remote, payload, direction */
+	relay_cmd_call_del,		/* call released, relay closes the call sockets */
+	relay_cmd_rtsp_set,		/* camera side sockets, remote, payload */
+	relay_cmd_rtsp_del,		/* last call left the camera, relay closes its sockets */
+	relay_cmd_quit,
+}relay_cmd_type;
+
+typedef struct relay_cmd_t{
+	relay_cmd_type type;
+	int index;		/* sipcall slot or camera index */
+	union{
+		sipcall call;
+		rtspserver rtsp;
+	}u;
+}relay_cmd;
+
+/* 
+* shared sip side sockets: peer address/port or peer ssrc ==> call slot.
+* bit 0 tells the two apart, mode in bits 1-3, port in bits 8-23.
+*/
+#define RELAY_FLOW_ADDR(addr,port,mode)	(((uint64_t)(addr) << 32) | ((uint64_t)(port) << 8) | ((mode) << 1))
+#define RELAY_FLOW_SSRC(ssrc,mode)		(((uint64_t)(ssrc) << 32) | ((mode) << 1) | 1)
+
+typedef struct relay_flow_t{
+	uint64_t key;
+	int index;			/* call slot, -1: empty */
+}relay_flow;
 
-static int sock_address_get(int socket, char *ipbuf, int ipbuf_len, int *port);
-static int sock_create(core*co,int callid,stream_mode mode, b2b_side side);
+/* one active destination of a camera stream */
+typedef struct relay_sub_t{
+	int fd;
+	int index;			/* call slot */
+	int callid;
+	int media_format;	/* target payload type, -1: keep */
+	struct sockaddr_in remote;
+}relay_sub;
+
+/* 
+* media relay thread, owns its own copy of the call table. 
+* the signaling thread is the single producer of the command queue,
+* the relay thread the single consumer.
+*/
+struct relay_t{
+	int epfd;
+	int wakefd;
+	unsigned int head;	/* next command to consume, written by relay */
+	unsigned int tail;	/* next free command, written by signaling */
+	relay_cmd queue[RELAY_QUEUE_LEN];
+	int running;
+	
+	/* 
+	* calls by slot, SIPCALL_SLAB per slab. slabs are added when a slot 
+	* beyond top is first set and kept until streams_stop: the signaling 
+	* thread reads the counters of slots below top, published with release.
+	*/
+	int maxcalls;
+	int nslabs;
+	relay_call **slabs;
+	int top;
+	int ncams;
+	rtspserver *cams;
+
+	/* 
+	* [rtp] shared_port: every call's sip side uses these, incoming 
+	* datagrams are demultiplexed through flows, rebuilt when a call 
+	* changes, the table grows with top.
+	*/
+	int shared_fds[stream_max];
+	struct sockaddr_in shared_local[stream_max];
+	relay_flow *flows;
+	unsigned int flow_mask;
+	unsigned long shared_unknown;	/* datagrams no call claimed */
+	int shared_out[stream_max];		/* EPOLLOUT on shared_fds[mode] */
+
+	/* 
+	* per stream fan-out, rebuilt when a call changes. subscribers are 
+	* grouped by camera: camera c owns subs[mode][first[c]..first[c+1]).
+	*/
+	relay_sub *subs[stream_max];
+	int *first[stream_max];
+	int *fill;
+
+	/* batched camera ==> sip path */
+	int batch;
+	char *rbufs;
+	char *shdrs;		/* per datagram rtp header, rewritten per subscriber */
+	char *rtpflags;		/* datagram k is rtp */
+	struct sockaddr_in *rfrom;
+	struct iovec *riovs;
+	struct iovec *siovs;	/* 2 per datagram: header, payload */
+	struct mmsghdr *rmsgs;
+	struct mmsghdr *smsgs;
+	unsigned long batch_wakeups;	/* recvmmsg returning data */
+	unsigned long batch_packets;	/* datagrams received by recvmmsg */
+	unsigned long batch_sends;		/* sendmmsg calls */
+	unsigned long batch_short;		/* datagrams sendmmsg did not take */
+	unsigned long batch_hist[RELAY_BATCH_HIST];
+	int batch_max;
+
+	/* counters: [camera * stream_max + mode], calls keep theirs in relay_call */
+	relay_stat *camstats;
+	time_t now;		/* once per wakeup */
+
+	/* io_uring backend, NULL: epoll */
+	relay_uring *uring;
+	relay_usend *usends;
+	int *usend_free;	/* stack of unused send slots */
+	int nusend_free;
+	unsigned short *bufref;	/* sends in flight per provided buffer */
+	unsigned long uring_recvs;
+	unsigned long uring_sends;
+	unsigned long uring_drops;	/* no send slot or sqe */
+	unsigned long uring_rearms;	/* multishot receives that ended */
+
+	/* [rtp] mtu: per camera video cut to fit, NULL: forwarded as received */
+	repack **repacks;
+
+	/* [rtp] gop_cache: per camera video, handed to viewers that join late */
+	gop_cache **gops;
+	unsigned long gop_bursts;
+	unsigned long gop_burst_packets;
+
+	/* rtcp feedback of the viewers, turned into pli/fir to the camera */
+	relay_keyframe *keyframes;
+	uint32_t rtcp_ssrc;		/* sender ssrc of our requests */
+	unsigned long feedback[relay_fb_max];
+};
+
+static int relay_post(core *co,relay_cmd_type type,int index,const void *data,size_t len);
+static int relay_epoll_add(core *co,int fd,int index,stream_mode mode,b2b_side side);
+static int relay_epoll_del(core *co,int fd);
+static int relay_batch_init(core *co);
+static void relay_subs_rebuild(core *co,stream_mode mode);
+static void relay_flows_rebuild(core *co);
+static int relay_flows_reserve(core *co);
+static int relay_fd_shared(struct relay_t *r,int fd);
+static int relay_fd_owned(struct relay_t *r,const int *fds,int i);
+static void relay_batch_free(struct relay_t *r);
+static int relay_uring_setup(core *co);
+static void relay_uring_cleanup(struct relay_t *r);
+static int relay_sub_iov(relay_sub *sub,char *pkt,size_t len,int is_rtp,char *hdr,struct iovec *iov);
+static void relay_stat_call_out(struct relay_t *r,int j,stream_mode i,int packets,size_t bytes,int failed,int err);
+static void relay_gop_step(core *co,int j);
 
 int 
 payload_init(core *co)
@@ -32,12 +287,12 @@ payload_init(core *co)
 
 	/* payload */	
 	for(i = 0; i < stream_max; i++) {
-		memset(&co->rtsp.payload[i],0,sizeof(co->rtsp.payload[i]));
-		co->rtsp.payload[i].media_format = -1;
-
-		for(j = 0; j< co->maxcalls; j++) {
-			memset(&co->sipcall[j].payload[i],0,sizeof(co->rtsp.payload[i]));
-			co->sipcall[j].payload[i].media_format = -1;
+		for(j = 0; j < core_sipcall_top(co); j++) {
+			sipcall *call = core_sipcall_at(co,j);
+			if(NULL == call)
+				continue;
+			memset(&call->payload[i],0,sizeof(call->payload[i]));
+			call->payload[i].media_format = -1;
 		}
 	}
 	
@@ -78,391 +333,2458 @@ sock_noblocking_set(int sockfd)
 	return 0;
 }
 
+/* udp socket bound to local, non-blocking, -1 on failure */
 static int 
-sock_address_get(int sock, char *ipbuf, int ipbuf_len, int *port)
+sock_bind(core *co,struct sockaddr_in *local)
 {
-	int ret = 0;
-	struct sockaddr_in addr;
-	socklen_t slen = sizeof(addr);
-	
-	ret = getsockname(sock,(struct sockaddr *)&addr,&slen);
-	if(0 == ret){
-		switch(((struct sockaddr *)&addr)->sa_family) {
-		case AF_INET:
-			if( NULL != ipbuf && ipbuf_len > 0){
-				inet_ntop(((struct sockaddr *)&addr)->sa_family,
-					&(((struct sockaddr_in *) &addr)->sin_addr),ipbuf,sizeof(ipbuf));
-			}
-			if( NULL != port ){
-				*port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
-			}
-			break;
-		case AF_INET6:
-			if( NULL != ipbuf && ipbuf_len > 0){
-				inet_ntop(((struct sockaddr *)&addr)->sa_family,
-					&(((struct sockaddr_in6 *)&addr)->sin6_addr),ipbuf,sizeof(ipbuf));
-			}
-			if( NULL != port ){
-				*port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
-			}
-			break;
-		default:
-			break;
-		}
+	int sock = -1;
+	
+	sock =  socket(AF_INET, SOCK_DGRAM, 0);
+	if( sock < 0 ){
+		log(co,LOG_ERR,"rtpproxy socket failed:%s\n",strerror(errno));
+		return -1;
 	}
-	return ret;
+	if( bind(sock,(struct sockaddr *)local,sizeof(*local)) < 0 ){
+		log(co,LOG_DEBUG,"rtpproxy bind(%s:%d) failed:%s\n",
+			inet_ntoa(local->sin_addr),ntohs(local->sin_port),strerror(errno));
+		close(sock);
+		return -1;
+	}
+	sock_noblocking_set(sock);
+	return sock;
 }
 
+/*
+* rtp on the even port of a pool pair, rtcp on the odd one (or on the
+* rtp socket with single, rtcp-mux). a pair another process holds goes
+* back to quarantine and the next one is tried; on failure fds stay -1.
+*/
 static int 
-sock_create(core *co,int callid,stream_mode mode, b2b_side side)
+sock_pair_bind(core *co,const char *ip,struct sockaddr_in *local,int *fds,int single)
 {
-	int sock = -1;
-	int ret = -1;
-	int port = 0;
-	
-	if( NULL == co || 
-		mode >= stream_max || mode < stream_audio_rtp || 
-		side >= side_max || side < side_sip){
-		return -1;
-	}
-	if(side_rtsp == side){
-		memset(&co->rtsp.remote[mode],0,sizeof(co->rtsp.remote[mode]));
-		co->rtsp.local[mode].sin_family      = AF_INET;
-		co->rtsp.local[mode].sin_addr.s_addr = inet_addr(co->rtsp_localip);
-		
-		sock =  socket(AF_INET, SOCK_DGRAM, 0);
-		ret = bind(sock,(struct sockaddr *)&co->rtsp.local[mode],sizeof(co->rtsp.local[mode]));	
-		if( ret < 0 ){
-			log(co,LOG_DEBUG,"rtpproxy rtsp bind(%s:%d)=%d failed!\n",
-				co->rtsp_localip,ntohs(co->rtsp.local[mode].sin_port),ret);
+	int try_times = 0;
+	int port = -1;
+	time_t now = time(NULL);
+
+	for(try_times = 0; try_times < RTP_BIND_TRIES; try_times++) {
+		port = port_pool_alloc(co->port_pool,now);
+		if(port < 0){
+			log(co,LOG_ERR,"rtpproxy no free rtp port pair in %d-%d\n",
+				co->rtp_start_port,co->rtp_end_port);
 			return -1;
 		}
-		co->rtsp.fds[mode] = sock;
-		ret = sock_address_get(sock,NULL, 0, &port);
-		if( 0 == ret ){
-			co->rtsp.local[mode].sin_port = htons(port);
-		}				
-		sock_noblocking_set(co->rtsp.fds[mode]);
+		memset(local,0,sizeof(struct sockaddr_in) * 2);
+		local[0].sin_family = AF_INET;
+		local[0].sin_addr.s_addr = inet_addr(ip);
+		local[0].sin_port = htons(port);
+		local[1] = local[0];
+		if(!single)
+			local[1].sin_port = htons(port+1);
+		
+		fds[0] = sock_bind(co,&local[0]);
+		fds[1] = single ? fds[0] : sock_bind(co,&local[1]);
+		if(fds[0] >= 0 && fds[1] >= 0)
+			return 0;
+		if(fds[0] >= 0)  close(fds[0]);
+		if(!single && fds[1] >= 0)  close(fds[1]);
+		fds[0] = fds[1] = -1;
+		port_pool_release(co->port_pool,port,now);
+	}
+	log(co,LOG_ERR,"rtpproxy bind failed %d times, last port %d\n",try_times,port);
+	return -1;
+}
+
+/*
+* [rtp] prebind: bound non-blocking pairs kept ready per side, so call
+* setup only pops one. the signaling loop tops them up between events.
+* released pairs are not reused as sockets: their ports go through the
+* quarantine and fresh sockets are bound for them later.
+*/
+typedef struct sock_prebound_t {
+	int fds[2];
+	struct sockaddr_in local[2];
+} sock_prebound;
+
+struct sock_prepool_t {
+	sock_prebound *pairs[side_max];
+	int count[side_max];
+	int size;
+	unsigned long taken;
+	unsigned long misses;	/* pool empty, bound on the call path */
+};
+
+static const char *
+sock_side_ip(core *co,b2b_side side)
+{
+	return side_rtsp == side ? co->rtsp_localip : co->sip_localip;
+}
+
+/* a pair for one stream: prebound if there is one, bound now otherwise */
+static int 
+sock_pair_take(core *co,b2b_side side,struct sockaddr_in *local,int *fds,int single)
+{
+	struct sock_prepool_t *pp = co->prepool;
+	sock_prebound *pair = NULL;
+
+	if(NULL == pp || 0 == pp->size)
+		return sock_pair_bind(co,sock_side_ip(co,side),local,fds,single);
+	if(0 == pp->count[side]){
+		pp->misses++;
+		return sock_pair_bind(co,sock_side_ip(co,side),local,fds,single);
+	}
+	pair = &pp->pairs[side][--pp->count[side]];
+	pp->taken++;
+	fds[0] = pair->fds[0];
+	local[0] = pair->local[0];
+	if(single){		/* the odd port stays reserved, pairs stay aligned */
+		close(pair->fds[1]);
+		fds[1] = fds[0];
+		local[1] = local[0];
 	}else{
-		int j = -1;
-		for(j = 0; j < co->maxcalls; j++) {
-			if(co->sipcall[j].callid == callid){
-				memset(&co->sipcall[j].remote[mode],0,sizeof(co->sipcall[j].remote[mode]));
-				co->sipcall[j].local[mode].sin_family      = AF_INET;
-				co->sipcall[j].local[mode].sin_addr.s_addr = inet_addr(co->sip_localip);
-
-				sock =  socket(AF_INET, SOCK_DGRAM, 0);
-				ret = bind(sock,(struct sockaddr *)&co->sipcall[j].local[mode],sizeof(co->sipcall[j].local[mode]));	
-				if( ret < 0 ){
-					log(co,LOG_DEBUG,"rtpproxy sip bind(%s:%d)=%d failed!\n",
-						co->sip_localip,ntohs(co->sipcall[j].local[mode].sin_port),ret);
-					return -1;
-				}
-				co->sipcall[j].fds[mode] = sock;
-				ret = sock_address_get(sock,NULL, 0, &port);
-				if( 0 == ret ){
-					co->sipcall[j].local[mode].sin_port = htons(port);
-				}						
-				sock_noblocking_set(co->sipcall[j].fds[mode]);
-			}	
+		fds[1] = pair->fds[1];
+		local[1] = pair->local[1];
+	}
+	return 0;
+}
+
+/* top up both sides, at most RTP_PREBIND_STEP binds per side */
+void 
+stream_prebind_refill(core *co)
+{
+	struct sock_prepool_t *pp = co->prepool;
+	sock_prebound *pair = NULL;
+	port_pool_usage usage;
+	b2b_side side;
+	int n;
+
+	if(NULL == pp)
+		return;
+	for(side = side_sip; side < side_max; side++) {
+		for(n = 0; n < RTP_PREBIND_STEP && pp->count[side] < pp->size; n++) {
+			port_pool_usage_get(co->port_pool,time(NULL),&usage);
+			if(0 == usage.free)
+				return;		/* calls hold the range, nothing to log */
+			pair = &pp->pairs[side][pp->count[side]];
+			if(sock_pair_bind(co,sock_side_ip(co,side),pair->local,pair->fds,0) < 0)
+				break;
+			pp->count[side]++;
 		}
 	}
-	return sock;
 }
 
-int 
-sock_pair_create(core *co,int callid,stream_mode mode, b2b_side side)
+static int 
+sock_prepool_init(core *co)
 {
-	int rtp_sock = -1;
-	int rtcp_sock = -1;
-	int try_times = 0;
-	int current_port = core_rtp_current_port_get(co);
-	int start_port = core_rtp_start_port_get(co);
-	int end_port = core_rtp_end_port_get(co);
+	struct sock_prepool_t *pp = NULL;
+	b2b_side side;
+	int before;
 
-try_nextport:		
-	if(try_times > 3 ) {
-		log(co,LOG_ERR,"bind error times %d, current_port=%d\n",try_times,current_port);
+	if(co->rtp_prebind <= 0)
+		return 0;
+	pp = (struct sock_prepool_t *)osip_malloc(sizeof(struct sock_prepool_t));
+	if(NULL == pp)
 		return -1;
+	memset(pp,0,sizeof(struct sock_prepool_t));
+	co->prepool = pp;
+	pp->size = co->rtp_prebind;
+	for(side = side_sip; side < side_max; side++) {
+		pp->pairs[side] = (sock_prebound *)osip_malloc(sizeof(sock_prebound) * pp->size);
+		if(NULL == pp->pairs[side])
+			return -1;
 	}
-	
-	if(current_port >= end_port )
-		current_port = start_port;
+	while(pp->count[side_sip] < pp->size || pp->count[side_rtsp] < pp->size) {
+		before = pp->count[side_sip] + pp->count[side_rtsp];
+		stream_prebind_refill(co);
+		if(pp->count[side_sip] + pp->count[side_rtsp] == before)
+			break;	/* range too small, the rest comes on demand */
+	}
+	return 0;
+}
 
-	/* rtsp */
-	if(side_rtsp == side){
-		if(co->rtsp.fds[mode] > 0)  return 0;
-		
-		co->rtsp.local[mode].sin_port	= htons(current_port);
-		co->rtsp.local[mode+1].sin_port = htons(current_port+1);
-		rtp_sock = sock_create(co,callid,mode,side);
-		rtcp_sock = sock_create(co,callid,mode+1,side);
-		if( rtp_sock <= 0 || rtcp_sock <= 0 ){
-			if(rtp_sock > 0)  close(rtp_sock);
-			if(rtcp_sock > 0)  close(rtcp_sock);
-			current_port += 2;
-			try_times += 1;
-			goto try_nextport;
-		}
-		current_port += 2;
-		core_rtp_current_port_set(co,current_port);
-	}else{ /* sip */
-		int j = -1;
-		for(j = 0; j < co->maxcalls; j++) {
-			if(co->sipcall[j].callid == callid){
-				if(co->sipcall[j].fds[mode] > 0)  return 0;
-				
-				co->sipcall[j].local[mode].sin_port	= htons(current_port);
-				co->sipcall[j].local[mode+1].sin_port = htons(current_port+1);
-				rtp_sock = sock_create(co,callid,mode,side);
-				rtcp_sock = sock_create(co,callid,mode+1,side);
-				if( rtp_sock <= 0 || rtcp_sock <= 0 ){
-					if(rtp_sock > 0)  close(rtp_sock);
-					if(rtcp_sock > 0)  close(rtcp_sock);
-					current_port += 2;
-					try_times += 1;
-					goto try_nextport;
-				}
-				current_port += 2;
-				core_rtp_current_port_set(co,current_port);
-			}
+static void 
+sock_prepool_free(core *co)
+{
+	struct sock_prepool_t *pp = co->prepool;
+	sock_prebound *pair = NULL;
+	b2b_side side;
+
+	if(NULL == pp)
+		return;
+	for(side = side_sip; side < side_max; side++) {
+		while(pp->count[side] > 0) {
+			pair = &pp->pairs[side][--pp->count[side]];
+			close(pair->fds[0]);
+			close(pair->fds[1]);
+			port_pool_release(co->port_pool,ntohs(pair->local[0].sin_port),time(NULL));
 		}
+		osip_free(pp->pairs[side]);
 	}
-	return 0;
+	osip_free(pp);
+	co->prepool = NULL;
+}
+
+/* give the pool back the pair of one rtp stream, shared and multicast ports are skipped */
+static void 
+sock_pair_release(core *co,int *fds,struct sockaddr_in *local,stream_mode mode)
+{
+	struct relay_t *r = co->relay;
+
+	if(fds[mode] <= 0 || (NULL != r && fds[mode] == r->shared_fds[mode]) ||
+		IN_MULTICAST(ntohl(local[mode].sin_addr.s_addr)))
+		return;
+	port_pool_release(co->port_pool,ntohs(local[mode].sin_port),time(NULL));
+}
+
+static void 
+sock_pairs_release(core *co,int *fds,struct sockaddr_in *local)
+{
+	sock_pair_release(co,fds,local,stream_audio_rtp);
+	sock_pair_release(co,fds,local,stream_video_rtp);
 }
 
+/* SETUP answered RTCP-mux: the camera sends rtcp to the rtp socket too */
 int 
-streams_init(core *co)
+stream_camera_mux(core *co, camera *cam, stream_mode mode)
 {
 	int rtpproxy = core_rtpproxy_get(co);
-	int ret = 0;
 	
-	if(0 == rtpproxy)
+	if(0 == rtpproxy || NULL == cam || cam->rtsp.fds[mode] <= 0)
+		return -1;
+	if(STREAM_MUXED(cam->rtsp.fds,mode))
 		return 0;
-
-	/* create rtp and rtcp */
-	ret = sock_pair_create(co, -1,stream_audio_rtp, side_rtsp);
-	if(0==ret) ret = sock_pair_create(co, -1,stream_video_rtp, side_rtsp);
-	if( ret < 0) {
-		return ret;
-	}
 	
-	payload_init(co);
-	core_show(co);
+	/* the rtcp socket is closed by the relay when it sees it replaced */
+	cam->rtsp.fds[mode+1] = cam->rtsp.fds[mode];
+	cam->rtsp.local[mode+1] = cam->rtsp.local[mode];
+	memset(&cam->rtsp.remote[mode+1],0,sizeof(cam->rtsp.remote[mode+1]));
+	relay_post(co,relay_cmd_rtsp_set,cam->index,&cam->rtsp,sizeof(rtspserver));
 	return 0;
 }
 
+/* bound to the group itself so other groups on the port stay out,
+ * SO_REUSEADDR lets several gateways on one host share it */
+static int 
+camera_mcast_sock_create(core *co,struct in_addr group,int port)
+{
+	struct sockaddr_in local;
+	struct ip_mreq mreq;
+	int sock = -1;
+	int on = 1;
+	
+	sock =  socket(AF_INET, SOCK_DGRAM, 0);
+	if( sock < 0 )
+		return -1;
+	setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	memset(&local,0,sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr = group;
+	local.sin_port = htons(port);
+	if( bind(sock,(struct sockaddr *)&local,sizeof(local)) < 0 ){
+		log(co,LOG_ERR,"rtpproxy multicast bind(%s:%d) failed:%s\n",
+			inet_ntoa(group),port,strerror(errno));
+		close(sock);
+		return -1;
+	}
+	memset(&mreq,0,sizeof(mreq));
+	mreq.imr_multiaddr = group;
+	mreq.imr_interface.s_addr = inet_addr(co->rtsp_localip);
+	if( setsockopt(sock,IPPROTO_IP,IP_ADD_MEMBERSHIP,&mreq,sizeof(mreq)) < 0 ){
+		log(co,LOG_ERR,"rtpproxy join %s on %s failed:%s\n",
+			inet_ntoa(group),co->rtsp_localip,strerror(errno));
+		close(sock);
+		return -1;
+	}
+	sock_noblocking_set(sock);
+	return sock;
+}
+
+/* rtp and rtcp of one camera stream on two consecutive ports */
+static int 
+camera_sock_pair_create(core *co,camera *cam,stream_mode mode)
+{
+	if(NULL == cam)  return -1;
+	if(cam->rtsp.fds[mode] > 0)  return 0;
+	memset(&cam->rtsp.remote[mode],0,sizeof(struct sockaddr_in) * 2);
+	return sock_pair_take(co,side_rtsp,&cam->rtsp.local[mode],&cam->rtsp.fds[mode],0);
+}
+
 int 
-stream_call_stop(core *co, int callid)
+sock_pair_create(core *co,int callid,stream_mode mode, b2b_side side)
 {
-	int i, j ;
-	int fd;
-	int rtpproxy = core_rtpproxy_get(co);
+	sipcall *call = NULL;
+
+	/* rtsp */
+	if(side_rtsp == side){
+		return camera_sock_pair_create(co,camera_of_call(co,callid),mode);
+	}
 	
-	if(0 == rtpproxy)
+	/* sip */
+	call = core_sipcall_get(co,callid);
+	if(NULL == call)  return -1;
+	if(call->fds[mode] > 0)  return 0;
+	
+	/* shared sockets, written once by streams_init */
+	if(NULL != co->relay && co->relay->shared_fds[mode] > 0){
+		call->fds[mode] = co->relay->shared_fds[mode];
+		call->fds[mode+1] = co->relay->shared_fds[mode+1];
+		call->local[mode] = co->relay->shared_local[mode];
+		call->local[mode+1] = co->relay->shared_local[mode+1];
 		return 0;
-		
-	for(j = 0; j < co->maxcalls; j++) {
-		if(co->sipcall[j].callid == callid) {
-			for(i = 0; i < stream_max; i++) {
-				fd = co->sipcall[j].fds[i];
-				if(fd >= 0) {
-					close(fd);
-					co->sipcall[j].fds[i] = -1;
-				}
-			}
-		}
 	}
-	
-	return 0;
+	memset(&call->remote[mode],0,sizeof(struct sockaddr_in) * 2);
+	return sock_pair_take(co,side_sip,&call->local[mode],&call->fds[mode],0);
 }
 
+/* rtcp-mux: one sip side socket carries both rtp and rtcp of the stream */
 int 
-streams_stop(core *co)
+sock_mux_create(core *co,int callid,stream_mode mode)
 {
-	int i, j ;
-	int fd;
-	int rtpproxy = core_rtpproxy_get(co);
+	sipcall *call = core_sipcall_get(co,callid);
+
+	if(NULL == call)  return -1;
+	if(call->fds[mode] > 0)  return 0;
 	
-	if(0 == rtpproxy)
+	if(NULL != co->relay && co->relay->shared_fds[mode] > 0){
+		call->fds[mode] = co->relay->shared_fds[mode];
+		call->fds[mode+1] = co->relay->shared_fds[mode];
+		call->local[mode] = co->relay->shared_local[mode];
+		call->local[mode+1] = co->relay->shared_local[mode];
 		return 0;
+	}
+	/* a whole pair, so the others stay aligned */
+	memset(&call->remote[mode],0,sizeof(struct sockaddr_in) * 2);
+	return sock_pair_take(co,side_sip,&call->local[mode],&call->fds[mode],1);
+}
+
+/*
+* signaling side: post one command to the relay thread.
+* lock-free single producer queue, waits only if the relay is 
+* RELAY_QUEUE_LEN commands behind.
+*/
+static int 
+relay_post(core *co,relay_cmd_type type,int index,const void *data,size_t len)
+{
+	struct relay_t *r = co->relay;
+	relay_cmd *cmd = NULL;
+	unsigned int tail;
+	uint64_t one = 1;
 	
-	for(i = 0; i < stream_max; i++) {
-		fd = co->rtsp.fds[i];
-		if(fd >= 0) {
-			close(fd);
-			co->rtsp.fds[i] = -1;
-		}
-		
-		for(j = 0; j < co->maxcalls; j++) {
-			fd = co->sipcall[j].fds[i];
-			if(fd >= 0) {
-				close(fd);
-				co->sipcall[j].fds[i] = -1;
-			}
-		}
+	if(NULL == r)
+		return -1;
+
+	tail = r->tail;
+	while(tail - __atomic_load_n(&r->head,__ATOMIC_ACQUIRE) >= RELAY_QUEUE_LEN){
+		osip_usleep(1000);
+	}
+	cmd = &r->queue[tail & (RELAY_QUEUE_LEN-1)];
+	cmd->type = type;
+	cmd->index = index;
+	if(NULL != data && len <= sizeof(cmd->u)){
+		memcpy(&cmd->u,data,len);
+	}
+	__atomic_store_n(&r->tail,tail+1,__ATOMIC_RELEASE);
+	
+	if(write(r->wakefd,&one,sizeof(one)) < 0){
+		log(co,LOG_DEBUG,"relay wakeup failed:%s\n",strerror(errno));
 	}
 	return 0;
 }
 
 static int 
-streams_rtsp_loop(core *co)
+relay_epoll_add(core *co,int fd,int index,stream_mode mode,b2b_side side)
 {
-	int				fd,nready;
-	fd_set			readset; 
-	ssize_t			recvlen;
-	int				slen;
-	struct timeval		tv;
-	int 				i, j ;
-	char				buf[RECV_BUFF_DEFAULT_LEN] = {0};
-	rtp_header *		rtp = NULL;
-	int 				maxfd = 0;
-	int 				ret = -1;
-	struct sockaddr_storage sa;
-	slen = sizeof(struct sockaddr_in);
-			
-	tv.tv_sec = 0;
-	tv.tv_usec = 10000; 
-	FD_ZERO(&readset);
+	struct relay_t *r = co->relay;
+	struct epoll_event ev;
+	int ret = -1;
 
-	for(i = 0; i < stream_max; i++) {
-		fd = co->rtsp.fds[i];
-		if(fd > 0){
-			FD_SET(fd, &readset);
-			if(maxfd < fd) maxfd = fd; 
-		}
+	if(fd <= 0)
+		return -1;
+	if(NULL != r->uring && side_rtsp == side){
+		return relay_uring_recv_multishot(r->uring,fd,
+			RELAY_UD(relay_ud_recv,fd,RELAY_KEY(index,mode,side)));
 	}
-	
-	nready = select(maxfd+1, &readset, NULL, NULL, &tv);
-	if(nready <= 0)
-		return 0;
-	
-	/* rtsp */
-	for(i = 0; i < stream_max; i++) {
-		fd = co->rtsp.fds[i];
-		if(FD_ISSET(fd, &readset)) {
-			/* symmetricRTP */
-			if(co->symmetric_rtp){
-				recvlen = recvfrom(fd,buf,sizeof(buf),0,
-					(struct sockaddr *)&co->rtsp.remote[i],(socklen_t *)&slen); 
-			}else{
-				recvlen = recvfrom(fd,buf,sizeof(buf),0,
-					(struct sockaddr *)&sa,(socklen_t *)&slen); 
-			}
 
-			/* rtcp */
-			if(stream_audio_rtcp == i || stream_video_rtcp == i)
-				goto sendtosip;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = RELAY_KEY(index,mode,side);
+	ret = epoll_ctl(r->epfd,EPOLL_CTL_ADD,fd,&ev);
+	if(ret < 0){
+		log(co,LOG_ERR,"epoll add fd=%d index=%d stream=%d side=%d failed:%s\n",
+			fd,index,mode,side,strerror(errno));
+	}
+	return ret;
+}
 
-			/* rtp header len > 12 */
-			if( recvlen <= 12 ){ 
-				goto sendtosip;
-			}
+static int 
+relay_epoll_del(core *co,int fd)
+{
+	struct epoll_event ev; /* non-NULL for kernels before 2.6.9 */
 
-			/* Check RTP version */
-			rtp = (rtp_header*)buf;
-			if( 2 != rtp->version ) {
-				goto sendtosip;
-			}
-			
-			/* Check RTP payloadType */
-			if(rtp->payload_type != co->rtsp.payload[i].media_format){
-				goto sendtosip;
-			}
-sendtosip: 
-			for(j = 0; j < co->maxcalls; j++) {
-				stream_dir  dir ;
-				
-				if(co->sipcall[j].callid <= 0)	{
-					continue;
-				}
-				if(co->sipcall[j].fds[i]<= 0)	{
-					continue;
-				}
-				
-				dir = core_sipcall_dir_get(co,co->sipcall[j].callid,i);
-				if(stream_inactive == dir || stream_sendonly == dir)	{
-					continue;
-				}
-				
-				/* payload_type map */
-				if(co->sipcall[j].payload[i].media_format >= 0 ){
-					rtp->payload_type = co->sipcall[j].payload[i].media_format;
-				}
-				ret = sendto(co->sipcall[j].fds[i],buf,recvlen,0,
-					(struct sockaddr *)&co->sipcall[j].remote[i],slen);
-				if(ret < 0){
-					log(co,LOG_DEBUG,"call(%d-%d) stream %d length=%d sendto failed:%d\n",
-						j,co->sipcall[j].callid, i, recvlen, ret);
-				}
-			}
-		}
+	if(fd <= 0)
+		return -1;
+	/* also flushes sqes still naming fd, it is closed next */
+	if(NULL != co->relay->uring){
+		relay_uring_cancel_fd(co->relay->uring,fd,RELAY_UD(relay_ud_none,0,0));
 	}
-	
-	return 0;
+	return epoll_ctl(co->relay->epfd,EPOLL_CTL_DEL,fd,&ev);
 }
 
+static stream_dir 
+relay_call_dir(sipcall *call,stream_mode mode)
+{
+	if(stream_audio_rtp == mode || stream_audio_rtcp == mode) {	
+		return call->audio_dir;
+	}
+	return call->video_dir;
+}
 
+/* 
+* keep only sendrecv/recvonly calls with a socket, a destination 
+* and a camera, so the per packet loop never looks at idle call slots.
+*/
 static int 
-streams_sip_loop(core *co)
+relay_sub_wanted(struct relay_t *r,sipcall *call,stream_mode mode)
 {
-	int				fd,nready;
-	fd_set			readset; 
-	int				slen;
-	struct timeval 	tv;
-	int 				i, j ;
-	char				buf[RECV_BUFF_DEFAULT_LEN] = {0};
-	int 				maxfd = 0;
+	stream_dir dir;
+	
+	if(call->callid <= 0 || call->fds[mode] <= 0)
+		return 0;
+	if(call->camera < 0 || call->camera >= r->ncams)
+		return 0;
+	if(0 == call->remote[mode].sin_port)
+		return 0;
+	dir = relay_call_dir(call,mode);
+	if(stream_inactive == dir || stream_sendonly == dir)
+		return 0;
+	return 1;
+}
 
-	slen = sizeof(struct sockaddr_in);
-			
-	tv.tv_sec = 0;
-	tv.tv_usec = 10000; 
-	FD_ZERO(&readset);
+static void 
+relay_subs_rebuild(core *co,stream_mode mode)
+{
+	struct relay_t *r = co->relay;
+	relay_sub *sub = NULL;
+	sipcall *call = NULL;
+	int *first = r->first[mode];
+	int j, c;
 
-	for(i = 0; i < stream_max; i++) {
-		for(j = 0; j < co->maxcalls; j++) {
-			fd = co->sipcall[j].fds[i];
-			if(fd > 0){
-				FD_SET(fd, &readset);
-				if(maxfd < fd) maxfd = fd; 
-			}
+	/* count per camera, then place: subs stay grouped by camera */
+	memset(first,0,sizeof(int) * (r->ncams+1));
+	for(j = 0; j < r->top; j++) {
+		if(relay_sub_wanted(r,&RELAY_CALL(r,j)->call,mode))
+			first[RELAY_CALL(r,j)->call.camera+1]++;
+	}
+	for(c = 0; c < r->ncams; c++) {
+		first[c+1] += first[c];
+		r->fill[c] = first[c];
+	}
+	for(j = 0; j < r->top; j++) {
+		call = &RELAY_CALL(r,j)->call;
+		if(!relay_sub_wanted(r,call,mode))
+			continue;
+
+		sub = &r->subs[mode][r->fill[call->camera]++];
+		sub->fd = call->fds[mode];
+		sub->index = j;
+		sub->callid = call->callid;
+		sub->media_format = -1;
+		if(stream_audio_rtp == mode || stream_video_rtp == mode){
+			sub->media_format = call->payload[mode].media_format;
 		}
+		memcpy(&sub->remote,&call->remote[mode],sizeof(sub->remote));
 	}
-	
-	nready = select(maxfd+1, &readset, NULL, NULL, &tv);
-	if(nready <= 0)
-		return 0;
+}
 
+static void 
+relay_call_close(core *co,int index)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,index);
+	int i;
+	
 	for(i = 0; i < stream_max; i++) {
-		for(j = 0; j < co->maxcalls; j++) {
-			if(co->sipcall[j].callid > 0){
-				fd = co->sipcall[j].fds[i];
-				if(FD_ISSET(fd, &readset)) {
-					recvfrom(fd,buf,sizeof(buf),0,
-						(struct sockaddr *)&co->sipcall[j].remote[i],(socklen_t *)&slen); 
-				}
-			}
+		if(relay_fd_owned(r,rc->call.fds,i)) {
+			relay_epoll_del(co,rc->call.fds[i]);
+			close(rc->call.fds[i]);
 		}
 	}
+	memset(&rc->call,0,sizeof(sipcall));
+	rc->call.callid = -1;
+	memset(rc->peer_ssrc,0,sizeof(rc->peer_ssrc));
+	for(i = 0; i < stream_max; i++) {
+		send_queue_free(rc->sendq[i]);
+		rc->sendq[i] = NULL;
+		rc->out_armed[i] = 0;
+	}
+	rc->burst = 0;
+}
 
-	return 0;
+/* 
+* slabs up to the one of slot index, then the per call arrays sized by 
+* top: subscribers and the flow table.
+*/
+static int 
+relay_calls_grow(core *co,int index)
+{
+	struct relay_t *r = co->relay;
+	relay_call *slab = NULL;
+	relay_sub *subs = NULL;
+	int s, j, i, top;
+
+	if(index < r->top)
+		return 0;
+	top = r->top;
+	for(s = r->top / SIPCALL_SLAB; s <= index / SIPCALL_SLAB; s++) {
+		top = (s + 1) * SIPCALL_SLAB;
+		if(NULL != r->slabs[s])
+			continue;
+		slab = (relay_call *)osip_malloc(sizeof(relay_call) * SIPCALL_SLAB);
+		if(NULL == slab)
+			return -1;
+		memset(slab,0,sizeof(relay_call) * SIPCALL_SLAB);
+		for(j = 0; j < SIPCALL_SLAB; j++) {
+			slab[j].call.callid = -1;
+		}
+		__atomic_store_n(&r->slabs[s],slab,__ATOMIC_RELEASE);
+	}
+	if(top > r->maxcalls)
+		top = r->maxcalls;
+	for(i = 0; i < stream_max; i++) {
+		subs = (relay_sub *)osip_realloc(r->subs[i],sizeof(relay_sub) * top);
+		if(NULL == subs)
+			return -1;
+		r->subs[i] = subs;
+	}
+	__atomic_store_n(&r->top,top,__ATOMIC_RELEASE);
+	return relay_flows_reserve(co);
 }
 
-int streams_loop(core *co)
-{	
-	int callnum = core_sipcallnum_get(co);
-	int rtpproxy = core_rtpproxy_get(co);
+static int 
+relay_fd_shared(struct relay_t *r,int fd)
+{
+	int i;
 	
-	if( rtpproxy && callnum > 0){
-		streams_rtsp_loop(co);
-		if(co->symmetric_rtp){
-			streams_sip_loop(co);
-		}
-	}else{
-		osip_usleep(50000);
+	if(fd <= 0)
+		return 0;
+	for(i = 0; i < stream_max; i++) {
+		if(fd == r->shared_fds[i])
+			return 1;
 	}
 	return 0;
 }
 
-
+/* fds[i] is a socket of its own: not a shared one, not the rtp one again (rtcp-mux) */
+static int 
+relay_fd_owned(struct relay_t *r,const int *fds,int i)
+{
+	if(fds[i] <= 0 || relay_fd_shared(r,fds[i]))
+		return 0;
+	if((stream_audio_rtcp == i || stream_video_rtcp == i) && fds[i] == fds[i-1])
+		return 0;
+	return 1;
+}
+
+static unsigned int 
+relay_flow_hash(struct relay_t *r,uint64_t key)
+{
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & r->flow_mask;
+}
+
+/* linear probing, entries only go away with a rebuild */
+static void 
+relay_flow_insert(struct relay_t *r,uint64_t key,int index)
+{
+	unsigned int h = relay_flow_hash(r,key);
+	unsigned int n;
+	
+	for(n = 0; n <= r->flow_mask; n++, h = (h+1) & r->flow_mask) {
+		if(r->flows[h].index < 0 || r->flows[h].key == key) {
+			r->flows[h].key = key;
+			r->flows[h].index = index;
+			return;
+		}
+	}
+}
+
+static int 
+relay_flow_find(struct relay_t *r,uint64_t key)
+{
+	unsigned int h = relay_flow_hash(r,key);
+	unsigned int n;
+	
+	for(n = 0; n <= r->flow_mask; n++, h = (h+1) & r->flow_mask) {
+		if(r->flows[h].index < 0)
+			return -1;
+		if(r->flows[h].key == key)
+			return r->flows[h].index;
+	}
+	return -1;
+}
+
+static void 
+relay_flows_rebuild(core *co)
+{
+	struct relay_t *r = co->relay;
+	sipcall *call = NULL;
+	uint32_t ssrc;
+	unsigned int h;
+	int i, j;
+
+	if(NULL == r->flows)
+		return;
+	for(h = 0; h <= r->flow_mask; h++) {
+		r->flows[h].index = -1;
+	}
+	for(j = 0; j < r->top; j++) {
+		call = &RELAY_CALL(r,j)->call;
+		if(call->callid <= 0)
+			continue;
+		for(i = 0; i < stream_max; i++) {
+			if(!relay_fd_shared(r,call->fds[i]))
+				continue;
+			if(0 != call->remote[i].sin_port) {
+				relay_flow_insert(r,RELAY_FLOW_ADDR(call->remote[i].sin_addr.s_addr,
+					call->remote[i].sin_port,i),j);
+			}
+			ssrc = RELAY_CALL(r,j)->peer_ssrc[i];
+			if(0 != ssrc) {
+				relay_flow_insert(r,RELAY_FLOW_SSRC(ssrc,i),j);
+			}
+		}
+	}
+}
+
+static void 
+relay_rtsp_close(core *co,int index)
+{
+	struct relay_t *r = co->relay;
+	int i;
+	
+	for(i = 0; i < stream_max; i++) {
+		if(relay_fd_owned(r,r->cams[index].fds,i)) {
+			relay_epoll_del(co,r->cams[index].fds[i]);
+			close(r->cams[index].fds[i]);
+		}
+	}
+	memset(&r->cams[index],0,sizeof(rtspserver));
+	if(NULL != r->gops)
+		gop_cache_reset(r->gops[index],h26x_none);
+	if(NULL != r->repacks)
+		repack_reset(r->repacks[index],h26x_none);
+	memset(&r->keyframes[index],0,sizeof(relay_keyframe));
+}
+
+static long 
+relay_now_ms(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void 
+relay_put32(unsigned char *p,uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p,&v,sizeof(v));
+}
+
+/* 
+* camera c ==> pli (rfc4585), or fir (rfc5104) when a viewer asked for one.
+* every viewer of the camera shares one request per [rtp] keyframe_interval.
+*/
+static void 
+relay_keyframe_request(core *co,int c,int fir)
+{
+	struct relay_t *r = co->relay;
+	relay_keyframe *kf = &r->keyframes[c];
+	rtspserver *cam = &r->cams[c];
+	stream_mode m = stream_video_rtcp;
+	unsigned char pkt[20];
+	size_t len = 12;
+	long now;
+
+	if(co->rtp_keyframe_interval <= 0)
+		return;
+	now = relay_now_ms();
+	if(0 != kf->last_ms && now - kf->last_ms < co->rtp_keyframe_interval){
+		RELAY_STAT_ADD(kf->suppressed,1);
+		return;
+	}
+	if(STREAM_MUXED(cam->fds,stream_video_rtp))
+		m = stream_video_rtp;
+	if(0 == kf->ssrc || cam->fds[m] <= 0 || 0 == cam->remote[m].sin_port){
+		RELAY_STAT_ADD(kf->failed,1);
+		return;
+	}
+	memset(pkt,0,sizeof(pkt));
+	pkt[0] = 0x80 | (fir ? 4 : 1);
+	pkt[1] = 206;	/* payload-specific feedback */
+	relay_put32(pkt + 4,r->rtcp_ssrc);
+	if(fir){
+		/* media ssrc 0, the fci names the camera */
+		relay_put32(pkt + 12,kf->ssrc);
+		pkt[16] = kf->fir_seq++;
+		len = 20;
+	}else{
+		relay_put32(pkt + 8,kf->ssrc);
+	}
+	pkt[3] = (unsigned char)(len / 4 - 1);
+	if(sendto(cam->fds[m],pkt,len,0,(struct sockaddr *)&cam->remote[m],sizeof(cam->remote[m])) < 0){
+		RELAY_STAT_ADD(kf->failed,1);
+		log(co,LOG_DEBUG,"camera %d %s sendto failed:%s\n",c,fir ? "fir" : "pli",strerror(errno));
+		return;
+	}
+	kf->last_ms = now;
+	RELAY_STAT_ADD(kf->sent,1);
+	log(co,LOG_DEBUG,"camera %d %s ssrc=%08x\n",c,fir ? "fir" : "pli",kf->ssrc);
+}
+
+/* rtcp compound from a video viewer: keyframe requests and nacks go upstream */
+static void 
+relay_rtcp_feedback(core *co,int j,const char *pkt,size_t len)
+{
+	struct relay_t *r = co->relay;
+	const unsigned char *p = (const unsigned char *)pkt;
+	int c = RELAY_CALL(r,j)->call.camera;
+	int pli = 0, fir = 0;
+	size_t off, n;
+
+	if(c < 0 || c >= r->ncams)
+		return;
+	for(off = 0; off + 4 <= len; off += n) {
+		n = ((((size_t)p[off+2] << 8) | p[off+3]) + 1) * 4;
+		if(2 != (p[off] >> 6) || off + n > len)
+			break;
+		if(206 == p[off+1] && 1 == (p[off] & 0x1F)){
+			RELAY_STAT_ADD(r->feedback[relay_fb_pli],1);
+			pli = 1;
+		}else if(206 == p[off+1] && 4 == (p[off] & 0x1F)){
+			RELAY_STAT_ADD(r->feedback[relay_fb_fir],1);
+			fir = 1;
+		}else if(205 == p[off+1] && 1 == (p[off] & 0x1F)){
+			/* the camera does not retransmit: a lost reference heals with a keyframe */
+			RELAY_STAT_ADD(r->feedback[relay_fb_nack],1);
+			pli = 1;
+		}
+	}
+	if(fir || pli)
+		relay_keyframe_request(co,c,fir);
+}
+
+static void 
+relay_epoll_mod(core *co,int fd,uint64_t key,int *armed,int out)
+{
+	struct epoll_event ev;
+
+	if(*armed == out)
+		return;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.u64 = key;
+	if(0 == epoll_ctl(co->relay->epfd,EPOLL_CTL_MOD,fd,&ev))
+		*armed = out;
+}
+
+/* wait for room on the socket of call j stream i (out 1), or stop waiting */
+static void 
+relay_epoll_out(core *co,int j,stream_mode i,int out)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,j);
+	int fd = rc->call.fds[i];
+	int m;
+
+	for(m = 0; m < stream_max; m++) {
+		if(fd == r->shared_fds[m]){
+			relay_epoll_mod(co,fd,RELAY_KEY_SHARED(m),&r->shared_out[m],out);
+			return;
+		}
+	}
+	/* rtcp-mux: the socket is registered as the rtp stream */
+	m = i;
+	if((stream_audio_rtcp == i || stream_video_rtcp == i) && fd == rc->call.fds[i-1])
+		m = i - 1;
+	relay_epoll_mod(co,fd,RELAY_KEY(j,m,side_sip),&rc->out_armed[m],out);
+}
+
+/* call j stream i cannot take a datagram now: it waits behind the others */
+static void 
+relay_sub_queue(core *co,int j,stream_mode i,const struct iovec *iov,int iovcnt)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,j);
+	h26x_codec codec = h26x_none;
+	send_queue_result res;
+
+	if(co->rtp_send_queue <= 0){
+		relay_stat_call_out(r,j,i,0,0,1,EAGAIN);
+		return;
+	}
+	if(NULL == rc->sendq[i]){
+		rc->sendq[i] = send_queue_new(co->rtp_send_queue);
+		if(NULL == rc->sendq[i]){
+			relay_stat_call_out(r,j,i,0,0,1,EAGAIN);
+			return;
+		}
+	}
+	if(stream_video_rtp == i)
+		codec = h26x_codec_of(r->cams[rc->call.camera].payload[i].mime_type);
+	res = send_queue_push(rc->sendq[i],codec,iov,iovcnt);
+	if(send_queue_dropped == res){
+		RELAY_STAT_ADD(rc->stats[i].queue_drops,1);
+	}else if(send_queue_resync == res){
+		RELAY_STAT_ADD(rc->stats[i].resyncs,1);
+		log(co,LOG_DEBUG,"call(%d-%d) stream %d send queue full, waiting for a keyframe\n",
+			j,rc->call.callid,i);
+		relay_keyframe_request(co,rc->call.camera,0);
+	}
+	if(send_queue_count(rc->sendq[i]) > 0)
+		relay_epoll_out(co,j,i,1);
+}
+
+/* one datagram to a viewer: straight out unless others wait, a full socket queues it */
+static void 
+relay_sub_send(core *co,relay_sub *sub,stream_mode i,struct msghdr *msg)
+{
+	struct relay_t *r = co->relay;
+	int ret;
+
+	if(send_queue_blocked(RELAY_CALL(r,sub->index)->sendq[i])){
+		relay_sub_queue(co,sub->index,i,msg->msg_iov,msg->msg_iovlen);
+		return;
+	}
+	ret = sendmsg(sub->fd,msg,0);
+	if(ret >= 0){
+		relay_stat_call_out(r,sub->index,i,1,ret,0,0);
+	}else if(EAGAIN == errno || EWOULDBLOCK == errno){
+		relay_sub_queue(co,sub->index,i,msg->msg_iov,msg->msg_iovlen);
+	}else{
+		relay_stat_call_out(r,sub->index,i,0,0,1,errno);
+		log(co,LOG_DEBUG,"call(%d-%d) stream %d sendmsg failed:%s\n",
+			sub->index,sub->callid,i,strerror(errno));
+	}
+}
+
+/* room on the socket of call j stream i: what waited goes out in order, 1: some still waits */
+static int 
+relay_sendq_drain(core *co,int j,stream_mode i)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,j);
+	const char *pkt = NULL;
+	size_t len = 0;
+	int ret;
+
+	while(NULL != (pkt = send_queue_peek(rc->sendq[i],&len))) {
+		ret = sendto(rc->call.fds[i],pkt,len,0,
+			(struct sockaddr *)&rc->call.remote[i],sizeof(rc->call.remote[i]));
+		if(ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			return 1;
+		if(ret < 0){
+			relay_stat_call_out(r,j,i,0,0,1,errno);
+		}else{
+			relay_stat_call_out(r,j,i,1,ret,0,0);
+			RELAY_STAT_ADD(rc->stats[i].queued,1);
+		}
+		send_queue_pop(rc->sendq[i]);
+	}
+	return 0;
+}
+
+/* EPOLLOUT on a sip side socket: one call's, or shared by every call */
+static void 
+stream_sip_writable(core *co,uint64_t key)
+{
+	struct relay_t *r = co->relay;
+	stream_mode m = RELAY_KEY_MODE(key);
+	relay_call *rc = NULL;
+	int j, i, fd, busy = 0;
+
+	if(side_max == RELAY_KEY_SIDE(key)){
+		fd = r->shared_fds[m];
+		for(j = 0; j < r->top; j++) {
+			rc = RELAY_CALL(r,j);
+			for(i = 0; i < stream_max; i++) {
+				if(fd == rc->call.fds[i] && NULL != rc->sendq[i])
+					busy |= relay_sendq_drain(co,j,i);
+			}
+		}
+		if(!busy)
+			relay_epoll_mod(co,fd,key,&r->shared_out[m],0);
+		for(j = 0; j < r->top; j++) {
+			rc = RELAY_CALL(r,j);
+			if(rc->burst && fd == rc->call.fds[stream_video_rtp])
+				relay_gop_step(co,j);
+		}
+		return;
+	}
+	j = RELAY_KEY_INDEX(key);
+	if(j < 0 || j >= r->top)
+		return;
+	rc = RELAY_CALL(r,j);
+	for(i = m; i < stream_max && i <= m + 1; i++) {
+		if(rc->call.fds[i] == rc->call.fds[m] && NULL != rc->sendq[i])
+			busy |= relay_sendq_drain(co,j,i);
+	}
+	if(!busy)
+		relay_epoll_mod(co,rc->call.fds[m],key,&rc->out_armed[m],0);
+	if(rc->burst && rc->call.fds[m] == rc->call.fds[stream_video_rtp])
+		relay_gop_step(co,j);
+}
+
+/* 
+* the cached group to call j from where it stopped, until a packet has to 
+* wait in the send queue; EPOLLOUT brings it back once that drained. live 
+* video to the call is skipped meanwhile, the cache has it too.
+*/
+static void 
+relay_gop_step(core *co,int j)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,j);
+	stream_mode i = stream_video_rtp;
+	relay_sub *sub = NULL;
+	gop_cache *gc = r->gops[rc->call.camera];
+	char hdr[RTP_HEADER_LEN];
+	struct iovec iov[2];
+	struct msghdr msg;
+	const char *pkt = NULL;
+	size_t len = 0;
+	int k;
+
+	for(k = r->first[i][rc->call.camera]; k < r->first[i][rc->call.camera+1]; k++) {
+		if(j == r->subs[i][k].index){
+			sub = &r->subs[i][k];
+			break;
+		}
+	}
+	if(NULL == sub){
+		rc->burst = 0;
+		return;
+	}
+	if(gop_cache_gen(gc) != rc->burst_gen){
+		/* a newer group starts with its own keyframe */
+		rc->burst_gen = gop_cache_gen(gc);
+		rc->burst_next = 0;
+		if(0 == gop_cache_count(gc)){
+			/* outgrown under the walk: live resumes mid group */
+			rc->burst = 0;
+			relay_keyframe_request(co,rc->call.camera,0);
+			return;
+		}
+	}
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_name = &sub->remote;
+	msg.msg_namelen = sizeof(struct sockaddr_in);
+	while(rc->burst_next < gop_cache_count(gc) && 0 == send_queue_count(rc->sendq[i])) {
+		pkt = gop_cache_packet(gc,rc->burst_next++,&len);
+		msg.msg_iovlen = relay_sub_iov(sub,(char *)pkt,len,1,hdr,iov);
+		relay_sub_send(co,sub,i,&msg);
+		RELAY_STAT_ADD(r->gop_burst_packets,1);
+	}
+	/* a packet still queued goes out ahead of the live ones */
+	if(rc->burst_next >= gop_cache_count(gc)){
+		rc->burst = 0;
+		log(co,LOG_DEBUG,"call(%d-%d) camera %d gop %d packets sent\n",
+			j,rc->call.callid,rc->call.camera,rc->burst_next);
+	}
+}
+
+/* 
+* call j just became a video viewer of its camera: the cached group goes 
+* out first, paced by its send queue. returns the packets cached.
+*/
+static int 
+relay_gop_burst(core *co,int j)
+{
+	struct relay_t *r = co->relay;
+	relay_call *rc = RELAY_CALL(r,j);
+	int n;
+
+	if(NULL == r->gops)
+		return 0;
+	n = gop_cache_count(r->gops[rc->call.camera]);
+	if(0 == n)
+		return 0;
+	rc->burst = 1;
+	rc->burst_next = 0;
+	rc->burst_gen = gop_cache_gen(r->gops[rc->call.camera]);
+	RELAY_STAT_ADD(r->gop_bursts,1);
+	relay_gop_step(co,j);
+	return n;
+}
+
+/* the gop cache is relay thread only: its size goes out through atomics */
+static void 
+relay_gop_publish(struct relay_t *r,int c)
+{
+	__atomic_store_n(&r->keyframes[c].gop_packets,(unsigned long)gop_cache_count(r->gops[c]),__ATOMIC_RELAXED);
+	__atomic_store_n(&r->keyframes[c].gop_bytes,(unsigned long)gop_cache_bytes(r->gops[c]),__ATOMIC_RELAXED);
+}
+
+/* camera c video rtp: its ssrc for keyframe requests, the group for late viewers */
+static void 
+relay_video_in(struct relay_t *r,int c,stream_mode mode,const char *pkt,size_t len)
+{
+	if(stream_video_rtp != mode)
+		return;
+	r->keyframes[c].ssrc = ntohl(((const rtp_header *)pkt)->ssrc);
+	if(NULL != r->gops){
+		gop_cache_add(r->gops[c],pkt,len);
+		relay_gop_publish(r,c);
+	}
+}
+
+/* relay side: apply one command */
+static void 
+relay_cmd_process(core *co,relay_cmd *cmd)
+{
+	struct relay_t *r = co->relay;
+	sipcall *call = NULL;
+	h26x_codec codec;
+	int i, viewer, restart;
+
+	switch(cmd->type) {
+	case relay_cmd_call_set:
+		if(cmd->index < 0 || cmd->index >= r->maxcalls)
+			break;
+		if(relay_calls_grow(co,cmd->index) < 0){
+			log(co,LOG_ERR,"relay call table grow to slot %d failed\n",cmd->index);
+			break;
+		}
+		call = &RELAY_CALL(r,cmd->index)->call;
+		viewer = relay_sub_wanted(r,call,stream_video_rtp);
+		if(cmd->u.call.callid != call->callid){
+			memset(RELAY_CALL(r,cmd->index)->peer_ssrc,0,sizeof(uint32_t) * stream_max);
+			memset(RELAY_CALL(r,cmd->index)->stats,0,sizeof(relay_stat) * stream_max);
+		}
+		for(i = 0; i < stream_max; i++) {
+			if(cmd->u.call.fds[i] == call->fds[i]) 
+				continue;
+			send_queue_free(RELAY_CALL(r,cmd->index)->sendq[i]);
+			RELAY_CALL(r,cmd->index)->sendq[i] = NULL;
+			RELAY_CALL(r,cmd->index)->out_armed[i] = 0;
+			if(stream_video_rtp == i)
+				RELAY_CALL(r,cmd->index)->burst = 0;
+			if(relay_fd_owned(r,call->fds,i)) {
+				relay_epoll_del(co,call->fds[i]);
+				close(call->fds[i]);
+			}
+			if(relay_fd_owned(r,cmd->u.call.fds,i)) {
+				relay_epoll_add(co,cmd->u.call.fds[i],cmd->index,i,side_sip);
+			}
+		}
+		memcpy(call,&cmd->u.call,sizeof(sipcall));
+		for(i = 0; i < stream_max; i++) {
+			relay_subs_rebuild(co,i);
+		}
+		relay_flows_rebuild(co);
+		/* nothing cached to start from: ask the camera */
+		if(!viewer && relay_sub_wanted(r,call,stream_video_rtp) &&
+			relay_gop_burst(co,cmd->index) <= 0){
+			relay_keyframe_request(co,call->camera,0);
+		}
+		break;
+	case relay_cmd_call_del:
+		if(cmd->index < 0 || cmd->index >= r->maxcalls)
+			break;
+		/* sockets of a call that was never answered are unknown here */
+		for(i = 0; i < stream_max; i++) {
+			if((cmd->index >= r->top || cmd->u.call.fds[i] != RELAY_CALL(r,cmd->index)->call.fds[i]) &&
+				relay_fd_owned(r,cmd->u.call.fds,i)) {
+				close(cmd->u.call.fds[i]);
+			}
+		}
+		if(cmd->index >= r->top)
+			break;
+		relay_call_close(co,cmd->index);
+		for(i = 0; i < stream_max; i++) {
+			relay_subs_rebuild(co,i);
+		}
+		relay_flows_rebuild(co);
+		break;
+	case relay_cmd_rtsp_set:
+		if(cmd->index < 0 || cmd->index >= r->ncams)
+			break;
+		codec = h26x_codec_of(cmd->u.rtsp.payload[stream_video_rtp].mime_type);
+		restart = (cmd->u.rtsp.fds[stream_video_rtp] != r->cams[cmd->index].fds[stream_video_rtp] ||
+			codec != h26x_codec_of(r->cams[cmd->index].payload[stream_video_rtp].mime_type));
+		for(i = 0; i < stream_max; i++) {
+			if(cmd->u.rtsp.fds[i] > 0 && cmd->u.rtsp.fds[i] != r->cams[cmd->index].fds[i]) {
+				/* replaced: unicast pair by multicast group, rtcp by rtcp-mux */
+				if(relay_fd_owned(r,r->cams[cmd->index].fds,i)) {
+					relay_epoll_del(co,r->cams[cmd->index].fds[i]);
+					close(r->cams[cmd->index].fds[i]);
+				}
+				if(relay_fd_owned(r,cmd->u.rtsp.fds,i)) {
+					relay_epoll_add(co,cmd->u.rtsp.fds[i],cmd->index,i,side_rtsp);
+				}
+			}
+		}
+		memcpy(&r->cams[cmd->index],&cmd->u.rtsp,sizeof(rtspserver));
+		if(restart && NULL != r->gops){
+			gop_cache_reset(r->gops[cmd->index],codec);
+			relay_gop_publish(r,cmd->index);
+		}
+		if(restart && NULL != r->repacks){
+			repack_reset(r->repacks[cmd->index],codec);
+		}
+		if(restart){
+			r->keyframes[cmd->index].ssrc = 0;
+		}
+		break;
+	case relay_cmd_rtsp_del:
+		if(cmd->index < 0 || cmd->index >= r->ncams)
+			break;
+		/* sockets of a camera whose calls never got answered are unknown here */
+		for(i = 0; i < stream_max; i++) {
+			if(cmd->u.rtsp.fds[i] != r->cams[cmd->index].fds[i] && 
+				relay_fd_owned(r,cmd->u.rtsp.fds,i)) {
+				close(cmd->u.rtsp.fds[i]);
+			}
+		}
+		relay_rtsp_close(co,cmd->index);
+		break;
+	case relay_cmd_quit:
+		r->running = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+static void 
+relay_cmd_drain(core *co)
+{
+	struct relay_t *r = co->relay;
+	unsigned int head = r->head;
+	uint64_t val;
+	
+	if(read(r->wakefd,&val,sizeof(val)) < 0){
+		/* EAGAIN, nothing posted */
+	}
+	while(head != __atomic_load_n(&r->tail,__ATOMIC_ACQUIRE)){
+		relay_cmd_process(co,&r->queue[head & (RELAY_QUEUE_LEN-1)]);
+		head++;
+		__atomic_store_n(&r->head,head,__ATOMIC_RELEASE);
+	}
+}
+
+static int 
+relay_batch_init(core *co)
+{
+	struct relay_t *r = co->relay;
+	int k;
+
+	r->batch = co->rtp_batch;
+	if(r->batch <= 1){
+		r->batch = 0;
+		return 0;
+	}
+	r->rbufs = (char *)osip_malloc(r->batch * RECV_BUFF_DEFAULT_LEN);
+	r->shdrs = (char *)osip_malloc(r->batch * RTP_HEADER_LEN);
+	r->rtpflags = (char *)osip_malloc(r->batch);
+	r->rfrom = (struct sockaddr_in *)osip_malloc(r->batch * sizeof(struct sockaddr_in));
+	r->riovs = (struct iovec *)osip_malloc(r->batch * sizeof(struct iovec));
+	r->siovs = (struct iovec *)osip_malloc(2 * r->batch * sizeof(struct iovec));
+	r->rmsgs = (struct mmsghdr *)osip_malloc(r->batch * sizeof(struct mmsghdr));
+	r->smsgs = (struct mmsghdr *)osip_malloc(r->batch * sizeof(struct mmsghdr));
+	if(NULL == r->rbufs || NULL == r->shdrs || NULL == r->rtpflags ||
+		NULL == r->rfrom || NULL == r->riovs || 
+		NULL == r->siovs || NULL == r->rmsgs || NULL == r->smsgs){
+		return -1;
+	}
+	memset(r->rmsgs,0,r->batch * sizeof(struct mmsghdr));
+	memset(r->smsgs,0,r->batch * sizeof(struct mmsghdr));
+	for(k = 0; k < r->batch; k++) {
+		r->riovs[k].iov_base = r->rbufs + k * RECV_BUFF_DEFAULT_LEN;
+		r->riovs[k].iov_len = RECV_BUFF_DEFAULT_LEN;
+		r->rmsgs[k].msg_hdr.msg_iov = &r->riovs[k];
+		r->rmsgs[k].msg_hdr.msg_iovlen = 1;
+		r->rmsgs[k].msg_hdr.msg_name = &r->rfrom[k];
+		r->smsgs[k].msg_hdr.msg_iov = &r->siovs[2*k];
+		r->smsgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	return 0;
+}
+
+static int 
+relay_uring_setup(core *co)
+{
+	struct relay_t *r = co->relay;
+	int k;
+
+	if(relay_uring_init(co,&r->uring,RELAY_URING_ENTRIES,RELAY_URING_BUFS,
+		RECV_BUFF_DEFAULT_LEN + 64) < 0){
+		return -1;
+	}
+	r->usends = (relay_usend *)osip_malloc(RELAY_URING_SENDS * sizeof(relay_usend));
+	r->usend_free = (int *)osip_malloc(RELAY_URING_SENDS * sizeof(int));
+	r->bufref = (unsigned short *)osip_malloc(RELAY_URING_BUFS * sizeof(unsigned short));
+	if(NULL == r->usends || NULL == r->usend_free || NULL == r->bufref)
+		return -1;
+	memset(r->usends,0,RELAY_URING_SENDS * sizeof(relay_usend));
+	memset(r->bufref,0,RELAY_URING_BUFS * sizeof(unsigned short));
+	for(k = 0; k < RELAY_URING_SENDS; k++) {
+		r->usend_free[k] = RELAY_URING_SENDS - 1 - k;
+	}
+	r->nusend_free = RELAY_URING_SENDS;
+	return 0;
+}
+
+static void 
+relay_uring_cleanup(struct relay_t *r)
+{
+	relay_uring_free(r->uring);
+	r->uring = NULL;
+	osip_free(r->usends);
+	osip_free(r->usend_free);
+	osip_free(r->bufref);
+	r->usends = NULL;
+	r->usend_free = NULL;
+	r->bufref = NULL;
+}
+
+static void 
+relay_batch_free(struct relay_t *r)
+{
+	osip_free(r->rbufs);
+	osip_free(r->shdrs);
+	osip_free(r->rtpflags);
+	osip_free(r->rfrom);
+	osip_free(r->riovs);
+	osip_free(r->siovs);
+	osip_free(r->rmsgs);
+	osip_free(r->smsgs);
+}
+
+/* 
+* [rtp] shared_port: an address and an ssrc per stream and call below top 
+* (a slab at least), at most half full. rebuilt when it grows.
+*/
+static int 
+relay_flows_reserve(core *co)
+{
+	struct relay_t *r = co->relay;
+	relay_flow *flows = NULL;
+	unsigned int size = 1;
+	unsigned int calls = r->top > SIPCALL_SLAB ? r->top : SIPCALL_SLAB;
+
+	if(co->rtp_shared_port <= 0)
+		return 0;
+	while(size < 4 * stream_max * calls) size <<= 1;
+	if(NULL != r->flows && size == r->flow_mask + 1)
+		return 0;
+	flows = (relay_flow *)osip_malloc(sizeof(relay_flow) * size);
+	if(NULL == flows)
+		return -1;
+	osip_free(r->flows);
+	r->flows = flows;
+	r->flow_mask = size - 1;
+	relay_flows_rebuild(co);
+	return 0;
+}
+
+/* [rtp] shared_port: audio rtp/rtcp, video rtp/rtcp on 4 consecutive ports */
+static int 
+relay_shared_init(core *co)
+{
+	struct relay_t *r = co->relay;
+	int i, port;
+	
+	for(i = 0; i < stream_max; i++) {
+		r->shared_fds[i] = -1;
+	}
+	if(co->rtp_shared_port <= 0)
+		return 0;
+	
+	if(relay_flows_reserve(co) < 0)
+		return -1;
+	
+	for(i = 0; i < stream_max; i++) {
+		port = co->rtp_shared_port + i;
+		r->shared_local[i].sin_family = AF_INET;
+		r->shared_local[i].sin_addr.s_addr = inet_addr(co->sip_localip);
+		r->shared_local[i].sin_port = htons(port);
+		r->shared_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if(r->shared_fds[i] < 0)
+			return -1;
+		if(bind(r->shared_fds[i],(struct sockaddr *)&r->shared_local[i],sizeof(r->shared_local[i])) < 0){
+			log(co,LOG_ERR,"rtpproxy shared bind(%s:%d) failed:%s\n",
+				co->sip_localip,port,strerror(errno));
+			return -1;
+		}
+		sock_noblocking_set(r->shared_fds[i]);
+		relay_epoll_add(co,r->shared_fds[i],1,i,side_max);
+	}
+	return 0;
+}
+
+/* everything the relay holds but call and camera sockets, any part may be missing */
+static void 
+relay_free(struct relay_t *r)
+{
+	int i, j;
+
+	if(NULL == r)
+		return;
+	for(i = 0; i < stream_max; i++) {
+		if(r->shared_fds[i] > 0) {
+			close(r->shared_fds[i]);
+		}
+	}
+	if(r->epfd >= 0)
+		close(r->epfd);
+	if(r->wakefd >= 0)
+		close(r->wakefd);
+	relay_batch_free(r);
+	relay_uring_cleanup(r);
+	osip_free(r->flows);
+	for(i = 0; i < stream_max; i++) {
+		osip_free(r->subs[i]);
+		osip_free(r->first[i]);
+	}
+	osip_free(r->fill);
+	osip_free(r->camstats);
+	osip_free(r->keyframes);
+	osip_free(r->cams);
+	for(j = 0; NULL != r->gops && j < r->ncams; j++) {
+		gop_cache_free(r->gops[j]);
+	}
+	osip_free(r->gops);
+	for(j = 0; NULL != r->repacks && j < r->ncams; j++) {
+		repack_free(r->repacks[j]);
+	}
+	osip_free(r->repacks);
+	for(j = 0; NULL != r->slabs && j < r->nslabs; j++) {
+		osip_free(r->slabs[j]);
+	}
+	osip_free(r->slabs);
+	osip_free(r);
+}
+
+int 
+streams_init(core *co)
+{
+	struct relay_t *r = NULL;
+	int rtpproxy = core_rtpproxy_get(co);
+	int j;
+	
+	if(0 == rtpproxy)
+		return 0;
+
+	co->port_pool = port_pool_new(co->rtp_start_port,co->rtp_end_port,co->rtp_port_quarantine);
+	if(NULL == co->port_pool){
+		return -1;
+	}
+	if(sock_prepool_init(co) < 0){
+		goto prepool_failed;
+	}
+	r = (struct relay_t *)osip_malloc(sizeof(struct relay_t));
+	if(NULL == r){
+		goto prepool_failed;
+	}
+	memset(r,0,sizeof(struct relay_t));
+	r->epfd = -1;
+	r->wakefd = -1;
+	r->maxcalls = co->maxcalls;
+	r->nslabs = (r->maxcalls + SIPCALL_SLAB - 1) / SIPCALL_SLAB;
+	r->slabs = (relay_call **)osip_malloc(sizeof(relay_call *) * r->nslabs);
+	if(NULL == r->slabs){
+		goto relay_failed;
+	}
+	memset(r->slabs,0,sizeof(relay_call *) * r->nslabs);
+	r->ncams = camera_count(co);
+	r->cams = (rtspserver *)osip_malloc(sizeof(rtspserver) * r->ncams);
+	r->fill = (int *)osip_malloc(sizeof(int) * r->ncams);
+	r->camstats = (relay_stat *)osip_malloc(sizeof(relay_stat) * stream_max * r->ncams);
+	r->keyframes = (relay_keyframe *)osip_malloc(sizeof(relay_keyframe) * r->ncams);
+	if(NULL == r->cams || NULL == r->fill || NULL == r->camstats || NULL == r->keyframes){
+		goto relay_failed;
+	}
+	memset(r->keyframes,0,sizeof(relay_keyframe) * r->ncams);
+	r->rtcp_ssrc = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+	memset(r->cams,0,sizeof(rtspserver) * r->ncams);
+	memset(r->camstats,0,sizeof(relay_stat) * stream_max * r->ncams);
+	for(j = 0; j < stream_max; j++) {
+		r->first[j] = (int *)osip_malloc(sizeof(int) * (r->ncams+1));
+		if(NULL == r->first[j]){
+			goto relay_failed;
+		}
+		memset(r->first[j],0,sizeof(int) * (r->ncams+1));
+	}
+	r->epfd = epoll_create(RELAY_MAX_EVENTS);
+	r->wakefd = eventfd(0,EFD_NONBLOCK);
+	if(r->epfd < 0 || r->wakefd < 0){
+		log(co,LOG_ERR,"relay init failed:%s\n",strerror(errno));
+		goto relay_failed;
+	}
+	if(co->rtp_gop_cache > 0){
+		r->gops = (gop_cache **)osip_malloc(sizeof(gop_cache *) * r->ncams);
+		if(NULL == r->gops){
+			goto relay_failed;
+		}
+		memset(r->gops,0,sizeof(gop_cache *) * r->ncams);
+		for(j = 0; j < r->ncams; j++) {
+			r->gops[j] = gop_cache_new((size_t)co->rtp_gop_cache * 1024);
+			if(NULL == r->gops[j]){
+				goto relay_failed;
+			}
+		}
+	}
+	if(co->rtp_mtu > 0){
+		r->repacks = (repack **)osip_malloc(sizeof(repack *) * r->ncams);
+		if(NULL == r->repacks){
+			goto relay_failed;
+		}
+		memset(r->repacks,0,sizeof(repack *) * r->ncams);
+		for(j = 0; j < r->ncams; j++) {
+			/* ipv4 and udp headers */
+			r->repacks[j] = repack_new(co->rtp_mtu - 28);
+			if(NULL == r->repacks[j]){
+				goto relay_failed;
+			}
+		}
+	}
+	co->relay = r;
+	relay_epoll_add(co,r->wakefd,0,0,side_max);
+	if(relay_batch_init(co) < 0){
+		log(co,LOG_ERR,"relay batch %d init failed\n",co->rtp_batch);
+		goto relay_failed;
+	}
+	if(0 == strcasecmp(co->rtp_backend,"io_uring") && relay_uring_setup(co) < 0){
+		log(co,LOG_WARNING,"relay backend io_uring unavailable, epoll used\n");
+		relay_uring_cleanup(r);
+	}
+	
+	if(relay_shared_init(co) < 0){
+		log(co,LOG_ERR,"relay shared_port %d init failed\n",co->rtp_shared_port);
+		goto relay_failed;
+	}
+	
+	/* camera sockets are created when the first call joins a camera */
+	payload_init(co);
+
+	r->running = 1;
+	co->relay_thread = osip_thread_create(20000, streams_loop, co);
+	if(NULL == co->relay_thread){
+		log(co,LOG_ERR,"relay thread create failed\n");
+		goto relay_failed;
+	}
+	core_show(co);
+	return 0;
+
+relay_failed:
+	relay_free(r);
+	co->relay = NULL;
+prepool_failed:
+	sock_prepool_free(co);
+	port_pool_free(co->port_pool);
+	co->port_pool = NULL;
+	return -1;
+}
+
+/* rtp and rtcp on the camera side, shared by every call on the camera */
+int 
+stream_camera_start(core *co, int callid)
+{
+	return stream_camera_open(co,camera_of_call(co,callid));
+}
+
+/* same, before any call: warm sessions */
+int 
+stream_camera_open(core *co, camera *cam)
+{
+	int ret = 0;
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy)
+		return 0;
+	ret = camera_sock_pair_create(co,cam,stream_audio_rtp);
+	if(0 == ret) ret = camera_sock_pair_create(co,cam,stream_video_rtp);
+	/* the relay owns camera sockets from now on, see stream_camera_join */
+	if(NULL != cam)
+		relay_post(co,relay_cmd_rtsp_set,cam->index,&cam->rtsp,sizeof(rtspserver));
+	return ret;
+}
+
+/* SETUP answered multicast: receive the group instead of our unicast pair */
+int 
+stream_camera_join(core *co, camera *cam, stream_mode mode, const char *group, int port)
+{
+	struct in_addr addr;
+	int rtp_sock = -1;
+	int rtcp_sock = -1;
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy || NULL == cam || NULL == group || port <= 0)
+		return -1;
+	if(0 == inet_aton(group,&addr) || !IN_MULTICAST(ntohl(addr.s_addr))){
+		log(co,LOG_ERR,"rtsp %s destination %s is not a multicast group\n",cam->url,group);
+		return -1;
+	}
+	if(cam->rtsp.fds[mode] > 0 &&
+		cam->rtsp.local[mode].sin_addr.s_addr == addr.s_addr &&
+		cam->rtsp.local[mode].sin_port == htons(port)){
+		return 0; /* reconnect, already a member */
+	}
+	
+	rtp_sock = camera_mcast_sock_create(co,addr,port);
+	rtcp_sock = camera_mcast_sock_create(co,addr,port+1);
+	if(rtp_sock < 0 || rtcp_sock < 0){
+		if(rtp_sock >= 0)  close(rtp_sock);
+		if(rtcp_sock >= 0)  close(rtcp_sock);
+		return -1;
+	}
+	
+	/* the unicast pair is closed by the relay when it sees the new one */
+	sock_pair_release(co,cam->rtsp.fds,cam->rtsp.local,mode);
+	cam->rtsp.fds[mode] = rtp_sock;
+	cam->rtsp.fds[mode+1] = rtcp_sock;
+	memset(&cam->rtsp.remote[mode],0,sizeof(cam->rtsp.remote[mode]));
+	memset(&cam->rtsp.remote[mode+1],0,sizeof(cam->rtsp.remote[mode+1]));
+	cam->rtsp.local[mode].sin_addr = addr;
+	cam->rtsp.local[mode].sin_port = htons(port);
+	cam->rtsp.local[mode+1].sin_addr = addr;
+	cam->rtsp.local[mode+1].sin_port = htons(port+1);
+	relay_post(co,relay_cmd_rtsp_set,cam->index,&cam->rtsp,sizeof(rtspserver));
+	log(co,LOG_INFO,"rtsp %s joined %s:%d-%d\n",cam->url,group,port,port+1);
+	return 0;
+}
+
+int 
+stream_camera_stop(core *co, camera *cam)
+{
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy || NULL == cam)
+		return 0;
+
+	/* sockets are closed by the relay thread, quarantine covers the lag */
+	relay_post(co,relay_cmd_rtsp_del,cam->index,&cam->rtsp,sizeof(rtspserver));
+	sock_pairs_release(co,cam->rtsp.fds,cam->rtsp.local);
+	camera_rtsp_reset(cam);
+	return 0;
+}
+
+/* hand the current media state of a call (and of its camera) to the relay */
+int 
+stream_call_update(core *co, int callid)
+{
+	int j;
+	camera *cam = NULL;
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy)
+		return 0;
+
+	cam = camera_of_call(co,callid);
+	if(NULL != cam){
+		relay_post(co,relay_cmd_rtsp_set,cam->index,&cam->rtsp,sizeof(rtspserver));
+	}
+	j = core_sipcall_slot(co,callid);
+	if(j >= 0) {
+		relay_post(co,relay_cmd_call_set,j,core_sipcall_at(co,j),sizeof(sipcall));
+	}
+	return 0;
+}
+
+int 
+stream_call_stop(core *co, int callid)
+{
+	int i, j ;
+	sipcall *call = NULL;
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy)
+		return 0;
+		
+	j = core_sipcall_slot(co,callid);
+	if(j >= 0) {
+		/* sockets are closed by the relay thread, quarantine covers the lag */
+		call = core_sipcall_at(co,j);
+		relay_post(co,relay_cmd_call_del,j,call,sizeof(sipcall));
+		sock_pairs_release(co,call->fds,call->local);
+		for(i = 0; i < stream_max; i++) {
+			call->fds[i] = -1;
+		}
+	}
+	
+	return 0;
+}
+
+int 
+streams_stop(core *co)
+{
+	struct relay_t *r = co->relay;
+	camera *cam = NULL;
+	sipcall *call = NULL;
+	int i, j ;
+	int fd;
+	int rtpproxy = core_rtpproxy_get(co);
+	
+	if(0 == rtpproxy || NULL == r)
+		return 0;
+
+	relay_post(co,relay_cmd_quit,0,NULL,0);
+	if(NULL != co->relay_thread){
+		osip_thread_join(co->relay_thread);
+		osip_free(co->relay_thread);
+		co->relay_thread = NULL;
+	}
+	
+	/* relay thread is gone, close everything it owned */
+	for(j = 0; j < r->top; j++) {
+		if(RELAY_CALL(r,j)->call.callid > 0) {
+			relay_call_close(co,j);
+		}
+	}
+	for(j = 0; j < camera_count(co); j++) {
+		cam = camera_get(co,j);
+		for(i = stream_max-1; i >= 0; i--) {
+			fd = cam->rtsp.fds[i];
+			if(relay_fd_owned(r,cam->rtsp.fds,i)) {
+				close(fd);
+			}
+			cam->rtsp.fds[i] = -1;
+		}
+	}
+	for(j = 0; j < core_sipcall_top(co); j++) {
+		call = core_sipcall_at(co,j);
+		for(i = 0; NULL != call && i < stream_max; i++) {
+			call->fds[i] = -1;
+		}
+	}
+	relay_free(r);
+	co->relay = NULL;
+	sock_prepool_free(co);
+	port_pool_free(co->port_pool);
+	co->port_pool = NULL;
+	return 0;
+}
+
+/* rtp version 2 with at least one payload byte */
+static int 
+relay_is_rtp(stream_mode mode,const char *pkt,size_t len)
+{
+	if(stream_audio_rtp != mode && stream_video_rtp != mode)
+		return 0;
+	if(len <= RTP_HEADER_LEN)
+		return 0;
+	return 2 == ((const rtp_header *)pkt)->version;
+}
+
+/* rfc5761: packet types 192-223 are rtcp, rtp avoids them when muxed */
+static int 
+relay_is_rtcp(const char *pkt,size_t len)
+{
+	unsigned char pt;
+	
+	if(len < 8 || 2 != ((const rtp_header *)pkt)->version)
+		return 0;
+	pt = (unsigned char)pkt[1];
+	return pt >= 192 && pt <= 223;
+}
+
+/* rtcp arriving on a muxed rtp socket belongs to the rtcp stream */
+static stream_mode 
+relay_mux_mode(const int *fds,stream_mode mode,const char *pkt,size_t len)
+{
+	if((stream_audio_rtp == mode || stream_video_rtp == mode) &&
+		STREAM_MUXED(fds,mode) && relay_is_rtcp(pkt,len))
+		return mode+1;
+	return mode;
+}
+
+static void 
+relay_stat_camera_in(struct relay_t *r,int c,stream_mode i,const char *pkt,size_t len)
+{
+	relay_stat *st = &r->camstats[c * stream_max + i];
+	const rtp_header *rtp = (const rtp_header *)pkt;
+	int pt = r->cams[c].payload[i].media_format;
+
+	RELAY_STAT_ADD(st->packets_in,1);
+	RELAY_STAT_ADD(st->bytes_in,len);
+	__atomic_store_n(&st->last_in,r->now,__ATOMIC_RELAXED);
+	if((stream_audio_rtp == i || stream_video_rtp == i) &&
+		(len < RTP_HEADER_LEN || 2 != rtp->version || (pt >= 0 && pt != rtp->payload_type))){
+		RELAY_STAT_ADD(st->bad_rtp,1);
+	}
+}
+
+static void 
+relay_stat_call_in(struct relay_t *r,int j,stream_mode i,size_t len)
+{
+	relay_stat *st = &RELAY_CALL(r,j)->stats[i];
+
+	RELAY_STAT_ADD(st->packets_in,1);
+	RELAY_STAT_ADD(st->bytes_in,len);
+	__atomic_store_n(&st->last_in,r->now,__ATOMIC_RELAXED);
+}
+
+/* packets/bytes went out to call j, failed more did not with errno err */
+static void 
+relay_stat_call_out(struct relay_t *r,int j,stream_mode i,int packets,size_t bytes,int failed,int err)
+{
+	relay_stat *st = &RELAY_CALL(r,j)->stats[i];
+
+	if(packets > 0){
+		RELAY_STAT_ADD(st->packets_out,packets);
+		RELAY_STAT_ADD(st->bytes_out,bytes);
+	}
+	if(failed > 0){
+		if(EAGAIN == err || EWOULDBLOCK == err || ENOBUFS == err){
+			RELAY_STAT_ADD(st->eagain_drops,failed);
+		}else{
+			RELAY_STAT_ADD(st->send_errors,failed);
+		}
+	}
+}
+
+/*
+* point iov at one camera datagram for one subscriber, the datagram 
+* itself is never written: rtp gets a private copy of the fixed header 
+* carrying the subscriber payload type, anything else 
+* goes out as received. returns the number of iovecs used.
+*/
+static int 
+relay_sub_iov(relay_sub *sub,char *pkt,size_t len,int is_rtp,char *hdr,struct iovec *iov)
+{
+	rtp_header *rtp = (rtp_header *)hdr;
+	
+	if(!is_rtp || sub->media_format < 0){
+		iov[0].iov_base = pkt;
+		iov[0].iov_len = len;
+		return 1;
+	}
+	memcpy(hdr,pkt,RTP_HEADER_LEN);
+	rtp->payload_type = sub->media_format;
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = RTP_HEADER_LEN;
+	iov[1].iov_base = pkt + RTP_HEADER_LEN;
+	iov[1].iov_len = len - RTP_HEADER_LEN;
+	return 2;
+}
+
+/* one datagram of camera c ==> every sip call on the same camera and stream */
+static void 
+relay_fanout(core *co,int c,stream_mode i,char *pkt,size_t len,int is_rtp)
+{
+	struct relay_t *r = co->relay;
+	char				hdr[RTP_HEADER_LEN];
+	struct iovec		iov[2];
+	struct msghdr		msg;
+	int 				j ;
+
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_namelen = sizeof(struct sockaddr_in);
+	
+	for(j = r->first[i][c]; j < r->first[i][c+1]; j++) {
+		relay_sub *sub = &r->subs[i][j];
+		
+		if(stream_video_rtp == i && RELAY_CALL(r,sub->index)->burst)
+			continue;
+		msg.msg_name = &sub->remote;
+		msg.msg_iovlen = relay_sub_iov(sub,pkt,len,is_rtp,hdr,iov);
+		relay_sub_send(co,sub,i,&msg);
+	}
+}
+
+/* 
+* [rtp] mtu: camera c video rtp cut to fit, then fanned out one by one.
+* 1: consumed, 0: forward the datagram as received.
+*/
+static int 
+relay_repack(core *co,int c,stream_mode i,const char *pkt,size_t len)
+{
+	struct relay_t *r = co->relay;
+	const char *out = NULL;
+	size_t olen = 0;
+	int n, k;
+
+	if(NULL == r->repacks || stream_video_rtp != i)
+		return 0;
+	n = repack_push(r->repacks[c],pkt,len);
+	if(n < 0)
+		return 0;
+	for(k = 0; k < n; k++) {
+		out = repack_packet(r->repacks[c],k,&olen);
+		relay_video_in(r,c,i,out,olen);
+		relay_fanout(co,c,i,(char *)out,olen,1);
+	}
+	return 1;
+}
+
+/* camera c ==> every sip call on the same camera and stream */
+static int 
+stream_rtsp_recv(core *co,int c,stream_mode i)
+{
+	struct relay_t *r = co->relay;
+	int				fd;
+	ssize_t			recvlen;
+	socklen_t		slen;
+	char				buf[RECV_BUFF_DEFAULT_LEN];
+	int 				is_rtp;
+	struct sockaddr_storage sa;
+
+	if(c < 0 || c >= r->ncams || r->cams[c].fds[i] <= 0)
+		return -1;
+	fd = r->cams[c].fds[i];
+	
+	/* symmetricRTP */
+	if(co->symmetric_rtp){
+		slen = sizeof(r->cams[c].remote[i]);
+		recvlen = recvfrom(fd,buf,sizeof(buf),0,
+			(struct sockaddr *)&r->cams[c].remote[i],&slen); 
+	}else{
+		slen = sizeof(sa);
+		recvlen = recvfrom(fd,buf,sizeof(buf),0,
+			(struct sockaddr *)&sa,&slen); 
+	}
+	if(recvlen <= 0)
+		return 0;
+
+	i = relay_mux_mode(r->cams[c].fds,i,buf,recvlen);
+	relay_stat_camera_in(r,c,i,buf,recvlen);
+	is_rtp = relay_is_rtp(i,buf,recvlen);
+	if(is_rtp && relay_repack(co,c,i,buf,recvlen))
+		return 0;
+	if(is_rtp)
+		relay_video_in(r,c,i,buf,recvlen);
+	relay_fanout(co,c,i,buf,recvlen,is_rtp);
+	return 0;
+}
+
+/* camera c ==> every sip call on it, up to r->batch datagrams per syscall */
+static int 
+stream_rtsp_recv_batch(core *co,int c,stream_mode i)
+{
+	struct relay_t *r = co->relay;
+	int				fd;
+	int 				n, k, j, h, m;
+	int 				sent, err;
+	size_t			bytes;
+	stream_mode		t;
+
+	if(c < 0 || c >= r->ncams || r->cams[c].fds[i] <= 0)
+		return -1;
+	/* [rtp] mtu: cut video leaves as it is cut, one datagram at a time keeps the order */
+	if(NULL != r->repacks && stream_video_rtp == i)
+		return stream_rtsp_recv(co,c,i);
+	fd = r->cams[c].fds[i];
+	for(k = 0; k < r->batch; k++) {
+		r->rmsgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	n = recvmmsg(fd,r->rmsgs,r->batch,MSG_DONTWAIT,NULL);
+	if(n <= 0)
+		return 0;
+
+	RELAY_STAT_ADD(r->batch_wakeups,1);
+	RELAY_STAT_ADD(r->batch_packets,n);
+	if(n > r->batch_max) __atomic_store_n(&r->batch_max,n,__ATOMIC_RELAXED);
+	for(h = 0; h < RELAY_BATCH_HIST-1 && (n >> (h+1)) > 0; h++);
+	RELAY_STAT_ADD(r->batch_hist[h],1);
+	
+	/* symmetricRTP */
+	if(co->symmetric_rtp){
+		memcpy(&r->cams[c].remote[i],&r->rfrom[n-1],sizeof(struct sockaddr_in));
+	}
+	/* rtpflags: 0 as received, 1 rtp, 2 rtcp of a muxed stream */
+	for(k = 0; k < n; k++) {
+		t = relay_mux_mode(r->cams[c].fds,i,r->riovs[k].iov_base,r->rmsgs[k].msg_len);
+		relay_stat_camera_in(r,c,t,r->riovs[k].iov_base,r->rmsgs[k].msg_len);
+		r->rtpflags[k] = (t != i) ? 2 : relay_is_rtp(i,r->riovs[k].iov_base,r->rmsgs[k].msg_len);
+		if(1 == r->rtpflags[k])
+			relay_video_in(r,c,i,r->riovs[k].iov_base,r->rmsgs[k].msg_len);
+	}
+
+	for(t = i; t <= i+1; t++) {
+		if(t != i && !STREAM_MUXED(r->cams[c].fds,i))
+			break;
+		for(j = r->first[t][c]; j < r->first[t][c+1]; j++) {
+			relay_sub *sub = &r->subs[t][j];
+			
+			if(stream_video_rtp == t && RELAY_CALL(r,sub->index)->burst)
+				continue;
+			for(k = 0, m = 0; k < n; k++) {
+				if((2 == r->rtpflags[k]) != (t != i))
+					continue;
+				r->smsgs[m].msg_hdr.msg_name = &sub->remote;
+				r->smsgs[m].msg_hdr.msg_iov = &r->siovs[2*m];
+				r->smsgs[m].msg_hdr.msg_iovlen = relay_sub_iov(sub,
+					r->riovs[k].iov_base,r->rmsgs[k].msg_len,1 == r->rtpflags[k],
+					r->shdrs + m * RTP_HEADER_LEN,&r->siovs[2*m]);
+				m++;
+			}
+			if(0 == m)
+				break;
+			if(send_queue_blocked(RELAY_CALL(r,sub->index)->sendq[t])){
+				for(k = 0; k < m; k++) {
+					relay_sub_queue(co,sub->index,t,r->smsgs[k].msg_hdr.msg_iov,r->smsgs[k].msg_hdr.msg_iovlen);
+				}
+				continue;
+			}
+			sent = sendmmsg(sub->fd,r->smsgs,m,0);
+			err = errno;
+			RELAY_STAT_ADD(r->batch_sends,1);
+			for(k = 0, bytes = 0; k < sent; k++) {
+				bytes += r->smsgs[k].msg_len;
+			}
+			relay_stat_call_out(r,sub->index,t,sent > 0 ? sent : 0,bytes,0,0);
+			if(sent < m){
+				RELAY_STAT_ADD(r->batch_short,(sent < 0) ? m : m - sent);
+			}
+			if(sent < 0 && EAGAIN != err && EWOULDBLOCK != err){
+				relay_stat_call_out(r,sub->index,t,0,0,m,err);
+				log(co,LOG_DEBUG,"call(%d-%d) stream %d sendmmsg %d failed:%s\n",
+					sub->index,sub->callid, t, m, strerror(err));
+				continue;
+			}
+			/* a short count loses the errno: the socket is taken to be full */
+			for(k = (sent < 0) ? 0 : sent; k < m; k++) {
+				relay_sub_queue(co,sub->index,t,r->smsgs[k].msg_hdr.msg_iov,r->smsgs[k].msg_hdr.msg_iovlen);
+			}
+		}
+	}
+	
+	return 0;
+}
+
+/* sip call ==> latch the remote address (symmetricRTP) */
+static int 
+stream_sip_recv(core *co,int j,stream_mode i)
+{
+	struct relay_t *r = co->relay;
+	struct sockaddr_in from;
+	socklen_t		slen = sizeof(from);
+	char				buf[RECV_BUFF_DEFAULT_LEN];
+	ssize_t			recvlen;
+	sipcall			*call = NULL;
+
+	if(j < 0 || j >= r->top || RELAY_CALL(r,j)->call.fds[i] <= 0)
+		return -1;
+
+	call = &RELAY_CALL(r,j)->call;
+	recvlen = recvfrom(call->fds[i],buf,sizeof(buf),0,
+		(struct sockaddr *)&from,&slen);
+	if(recvlen <= 0 || call->callid <= 0){
+		return 0;
+	}
+	i = relay_mux_mode(call->fds,i,buf,recvlen);
+	relay_stat_call_in(r,j,i,recvlen);
+	if(stream_video_rtcp == i)
+		relay_rtcp_feedback(co,j,buf,recvlen);
+	if(co->symmetric_rtp &&
+		(from.sin_port != call->remote[i].sin_port ||
+		from.sin_addr.s_addr != call->remote[i].sin_addr.s_addr)){
+		memcpy(&call->remote[i],&from,sizeof(from));
+		relay_subs_rebuild(co,i);
+	}
+	return 0;
+}
+
+/* peer ssrc of an rtp packet, or the sender ssrc of an rtcp one, 0: none */
+static uint32_t 
+relay_peer_ssrc(stream_mode mode,const char *pkt,size_t len)
+{
+	uint32_t ssrc;
+	
+	if(len < 8 || 2 != ((const rtp_header *)pkt)->version)
+		return 0;
+	if(stream_audio_rtp == mode || stream_video_rtp == mode) {
+		if(len < RTP_HEADER_LEN)
+			return 0;
+		return ntohl(((const rtp_header *)pkt)->ssrc);
+	}
+	memcpy(&ssrc,pkt + 4,sizeof(ssrc));
+	return ntohl(ssrc);
+}
+
+/* 
+* sip call ==> shared socket: the peer address names the call, an ssrc 
+* seen before from a known address finds it again after a nat rebinding.
+*/
+static int 
+stream_shared_recv(core *co,stream_mode i)
+{
+	struct relay_t *r = co->relay;
+	struct sockaddr_in from;
+	socklen_t		slen = sizeof(from);
+	char				buf[RECV_BUFF_DEFAULT_LEN];
+	ssize_t			recvlen;
+	uint32_t			ssrc;
+	int 				j;
+
+	recvlen = recvfrom(r->shared_fds[i],buf,sizeof(buf),0,(struct sockaddr *)&from,&slen);
+	if(recvlen <= 0)
+		return 0;
+	/* only a muxed peer sends rtcp to an rtp port */
+	if((stream_audio_rtp == i || stream_video_rtp == i) && relay_is_rtcp(buf,recvlen))
+		i++;
+	ssrc = relay_peer_ssrc(i,buf,recvlen);
+	j = relay_flow_find(r,RELAY_FLOW_ADDR(from.sin_addr.s_addr,from.sin_port,i));
+	if(j < 0 && 0 != ssrc){
+		j = relay_flow_find(r,RELAY_FLOW_SSRC(ssrc,i));
+		/* symmetricRTP */
+		if(j >= 0 && co->symmetric_rtp){
+			memcpy(&RELAY_CALL(r,j)->call.remote[i],&from,sizeof(from));
+			relay_subs_rebuild(co,i);
+			relay_flows_rebuild(co);
+		}
+	}
+	if(j < 0){
+		RELAY_STAT_ADD(r->shared_unknown,1);
+		return 0;
+	}
+	relay_stat_call_in(r,j,i,recvlen);
+	if(stream_video_rtcp == i)
+		relay_rtcp_feedback(co,j,buf,recvlen);
+	if(0 != ssrc && ssrc != RELAY_CALL(r,j)->peer_ssrc[i]){
+		RELAY_CALL(r,j)->peer_ssrc[i] = ssrc;
+		relay_flow_insert(r,RELAY_FLOW_SSRC(ssrc,i),j);
+	}
+	return 0;
+}
+
+/* one epoll round: commands, sip side sockets, camera sockets unless io_uring has them */
+static void 
+relay_epoll_dispatch(core *co,int timeout)
+{
+	struct relay_t *r = co->relay;
+	struct epoll_event events[RELAY_MAX_EVENTS];
+	int nready, n;
+	uint64_t key;
+	
+	nready = epoll_wait(r->epfd,events,RELAY_MAX_EVENTS,timeout);
+	r->now = time(NULL);
+	for(n = 0; n < nready; n++) {
+		key = events[n].data.u64;
+		if(RELAY_KEY_WAKEUP == key){
+			relay_cmd_drain(co);
+		}else if(side_max == RELAY_KEY_SIDE(key)){
+			if(events[n].events & EPOLLOUT)
+				stream_sip_writable(co,key);
+			if(events[n].events & ~EPOLLOUT)
+				stream_shared_recv(co,RELAY_KEY_MODE(key));
+		}else if(side_rtsp == RELAY_KEY_SIDE(key)){
+			if(r->batch > 1){
+				stream_rtsp_recv_batch(co,RELAY_KEY_INDEX(key),RELAY_KEY_MODE(key));
+			}else{
+				stream_rtsp_recv(co,RELAY_KEY_INDEX(key),RELAY_KEY_MODE(key));
+			}
+		}else{
+			if(events[n].events & EPOLLOUT)
+				stream_sip_writable(co,key);
+			if(events[n].events & ~EPOLLOUT)
+				stream_sip_recv(co,RELAY_KEY_INDEX(key),RELAY_KEY_MODE(key));
+		}
+	}
+}
+
+/* the payload buffer goes back to the kernel once its last send is done */
+static void 
+relay_uring_buf_unref(struct relay_t *r,unsigned int bid)
+{
+	if(0 == r->bufref[bid] || 0 == --r->bufref[bid])
+		relay_uring_buf_put(r->uring,bid);
+}
+
+/* 
+* camera c ==> every sip call on it, one sendmsg sqe per subscriber.
+* a call with datagrams waiting in its send queue gets this one queued
+* behind them instead, as relay_sub_send does on the epoll path.
+*/
+static void 
+stream_rtsp_uring_recv(core *co,relay_uring_cqe *cqe)
+{
+	struct relay_t *r = co->relay;
+	uint64_t key = RELAY_UD_KEY(cqe->user_data);
+	int fd = RELAY_UD_FD(cqe->user_data);
+	int c = RELAY_KEY_INDEX(key);
+	stream_mode i = RELAY_KEY_MODE(key);
+	stream_mode t;
+	struct sockaddr_in from;
+	struct epoll_event ev;
+	relay_usend *us = NULL;
+	unsigned int bid = 0;
+	char *pkt = NULL;
+	char hdr[RTP_HEADER_LEN];
+	struct iovec iov[2];
+	int current, len, j, is_rtp, repacked, slot, iovcnt;
+
+	current = (c >= 0 && c < r->ncams && r->cams[c].fds[i] == fd);
+	len = relay_uring_recv_get(r->uring,cqe,&pkt,&from,&bid);
+	if(len < 0){
+		if(!relay_uring_cqe_more(cqe) && current && -ENOBUFS != cqe->res && -ECANCELED != cqe->res){
+			/* kernel without multishot recvmsg: this socket goes back to epoll */
+			log(co,LOG_WARNING,"io_uring recv fd=%d failed:%s, epoll used\n",fd,strerror(-cqe->res));
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = key;
+			epoll_ctl(r->epfd,EPOLL_CTL_ADD,fd,&ev);
+			return;
+		}
+	}else{
+		RELAY_STAT_ADD(r->uring_recvs,1);
+		r->bufref[bid] = 1;	/* held while the sqes are queued */
+		if(current && len > 0){
+			if(co->symmetric_rtp){
+				memcpy(&r->cams[c].remote[i],&from,sizeof(from));
+			}
+			t = relay_mux_mode(r->cams[c].fds,i,pkt,len);
+			relay_stat_camera_in(r,c,t,pkt,len);
+			is_rtp = relay_is_rtp(t,pkt,len);
+			/* repacked output goes out by sendmsg, after the sqes queued before it */
+			if(is_rtp && NULL != r->repacks && stream_video_rtp == t)
+				relay_uring_submit(r->uring);
+			repacked = is_rtp && relay_repack(co,c,t,pkt,len);
+			if(is_rtp && !repacked)
+				relay_video_in(r,c,t,pkt,len);
+			for(j = r->first[t][c]; !repacked && j < r->first[t][c+1]; j++) {
+				relay_sub *sub = &r->subs[t][j];
+				
+				if(stream_video_rtp == t && RELAY_CALL(r,sub->index)->burst)
+					continue;
+				if(send_queue_blocked(RELAY_CALL(r,sub->index)->sendq[t])){
+					iovcnt = relay_sub_iov(sub,pkt,len,is_rtp,hdr,iov);
+					relay_sub_queue(co,sub->index,t,iov,iovcnt);
+					continue;
+				}
+				if(0 == r->nusend_free){
+					RELAY_STAT_ADD(r->uring_drops,1);
+					relay_stat_call_out(r,sub->index,t,0,0,1,ENOBUFS);
+					continue;
+				}
+				slot = r->usend_free[--r->nusend_free];
+				us = &r->usends[slot];
+				memcpy(&us->to,&sub->remote,sizeof(us->to));
+				memset(&us->msg,0,sizeof(us->msg));
+				us->msg.msg_name = &us->to;
+				us->msg.msg_namelen = sizeof(us->to);
+				us->msg.msg_iov = us->iov;
+				us->msg.msg_iovlen = relay_sub_iov(sub,pkt,len,is_rtp,us->hdr,us->iov);
+				us->bid = bid;
+				us->index = sub->index;
+				us->callid = sub->callid;
+				us->mode = t;
+				if(relay_uring_sendmsg(r->uring,sub->fd,&us->msg,RELAY_UD(relay_ud_send,0,slot)) < 0){
+					r->usend_free[r->nusend_free++] = slot;
+					RELAY_STAT_ADD(r->uring_drops,1);
+					relay_stat_call_out(r,sub->index,t,0,0,1,ENOBUFS);
+					continue;
+				}
+				r->bufref[bid]++;
+			}
+		}
+		relay_uring_buf_unref(r,bid);
+	}
+	
+	/* ended by ENOBUFS or an error: arm again while the socket is current */
+	if(!relay_uring_cqe_more(cqe) && current && -ECANCELED != cqe->res){
+		RELAY_STAT_ADD(r->uring_rearms,1);
+		relay_uring_recv_multishot(r->uring,fd,cqe->user_data);
+	}
+}
+
+/* a full socket: the datagram waits in the call send queue while the payload buffer is still held */
+static void 
+stream_uring_sent(core *co,relay_uring_cqe *cqe)
+{
+	struct relay_t *r = co->relay;
+	int slot = (int)RELAY_UD_KEY(cqe->user_data);
+	relay_usend *us = NULL;
+
+	if(slot < 0 || slot >= RELAY_URING_SENDS)
+		return;
+	us = &r->usends[slot];
+	RELAY_STAT_ADD(r->uring_sends,1);
+	if(-EAGAIN == cqe->res || -EWOULDBLOCK == cqe->res){
+		if(RELAY_CALL(r,us->index)->call.callid == us->callid)
+			relay_sub_queue(co,us->index,us->mode,us->msg.msg_iov,us->msg.msg_iovlen);
+	}else if(cqe->res < 0){
+		relay_stat_call_out(r,r->usends[slot].index,r->usends[slot].mode,0,0,1,-cqe->res);
+		log(co,LOG_DEBUG,"io_uring send to %s:%d failed:%s\n",
+			inet_ntoa(r->usends[slot].to.sin_addr),ntohs(r->usends[slot].to.sin_port),
+			strerror(-cqe->res));
+	}else{
+		relay_stat_call_out(r,r->usends[slot].index,r->usends[slot].mode,1,cqe->res,0,0);
+	}
+	relay_uring_buf_unref(r,r->usends[slot].bid);
+	r->usend_free[r->nusend_free++] = slot;
+}
+
+/* io_uring: the epoll fd itself is one more multishot poll on the ring */
+static void 
+streams_loop_uring(core *co)
+{
+	struct relay_t *r = co->relay;
+	relay_uring_cqe cqes[RELAY_MAX_EVENTS];
+	int n, k;
+	
+	relay_uring_poll_multishot(r->uring,r->epfd,RELAY_UD(relay_ud_epoll,0,0));
+	while(r->running) {
+		n = relay_uring_wait(r->uring,cqes,RELAY_MAX_EVENTS);
+		r->now = time(NULL);
+		if(n < 0){
+			log(co,LOG_ERR,"io_uring wait failed:%s\n",strerror(errno));
+			osip_usleep(1000);
+			continue;
+		}
+		for(k = 0; k < n; k++) {
+			switch(RELAY_UD_KIND(cqes[k].user_data)) {
+			case relay_ud_epoll:
+				relay_uring_submit(r->uring);	/* sends before any close */
+				relay_epoll_dispatch(co,0);
+				if(!relay_uring_cqe_more(&cqes[k]))
+					relay_uring_poll_multishot(r->uring,r->epfd,RELAY_UD(relay_ud_epoll,0,0));
+				break;
+			case relay_ud_recv:
+				stream_rtsp_uring_recv(co,&cqes[k]);
+				break;
+			case relay_ud_send:
+				stream_uring_sent(co,&cqes[k]);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* media relay thread */
+void *
+streams_loop(void *arg)
+{	
+	core *co = (core *)arg;
+	struct relay_t *r = co->relay;
+	
+	if(NULL != r->uring){
+		streams_loop_uring(co);
+		return NULL;
+	}
+	while(r->running) {
+		relay_epoll_dispatch(co,-1);
+	}
+	return NULL;
+}
+
+/* relay counters, batch sizes achieved by the camera ==> sip path */
+int 
+streams_show(core *co)
+{
+	struct relay_t *r = co->relay;
+	unsigned long wakeups, packets;
+	port_pool_usage usage;
+	int j;
+	
+	if(NULL == r)
+		return 0;
+	port_pool_usage_get(co->port_pool,time(NULL),&usage);
+	log(co,LOG_INFO,"rtp ports %d-%d pairs=%d used=%d quarantined=%d free=%d allocs=%lu exhausted=%lu\n",
+		co->rtp_start_port,co->rtp_end_port,usage.total,usage.used,usage.quarantined,
+		usage.free,usage.allocs,usage.exhausted);
+	if(NULL != co->prepool){
+		log(co,LOG_INFO,"rtp prebound sip=%d rtsp=%d of %d taken=%lu misses=%lu\n",
+			co->prepool->count[side_sip],co->prepool->count[side_rtsp],co->prepool->size,
+			co->prepool->taken,co->prepool->misses);
+	}
+	log(co,LOG_INFO,"relay call table top=%d of %d\n",
+		__atomic_load_n(&r->top,__ATOMIC_ACQUIRE),r->maxcalls);
+	if(co->rtp_shared_port > 0){
+		log(co,LOG_INFO,"relay shared_port=%d unknown=%lu\n",co->rtp_shared_port,
+			__atomic_load_n(&r->shared_unknown,__ATOMIC_RELAXED));
+	}
+	for(j = 0; NULL != r->gops && j < r->ncams; j++) {
+		log(co,LOG_INFO,"relay camera %d gop cache packets=%lu bytes=%lu\n",j,
+			__atomic_load_n(&r->keyframes[j].gop_packets,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->keyframes[j].gop_bytes,__ATOMIC_RELAXED));
+	}
+	for(j = 0; co->rtp_keyframe_interval > 0 && j < r->ncams; j++) {
+		log(co,LOG_INFO,"relay camera %d keyframe requests sent=%lu suppressed=%lu failed=%lu\n",j,
+			__atomic_load_n(&r->keyframes[j].sent,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->keyframes[j].suppressed,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->keyframes[j].failed,__ATOMIC_RELAXED));
+	}
+	log(co,LOG_INFO,"relay rtcp feedback pli=%lu fir=%lu nack=%lu\n",
+		__atomic_load_n(&r->feedback[relay_fb_pli],__ATOMIC_RELAXED),
+		__atomic_load_n(&r->feedback[relay_fb_fir],__ATOMIC_RELAXED),
+		__atomic_load_n(&r->feedback[relay_fb_nack],__ATOMIC_RELAXED));
+	if(NULL != r->gops){
+		log(co,LOG_INFO,"relay gop bursts=%lu packets=%lu\n",
+			__atomic_load_n(&r->gop_bursts,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->gop_burst_packets,__ATOMIC_RELAXED));
+	}
+	if(NULL != r->uring){
+		log(co,LOG_INFO,"relay io_uring recvs=%lu sends=%lu drops=%lu rearms=%lu\n",
+			__atomic_load_n(&r->uring_recvs,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->uring_sends,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->uring_drops,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->uring_rearms,__ATOMIC_RELAXED));
+	}
+	if(r->batch <= 1)
+		return 0;
+
+	wakeups = __atomic_load_n(&r->batch_wakeups,__ATOMIC_RELAXED);
+	packets = __atomic_load_n(&r->batch_packets,__ATOMIC_RELAXED);
+	log(co,LOG_INFO,
+		"relay batch=%d wakeups=%lu packets=%lu avg=%lu.%02lu max=%d sendmmsg=%lu short=%lu "
+		"hist[1]=%lu [2-3]=%lu [4-7]=%lu [8-15]=%lu [16-31]=%lu [32-63]=%lu [64]=%lu\n",
+		r->batch, wakeups, packets,
+		wakeups ? packets/wakeups : 0, wakeups ? (packets*100/wakeups)%100 : 0,
+		__atomic_load_n(&r->batch_max,__ATOMIC_RELAXED),
+		__atomic_load_n(&r->batch_sends,__ATOMIC_RELAXED),
+		__atomic_load_n(&r->batch_short,__ATOMIC_RELAXED),
+		RELAY_STAT_GET(r->batch_hist[0]),RELAY_STAT_GET(r->batch_hist[1]),
+		RELAY_STAT_GET(r->batch_hist[2]),RELAY_STAT_GET(r->batch_hist[3]),
+		RELAY_STAT_GET(r->batch_hist[4]),RELAY_STAT_GET(r->batch_hist[5]),
+		RELAY_STAT_GET(r->batch_hist[6]));
+	return 0;
+}
+
+static const char *stream_names[stream_max] = {
+	"audio_rtp","audio_rtcp","video_rtp","video_rtcp"
+};
+
+/* one counter family: HELP/TYPE, then a line per camera stream that saw traffic */
+static void 
+streams_metrics_camera(core *co,struct stats_buf_t *sb,const char *name,const char *help,
+	size_t offset,const char *type)
+{
+	struct relay_t *r = co->relay;
+	relay_stat *st = NULL;
+	int c, i;
+
+	stats_printf(sb,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+	for(c = 0; c < r->ncams; c++) {
+		for(i = 0; i < stream_max; i++) {
+			st = &r->camstats[c * stream_max + i];
+			if(0 == RELAY_STAT_GET(st->packets_in))
+				continue;
+			stats_printf(sb,"%s{camera=\"%s\",stream=\"%s\"} %lu\n",name,
+				camera_label(camera_get(co,c)),stream_names[i],
+				__atomic_load_n((unsigned long *)((char *)st + offset),__ATOMIC_RELAXED));
+		}
+	}
+}
+
+/* same, per active call stream */
+static void 
+streams_metrics_call(core *co,struct stats_buf_t *sb,const char *name,const char *help,
+	size_t offset,const char *type)
+{
+	struct relay_t *r = co->relay;
+	relay_stat *st = NULL;
+	sipcall *call = NULL;
+	int top = __atomic_load_n(&r->top,__ATOMIC_ACQUIRE);
+	int j, i;
+
+	stats_printf(sb,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+	for(j = 0; j < core_sipcall_top(co) && j < top; j++) {
+		call = core_sipcall_at(co,j);
+		if(NULL == call || call->callid <= 0)
+			continue;
+		for(i = 0; i < stream_max; i++) {
+			if(call->fds[i] <= 0)
+				continue;
+			st = &__atomic_load_n(&r->slabs[j / SIPCALL_SLAB],__ATOMIC_ACQUIRE)[j % SIPCALL_SLAB].stats[i];
+			stats_printf(sb,"%s{callid=\"%d\",camera=\"%s\",stream=\"%s\"} %lu\n",name,
+				call->callid,camera_label(camera_get(co,call->camera)),stream_names[i],
+				__atomic_load_n((unsigned long *)((char *)st + offset),__ATOMIC_RELAXED));
+		}
+	}
+}
+
+#define STAT_OFFSET(field)	offsetof(relay_stat,field)
+
+/* prometheus text of the relay counters, called by the signaling thread */
+int 
+streams_metrics(core *co,struct stats_buf_t *sb)
+{
+	struct relay_t *r = co->relay;
+	port_pool_usage usage;
+	int c;
+	
+	if(NULL == r)
+		return 0;
+	port_pool_usage_get(co->port_pool,time(NULL),&usage);
+	stats_printf(sb,"# HELP sip2rtsp_rtp_port_pairs Rtp/rtcp port pairs of the range.\n"
+		"# TYPE sip2rtsp_rtp_port_pairs gauge\n"
+		"sip2rtsp_rtp_port_pairs{state=\"used\"} %d\n"
+		"sip2rtsp_rtp_port_pairs{state=\"quarantined\"} %d\n"
+		"sip2rtsp_rtp_port_pairs{state=\"free\"} %d\n",
+		usage.used,usage.quarantined,usage.free);
+	stats_printf(sb,"# HELP sip2rtsp_rtp_port_exhausted_total Port pair requests with none free.\n"
+		"# TYPE sip2rtsp_rtp_port_exhausted_total counter\n"
+		"sip2rtsp_rtp_port_exhausted_total %lu\n",usage.exhausted);
+	if(NULL != co->prepool){
+		stats_printf(sb,"# HELP sip2rtsp_rtp_prebound_pairs Bound socket pairs ready for call setup.\n"
+			"# TYPE sip2rtsp_rtp_prebound_pairs gauge\n"
+			"sip2rtsp_rtp_prebound_pairs{side=\"sip\"} %d\n"
+			"sip2rtsp_rtp_prebound_pairs{side=\"rtsp\"} %d\n",
+			co->prepool->count[side_sip],co->prepool->count[side_rtsp]);
+		stats_printf(sb,"# HELP sip2rtsp_rtp_prebound_misses_total Pairs bound on the call path, pool empty.\n"
+			"# TYPE sip2rtsp_rtp_prebound_misses_total counter\n"
+			"sip2rtsp_rtp_prebound_misses_total %lu\n",co->prepool->misses);
+	}
+	if(NULL != r->gops){
+		stats_printf(sb,"# HELP sip2rtsp_gop_bursts_total Cached groups sent to joining viewers.\n"
+			"# TYPE sip2rtsp_gop_bursts_total counter\n"
+			"sip2rtsp_gop_bursts_total %lu\n"
+			"# HELP sip2rtsp_gop_burst_packets_total Cached packets sent to joining viewers.\n"
+			"# TYPE sip2rtsp_gop_burst_packets_total counter\n"
+			"sip2rtsp_gop_burst_packets_total %lu\n",
+			__atomic_load_n(&r->gop_bursts,__ATOMIC_RELAXED),
+			__atomic_load_n(&r->gop_burst_packets,__ATOMIC_RELAXED));
+	}
+	stats_printf(sb,"# HELP sip2rtsp_rtcp_feedback_total Rtcp feedback messages from the sip peers.\n"
+		"# TYPE sip2rtsp_rtcp_feedback_total counter\n"
+		"sip2rtsp_rtcp_feedback_total{type=\"pli\"} %lu\n"
+		"sip2rtsp_rtcp_feedback_total{type=\"fir\"} %lu\n"
+		"sip2rtsp_rtcp_feedback_total{type=\"nack\"} %lu\n",
+		__atomic_load_n(&r->feedback[relay_fb_pli],__ATOMIC_RELAXED),
+		__atomic_load_n(&r->feedback[relay_fb_fir],__ATOMIC_RELAXED),
+		__atomic_load_n(&r->feedback[relay_fb_nack],__ATOMIC_RELAXED));
+	stats_printf(sb,"# HELP sip2rtsp_keyframe_requests_total Pli/fir for the camera, by outcome.\n"
+		"# TYPE sip2rtsp_keyframe_requests_total counter\n");
+	for(c = 0; c < r->ncams; c++) {
+		stats_printf(sb,"sip2rtsp_keyframe_requests_total{camera=\"%s\",result=\"sent\"} %lu\n"
+			"sip2rtsp_keyframe_requests_total{camera=\"%s\",result=\"suppressed\"} %lu\n"
+			"sip2rtsp_keyframe_requests_total{camera=\"%s\",result=\"failed\"} %lu\n",
+			camera_label(camera_get(co,c)),__atomic_load_n(&r->keyframes[c].sent,__ATOMIC_RELAXED),
+			camera_label(camera_get(co,c)),__atomic_load_n(&r->keyframes[c].suppressed,__ATOMIC_RELAXED),
+			camera_label(camera_get(co,c)),__atomic_load_n(&r->keyframes[c].failed,__ATOMIC_RELAXED));
+	}
+	streams_metrics_camera(co,sb,"sip2rtsp_camera_packets_in_total",
+		"Datagrams received from the camera.",STAT_OFFSET(packets_in),"counter");
+	streams_metrics_camera(co,sb,"sip2rtsp_camera_bytes_in_total",
+		"Bytes received from the camera.",STAT_OFFSET(bytes_in),"counter");
+	streams_metrics_camera(co,sb,"sip2rtsp_camera_bad_rtp_total",
+		"Camera rtp with a wrong version or payload type.",STAT_OFFSET(bad_rtp),"counter");
+	streams_metrics_camera(co,sb,"sip2rtsp_camera_last_packet_seconds",
+		"Unix time of the last camera datagram.",STAT_OFFSET(last_in),"gauge");
+	streams_metrics_call(co,sb,"sip2rtsp_call_packets_out_total",
+		"Datagrams relayed to the sip peer.",STAT_OFFSET(packets_out),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_bytes_out_total",
+		"Bytes relayed to the sip peer.",STAT_OFFSET(bytes_out),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_packets_in_total",
+		"Datagrams received from the sip peer.",STAT_OFFSET(packets_in),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_bytes_in_total",
+		"Bytes received from the sip peer.",STAT_OFFSET(bytes_in),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_send_errors_total",
+		"Sends to the sip peer that failed.",STAT_OFFSET(send_errors),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_eagain_drops_total",
+		"Datagrams dropped on a full socket buffer.",STAT_OFFSET(eagain_drops),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_queued_total",
+		"Datagrams sent after waiting in the send queue.",STAT_OFFSET(queued),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_queue_drops_total",
+		"Datagrams the send queue dropped, whole frames or until a keyframe.",STAT_OFFSET(queue_drops),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_resyncs_total",
+		"Send queue flushes waiting for the next keyframe.",STAT_OFFSET(resyncs),"counter");
+	streams_metrics_call(co,sb,"sip2rtsp_call_last_packet_seconds",
+		"Unix time of the last datagram from the sip peer.",STAT_OFFSET(last_in),"gauge");
+	return 0;
+}
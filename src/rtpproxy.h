@@ -23,11 +23,19 @@
 
 #include "sip.h"
 #include "log.h"
+#include "camera.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define RTP_HEADER_LEN	(12)	/* fixed part, without csrc */
+
+struct stats_buf_t;
+
+/* rtcp-mux: both ends of a stream on the rtp socket */
+#define STREAM_MUXED(fds,rtp)	((fds)[rtp] > 0 && (fds)[rtp] == (fds)[(rtp)+1])
+
 typedef struct rtp_header_t{
 #if BYTE_ORDER == BIG_ENDIAN
 	uint16_t version:2;
@@ -52,10 +60,22 @@ typedef struct rtp_header_t{
 
 int payload_init(core *co);
 int streams_init(core *co);
-int streams_loop(core *co);
+void *streams_loop(void *arg);
 int streams_stop(core *co);
+int streams_show(core *co);
+int streams_metrics(core *co,struct stats_buf_t *sb);
+int stream_call_update(core *co, int callid);
 int stream_call_stop(core *co, int callid);
+int stream_camera_start(core *co, int callid);
+int stream_camera_open(core *co, camera *cam);
+int stream_camera_join(core *co, camera *cam, stream_mode mode, const char *group, int port);
+int stream_camera_stop(core *co, camera *cam);
+int stream_camera_mux(core *co, camera *cam, stream_mode mode);
 int sock_pair_create(core*co,int callid,stream_mode mode,b2b_side side);
+int sock_mux_create(core *co,int callid,stream_mode mode);
+void stream_prebind_refill(core *co);
+int sock_blocking_set(int sockfd);
+int sock_noblocking_set(int sockfd);
 
 #ifdef __cplusplus
 }
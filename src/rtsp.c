@@ -29,6 +29,7 @@ void
 free_rtsp_client(rtsp_client_t *client)
 {
 	rtsp_session_t *p = NULL;
+	int i;
 	
 	if( NULL == client)
 		return;
@@ -37,6 +38,10 @@ free_rtsp_client(rtsp_client_t *client)
 	rtsp_close_thread(rptr);
 	} else*/ {
 		rtsp_close_socket(client);
+		for (i = 0; i < stream_max; i++) {
+			if (client->feed_fds[i] >= 0)
+				close(client->feed_fds[i]);
+		}
 #ifdef _WINDOWS
 		WSACleanup();
 #endif
@@ -49,6 +54,8 @@ free_rtsp_client(rtsp_client_t *client)
 	}
 		
 	CHECK_AND_FREE(client->session);
+	sdp_free_session_desc(client->sdp);
+	client->sdp = NULL;
 	CHECK_AND_FREE(client->orig_url);
 	CHECK_AND_FREE(client->url);
 	CHECK_AND_FREE(client->server_name);
@@ -64,6 +71,7 @@ rtsp_client_t *
 rtsp_create_client_common(core *co,const char *url, int *perr)
 {
 	int err;
+	int ix;
 	rtsp_client_t *client;
 
 	client = malloc(sizeof(rtsp_client_t));
@@ -85,6 +93,9 @@ rtsp_create_client_common(core *co,const char *url, int *perr)
 	client->m_buffer_len = 0;
 	client->m_resp_buffer[RECV_BUFF_DEFAULT_LEN] = '\0';
 	client->need_reconnect = 0;
+	for (ix = 0; ix < stream_max; ix++) {
+		client->feed_fds[ix] = -1;
+	}
 	
 	client->authorization = NULL;
 	client->session_timeout = 0;
@@ -173,7 +173,6 @@ extern "C" {
 	* Output - pointer to rtsp_client handle
 	*/
 	rtsp_client_t *rtsp_create_client(core *co, const char *url, int *err);
-	rtsp_client_t *rtsp_create_client_for_rtp_tcp(const char *url, int *err);
 	/*
 	* rtsp message function error messages
 	*/
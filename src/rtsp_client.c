@@ -27,407 +27,706 @@
 #if !defined(WIN32) && !defined(_WIN32_WCE)
 #include <sys/time.h>
 #endif
+#include <sys/epoll.h>
 
 #include "rtsp_client.h"
+#include "rtpproxy.h"
 
 
 /*--- Global variable---*/
-static rtsp_client_t *rtsp_client = NULL;
 static  const char transport_str[] =" RTP/AVP;unicast;destination=%s;client_port=%d-%d";
+static  const char interleaved_str[] =" RTP/AVP/TCP;unicast;interleaved=%d-%d";
+static  const char multicast_str[] =" RTP/AVP;multicast";
+static  const char rtcp_mux_str[] =";RTCP-mux";
 static  const char auth_fmt[] =	"Digest username=\"%s\", realm=%s,nonce=%s,uri=\"%s\", response=\"%s\"";
+static  const char *method_str[] = {
+	"DESCRIBE", "SETUP", "PLAY", "PAUSE", "GET_PARAMETER", "TEARDOWN"
+};
 static time_t rtsp_systemtime_get(time_t * t);
+static void rtsp_setup_next(core *co,camera *cam);
+static int rtsp_flush_out(core *co,camera *cam);
 
-int 
-rtsp_open(core *co,int call_id,char *video_host, uint16_t video_port, 
-	char *audio_host, uint16_t audio_port , 
-	rtsp_transport_parse_t *video_transport,rtsp_transport_parse_t *audio_transport,
-	char *sdp_buff, int sdp_buff_len, int *status)
+static void 
+rtsp_reactor_set(core *co,camera *cam,int op)
 {
-	int ret = 0;
-	rtsp_command_t cmd;
-	rtsp_decode_t *decode = NULL;
-	session_desc_t *sdp = NULL;
-	media_desc_t *media = NULL;
-	sdp_decode_info_t *sdpdecode = NULL;
-	rtsp_session_t *session = NULL;
-	int translated;
-	char transport_buf[HEAD_BUFF_DEFAULT_LEN]={0};
-	media_type media_type; 
-	char auth_str[HEAD_BUFF_DEFAULT_LEN]={0};
-	char *wwwauth = NULL;
-	osip_www_authenticate_t *auth = NULL;
-	HASHHEX response;
+	rtsp_client_t *client = cam->client;
+	struct epoll_event ev;
+
+	if( client->server_socket < 0 )
+		return;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	if( rtsp_connecting == client->state || client->out_len > 0 )
+		ev.events |= EPOLLOUT;
+	ev.data.u64 = RTSP_IO_KEY(cam->index,-1);
+	if( epoll_ctl(co->epfd,op,client->server_socket,&ev) < 0 && EPOLL_CTL_DEL != op )
+		log(co,LOG_ERR,"rtsp %s epoll_ctl(%d) failed:%s\n",cam->url,op,strerror(errno));
+}
+
+/* 
+* interleaved: one connected udp socket per stream towards the relay's 
+* camera side socket. rtp and rtcp feeds sit on consecutive ports, so 
+* they can stand in for the camera's server_port pair.
+*/
+static int 
+rtsp_feeds_open(core *co,camera *cam)
+{
+	rtsp_client_t *client = cam->client;
+	struct sockaddr_in to, from;
+	struct epoll_event ev;
+	socklen_t slen;
+	int mode, k, tries;
+	int fd;
 	
-	if( NULL != rtsp_client && !rtsp_client->need_reconnect ){
-		strncpy(sdp_buff,rtsp_client->sdp_buf,sdp_buff_len);
-		memcpy(video_transport,&rtsp_client->video_transport,sizeof(rtsp_transport_parse_t));
-		memcpy(audio_transport,&rtsp_client->audio_transport,sizeof(rtsp_transport_parse_t));
-		return 0;
+	for(mode = stream_audio_rtp; mode < stream_max; mode += 2) {
+		if( cam->rtsp.fds[mode] <= 0 )
+			continue;
+		for(tries = 0; client->feed_fds[mode] < 0 && tries < 8; tries++) {
+			memset(&from,0,sizeof(from));
+			for(k = 0; k < 2; k++) {
+				memcpy(&to,&cam->rtsp.local[mode+k],sizeof(to));
+				if( INADDR_ANY == to.sin_addr.s_addr )
+					to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				from.sin_family = AF_INET;
+				from.sin_addr.s_addr = to.sin_addr.s_addr;
+				if( 1 == k )
+					from.sin_port = htons(ntohs(from.sin_port)+1);
+				fd = socket(AF_INET,SOCK_DGRAM,0);
+				slen = sizeof(from);
+				if( fd < 0 || bind(fd,(struct sockaddr *)&from,sizeof(from)) < 0 ||
+					connect(fd,(struct sockaddr *)&to,sizeof(to)) < 0 ||
+					getsockname(fd,(struct sockaddr *)&from,&slen) < 0 ){
+					if( fd >= 0 )  close(fd);
+					if( client->feed_fds[mode] >= 0 )  close(client->feed_fds[mode]);
+					client->feed_fds[mode] = -1;
+					break;
+				}
+				client->feed_fds[mode+k] = fd;
+			}
+		}
+		if( client->feed_fds[mode] < 0 ){
+			log(co,LOG_ERR,"rtsp %s interleaved feed %d failed:%s\n",cam->url,mode,strerror(errno));
+			return -1;
+		}
+		for(k = 0; k < 2; k++) {
+			sock_noblocking_set(client->feed_fds[mode+k]);
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = RTSP_IO_KEY(cam->index,mode+k);
+			epoll_ctl(co->epfd,EPOLL_CTL_ADD,client->feed_fds[mode+k],&ev);
+		}
 	}
+	return 0;
+}
+
+/* the feed address is where the relay sees this camera's stream */
+static void 
+rtsp_feed_transport(camera *cam,stream_mode mode,rtsp_transport_parse_t *transport)
+{
+	struct sockaddr_in from;
+	socklen_t slen = sizeof(from);
 	
-	free_rtsp_client(rtsp_client);
-	rtsp_client = rtsp_create_client(co,co->rtsp_url, &ret);
-	if(NULL == rtsp_client)	{
-		*status = 404;
-		return -1;
+	if( cam->client->feed_fds[mode] < 0 || 
+		getsockname(cam->client->feed_fds[mode],(struct sockaddr *)&from,&slen) < 0 )
+		return;
+	transport->server_port = ntohs(from.sin_port);
+	snprintf(transport->source,sizeof(transport->source),"%s",inet_ntoa(from.sin_addr));
+}
+
+/* relay => camera: '$'-frame what the relay sent to a feed */
+static void 
+rtsp_feed_io(core *co,camera *cam,stream_mode mode)
+{
+	rtsp_client_t *client = cam->client;
+	char buf[RECV_BUFF_DEFAULT_LEN];
+	int len;
+	int queued = 0;
+	
+	while( (len = recv(client->feed_fds[mode],buf,sizeof(buf),MSG_DONTWAIT)) > 0 ){
+		if( rtsp_ready != client->state || client->server_socket < 0 ||
+			client->out_len + 4 + len > sizeof(client->out_buf) )
+			continue;	/* dropped, like udp would */
+		client->out_buf[client->out_len++] = '$';
+		client->out_buf[client->out_len++] = (char)mode;
+		client->out_buf[client->out_len++] = (char)(len >> 8);
+		client->out_buf[client->out_len++] = (char)len;
+		memcpy(client->out_buf+client->out_len,buf,len);
+		client->out_len += len;
+		queued = 1;
 	}
+	if( queued )
+		rtsp_flush_out(co,cam);
+}
+
+/* drop the control connection, the client (sdp, transports) stays */
+static void 
+rtsp_disconnect(core *co,camera *cam)
+{
+	rtsp_client_t *client = cam->client;
 	
-	osip_www_authenticate_init(&auth);
+	rtsp_reactor_set(co,cam,EPOLL_CTL_DEL);
+	rtsp_close_socket(client);
+	client->ninflight = 0;
+	client->in_len = 0;
+	client->out_len = 0;
+	client->need_reconnect = 1;
+}
 
-	/* describe */
-	memset(&cmd, 0, sizeof(cmd));
-	free_decode_response(decode);
-	decode = NULL;
-	ret = rtsp_send_describe(rtsp_client, &cmd, &decode);
-	if( NULL == decode){
-		ret = -1;
-		goto go_out;
-	}
+/* open failed or timed out: every call waiting on it gets status */
+static void 
+rtsp_open_fail(core *co,camera *cam,int status)
+{
+	rtsp_client_t *client = cam->client;
+	
+	log(co,LOG_NOTICE,"rtsp %s open failed,state=%d status=%d\n",cam->url,client->state,status);
+	rtsp_disconnect(co,cam);
+	client->state = rtsp_failed;
+	if( NULL != client->open_done )
+		client->open_done(co,cam,status);
+}
 
-	*status = atoi(decode->retcode);
-	if( 401 == *status || 407 == *status ){
-		if( NULL != decode->www_authenticate ) wwwauth = decode->www_authenticate ;
-		else if (NULL != decode->proxy_authenticate ) wwwauth = decode->proxy_authenticate ;
-		else if( NULL != decode->authorization ) wwwauth = decode->authorization ;
-		if( NULL != wwwauth )	{
-			CHECK_AND_FREE(rtsp_client->authorization);
-			rtsp_client->authorization = strdup(wwwauth);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
-
-			if( NULL != auth)	{
-				ret = osip_www_authenticate_parse(auth, wwwauth);
-				if( 0 == ret )	{
-					ret=rtsp_compute_digest_response(co->rtsp_url,co->rtsp_username,
-						co->rtsp_password,auth->realm, auth->nonce,"DESCRIBE",response);
-					if( 0 == ret )	{
-						snprintf(auth_str,sizeof(auth_str)-1,auth_fmt,co->rtsp_username,
-							auth->realm,auth->nonce,co->rtsp_url, response);
-						CHECK_AND_FREE(cmd.authorization);
-						cmd.authorization = strdup(auth_str);
-						free_decode_response(decode);
-						decode = NULL;
-						ret = rtsp_send_describe(rtsp_client, &cmd, &decode);
-						if(NULL != decode ) *status = atoi(decode->retcode);
-					}
-				}
+static int 
+rtsp_flush_out(core *co,camera *cam)
+{
+	rtsp_client_t *client = cam->client;
+	int ret;
+	
+	if( rtsp_connecting == client->state || client->server_socket < 0 )
+		return 0;
+	if( client->out_len > 0 ){
+		ret = send(client->server_socket,client->out_buf,client->out_len,MSG_NOSIGNAL|MSG_DONTWAIT);
+		if( ret < 0 ){
+			if( EAGAIN != errno && EWOULDBLOCK != errno ){
+				log(co,LOG_DEBUG,"rtsp %s send failed:%s\n",cam->url,strerror(errno));
+				return -1;
 			}
-		}else{
-			ret = -1;
-		 	goto go_out;
+			ret = 0;
 		}
+		client->out_len -= ret;
+		memmove(client->out_buf,client->out_buf+ret,client->out_len);
 	}
+	rtsp_reactor_set(co,cam,EPOLL_CTL_MOD);
+	return 0;
+}
+
+static void 
+rtsp_auth_build(camera *cam,const char *method,char *auth_str,int auth_str_len)
+{
+	osip_www_authenticate_t *auth = NULL;
+	HASHHEX response;
 
-	if( NULL == decode->body)	{
-		ret = -1;
-		goto go_out;
+	auth_str[0] = '\0';
+	if( NULL == cam->client->authorization )
+		return;
+	osip_www_authenticate_init(&auth);
+	if( NULL == auth )
+		return;
+	if( 0 == osip_www_authenticate_parse(auth,cam->client->authorization) &&
+		0 == rtsp_compute_digest_response(cam->url,cam->username,
+			cam->password,auth->realm,auth->nonce,method,response) ){
+		snprintf(auth_str,auth_str_len-1,auth_fmt,cam->username,
+			auth->realm,auth->nonce,cam->url,response);
 	}
+	osip_www_authenticate_free(auth);
+}
 
-	/* sdp_buf */
-	strncpy(rtsp_client->sdp_buf,decode->body,sizeof(rtsp_client->sdp_buf)-1);
-		
-	strncpy(sdp_buff,decode->body, sdp_buff_len);
+/* queue one request, its response is handled by rtsp_response */
+static int 
+rtsp_request(core *co,camera *cam,rtsp_method method,const char *url,
+	char *transport,char *range,const char *session)
+{
+	rtsp_client_t *client = cam->client;
+	rtsp_command_t cmd;
+	char auth_str[HEAD_BUFF_DEFAULT_LEN] = {0};
+	int len;
+
+	if( client->server_socket < 0 || client->ninflight >= RTSP_INFLIGHT_MAX )
+		return -1;
 	
-	sdpdecode = set_sdp_decode_from_memory(decode->body);
-	if (sdpdecode == NULL)	{
-		log(co,LOG_DEBUG,"Couldn't get sdp decode\n");
-		ret = -1;
-		goto go_out;
+	memset(&cmd,0,sizeof(cmd));
+	cmd.transport = transport;
+	cmd.range = range;
+	rtsp_auth_build(cam,method_str[method],auth_str,sizeof(auth_str));
+	if( '\0' != auth_str[0] )
+		cmd.authorization = auth_str;
+	
+	len = rtsp_build_request(client,method_str[method],url,&cmd,session,
+		client->out_buf+client->out_len,sizeof(client->out_buf)-client->out_len);
+	if( len < 0 ){
+		log(co,LOG_DEBUG,"rtsp %s %s does not fit\n",cam->url,method_str[method]);
+		return -1;
 	}
+	log(co,LOG_NOTICE,"rtsp send -->\n%.*s\n",len,client->out_buf+client->out_len);
+	client->out_len += len;
+	client->next_cseq++;
+	client->inflight[client->ninflight++] = method;
+	client->deadline = rtsp_systemtime_get(NULL) + (client->recv_timeout + 999)/1000;
+	return rtsp_flush_out(co,cam);
+}
 
-	if (sdp_decode(sdpdecode, &sdp, &translated) != 0){
-		log(co,LOG_DEBUG,"Couldn't decode sdp\n");
-		ret = -1;
-		goto go_out;
-	}
-
-	convert_relative_urls_to_absolute(sdp, co->rtsp_url);
-	media = sdp->media;	
-	if( NULL != media && NULL != media->media){
-		if (strncasecmp(media->media, "video",strlen("video")) == 0) {
-			media_type = MEDIA_VIDEO;
-			snprintf(transport_buf,sizeof(transport_buf)-1,transport_str,
-				video_host, video_port,video_port+1);
-		}else if (strncasecmp(media->media, "audio",strlen("audio")) == 0) {
-			media_type = MEDIA_AUDIO;
-			snprintf(transport_buf,sizeof(transport_buf)-1,transport_str,
-				audio_host, audio_port,audio_port+1);
+static void 
+rtsp_describe_done(core *co,camera *cam,rtsp_decode_t *decode,int status)
+{
+	rtsp_client_t *client = cam->client;
+	sdp_decode_info_t *sdpdecode = NULL;
+	char *wwwauth = NULL;
+	int translated;
+
+	if( (401 == status || 407 == status) && !client->auth_tried ){
+		if( NULL != decode->www_authenticate ) wwwauth = decode->www_authenticate ;
+		else if (NULL != decode->proxy_authenticate ) wwwauth = decode->proxy_authenticate ;
+		else if( NULL != decode->authorization ) wwwauth = decode->authorization ;
+		if( NULL != wwwauth ){
+			CHECK_AND_FREE(client->authorization);
+			client->authorization = strdup(wwwauth);
+			client->auth_tried = 1;
+			if( 0 == rtsp_request(co,cam,rtsp_method_describe,client->url,NULL,NULL,NULL) )
+				return;
 		}
 	}
-	cmd.transport = transport_buf;
-	if( NULL != auth ){
-		ret = rtsp_compute_digest_response(co->rtsp_url,co->rtsp_username,
-			co->rtsp_password,auth->realm,auth->nonce,"SETUP",response);
-		if( 0 == ret ){
-			snprintf(auth_str,sizeof(auth_str)-1,auth_fmt,co->rtsp_username,
-				auth->realm,auth->nonce,co->rtsp_url,response);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
-		}
+	if( 2 != status/100 || NULL == decode->body ){
+		rtsp_open_fail(co,cam,status > 0 ? status : 503);
+		return;
 	}
+	
+	/* sdp_buf */
+	strncpy(client->sdp_buf,decode->body,sizeof(client->sdp_buf)-1);
+	sdpdecode = set_sdp_decode_from_memory(decode->body);
+	if( NULL == sdpdecode || 0 != sdp_decode(sdpdecode,&client->sdp,&translated) ){
+		log(co,LOG_DEBUG,"Couldn't decode sdp\n");
+		sdp_decode_info_free(sdpdecode);
+		rtsp_open_fail(co,cam,503);
+		return;
+	}
+	sdp_decode_info_free(sdpdecode);
+	convert_relative_urls_to_absolute(client->sdp,cam->url);
+	
+	client->state = rtsp_setting_up;
+	client->setup_media = client->sdp->media;
+	rtsp_setup_next(co,cam);
+}
 
-	/* setup */
-	free_decode_response(decode);
-	decode = NULL;
-	ret = rtsp_send_setup(rtsp_client,media->control_string,&cmd,&session,&decode,0);
-	if (ret != RTSP_RESPONSE_GOOD || NULL == decode){
-		log(co,LOG_DEBUG,"Response to setup is %d\n", ret);
-		goto go_out;
-	}
-
-	rtsp_sessiontimeout_set(decode->session_timeout);
-	*status = atoi(decode->retcode);
-	rtsp_client->session = strdup(session->session);
-	if( MEDIA_VIDEO == media_type ){
-		ret = process_rtsp_transport(video_transport,decode->transport,"RTP/AVP");
-		memcpy(&rtsp_client->video_transport,video_transport,sizeof(rtsp_client->video_transport));
-	}else if(MEDIA_AUDIO ==  media_type){
-		ret = process_rtsp_transport(audio_transport,decode->transport,"RTP/AVP");
-		memcpy(&rtsp_client->audio_transport,audio_transport,sizeof(rtsp_client->audio_transport));
-	}
-
-	media = (sdp->media)->next;
-	while(media!= NULL){
-		if( NULL != media->media){
-			media_type = 0;
-			if (strncasecmp(media->media, "video",strlen("video")) == 0) {
-				media_type = MEDIA_VIDEO;
-				snprintf(transport_buf,sizeof(transport_buf)-1,transport_str,
-					video_host, video_port,video_port+1);
-			}else if (strncasecmp(media->media, "audio",strlen("audio")) == 0) {
-				media_type = MEDIA_AUDIO;
-				snprintf(transport_buf,sizeof(transport_buf)-1,transport_str,
-					audio_host, audio_port,audio_port+1);
-			}
-		}
-
-		cmd.transport = transport_buf;
-		free_decode_response(decode);
-		decode = NULL;
-		ret=rtsp_send_setup(rtsp_client,media->control_string,&cmd,&session,&decode,1);
-		if (ret != RTSP_RESPONSE_GOOD || NULL == decode){
-			log(co,LOG_DEBUG,"Response to setup is %d\n", ret);
-			goto go_out;
+/* one SETUP per audio/video track, then the session is ready */
+static void 
+rtsp_setup_next(core *co,camera *cam)
+{
+	rtsp_client_t *client = cam->client;
+	media_desc_t *media = NULL;
+	char *transport = NULL;
+	
+	for(media = client->setup_media; NULL != media; media = media->next) {
+		if( NULL == media->media )
+			continue;
+		if( 0 == strncasecmp(media->media,"video",strlen("video")) ){
+			client->setup_type = MEDIA_VIDEO;
+			transport = client->video_transport_str;
+			break;
 		}
-
-		rtsp_sessiontimeout_set(decode->session_timeout);
-		*status = atoi(decode->retcode);
-		if( MEDIA_VIDEO == media_type )	{
-			ret = process_rtsp_transport(video_transport,decode->transport, "RTP/AVP");
-			memcpy(&rtsp_client->video_transport,video_transport,sizeof(rtsp_client->video_transport));
-		}else if(MEDIA_AUDIO == media_type)	{
-			ret = process_rtsp_transport(audio_transport,decode->transport, "RTP/AVP");
-			memcpy(&rtsp_client->audio_transport,audio_transport,sizeof(rtsp_client->audio_transport));
+		if( 0 == strncasecmp(media->media,"audio",strlen("audio")) ){
+			client->setup_type = MEDIA_AUDIO;
+			transport = client->audio_transport_str;
+			break;
 		}
-		media = media->next;
 	}
-
-go_out:
-	if( 0 != ret ){
-		free_rtsp_client(rtsp_client);
-		rtsp_client=NULL;
+	client->setup_media = media;
+	
+	if( NULL == media ){
+		sdp_free_session_desc(client->sdp);
+		client->sdp = NULL;
+		client->state = rtsp_ready;
+		client->need_reconnect = 0;
+		client->last_update = rtsp_systemtime_get(NULL);
+		if( NULL != client->open_done )
+			client->open_done(co,cam,200);
+		return;
+	}
+	if( 0 != rtsp_request(co,cam,rtsp_method_setup,
+		NULL != media->control_string ? media->control_string : client->url,
+		transport,NULL,client->session) ){
+		rtsp_open_fail(co,cam,503);
 	}
-	sdp_decode_info_free(sdpdecode);
-	CHECK_AND_FREE(cmd.authorization);
-	sdp_free_session_desc(sdp);
-	free_decode_response(decode);
-	osip_www_authenticate_free(auth);
-
-	return ret;
 }
 
-int 
-rtsp_play(core *co)
+/* SETUP reply transport, an interleaved one must keep our channels,
+ * a multicast one moves the relay's camera pair onto the group */
+static int 
+rtsp_transport_set(core *co,camera *cam,stream_mode mode,rtsp_transport_parse_t *transport,char *reply)
 {
-	rtsp_command_t cmd;
-	rtsp_decode_t *decode = NULL;
 	int ret;
-	char auth_str[HEAD_BUFF_DEFAULT_LEN]={0};
-	osip_www_authenticate_t *auth = NULL;
-	HASHHEX response;
-		
-	if( NULL == rtsp_client|| NULL == co )
-		return -1;
+	
+	if( cam->client->multicast ){
+		ret = process_rtsp_transport(transport,reply,"RTP/AVP");
+		if( 0 != ret || !transport->have_multicast )
+			return 0; /* server chose unicast, our pair still listens */
+		if( '\0' == transport->destination[0] || 0 == transport->server_port )
+			return -1;
+		return stream_camera_join(co,cam,mode,transport->destination,transport->server_port);
+	}
+	if( !cam->client->interleaved ){
+		process_rtsp_transport(transport,reply,"RTP/AVP");
+		if( transport->have_rtcp_mux && 0 != stream_camera_mux(co,cam,mode) )
+			transport->have_rtcp_mux = 0;
+		return 0;
+	}
+	transport->use_interleaved = 1;
+	transport->interleave_port = mode;
+	ret = process_rtsp_transport(transport,reply,"RTP/AVP");
+	if( 0 != ret )
+		return ret;
+	rtsp_feed_transport(cam,mode,transport);
+	return 0;
+}
 
-	memset(&cmd, 0, sizeof(rtsp_command_t));
-	cmd.transport = NULL;
-	cmd.range = "npt=0.0-";
+static void 
+rtsp_setup_done(core *co,camera *cam,rtsp_decode_t *decode,int status)
+{
+	rtsp_client_t *client = cam->client;
+	char *timeout = NULL;
+	char *p = NULL;
+	int ret = 0;
 	
-	if( NULL != rtsp_client->authorization){
-		osip_www_authenticate_init(&auth);
-		ret = osip_www_authenticate_parse(auth, rtsp_client->authorization);
-		
-		ret = rtsp_compute_digest_response(co->rtsp_url, co->rtsp_username, 
-			co->rtsp_password, auth->realm, auth->nonce,"PLAY",response);
-		if( 0 == ret )	{
-			snprintf(auth_str,sizeof(auth_str)-1, auth_fmt, co->rtsp_username, 
-				auth->realm, auth->nonce,co->rtsp_url, response);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
-		}
+	if( 2 != status/100 || NULL == decode->session ){
+		rtsp_open_fail(co,cam,status > 0 ? status : 503);
+		return;
 	}
-	ret = rtsp_send_aggregate_play(rtsp_client,co->rtsp_url,&cmd,&decode);  
-	if (ret != RTSP_RESPONSE_GOOD)	{
-		log(co,LOG_DEBUG,"response to play is %d\n", ret);
-	}else{
-		rtsp_client->last_update = rtsp_systemtime_get(NULL);
+	
+	/* Session: id[;timeout=n] */
+	timeout = strstr(decode->session,"timeout");
+	if( NULL != timeout )
+		sscanf(timeout, " timeout = %d",&decode->session_timeout);
+	p = strchr(decode->session,';');
+	if( NULL != p ) 
+		*p = '\0';
+	if( NULL == client->session )
+		client->session = strdup(decode->session);
+	rtsp_sessiontimeout_set(cam,decode->session_timeout);
+	
+	if( MEDIA_VIDEO == client->setup_type ){
+		ret = rtsp_transport_set(co,cam,stream_video_rtp,&client->video_transport,decode->transport);
+	}else if( MEDIA_AUDIO == client->setup_type ){
+		ret = rtsp_transport_set(co,cam,stream_audio_rtp,&client->audio_transport,decode->transport);
 	}
+	if( 0 != ret ){
+		log(co,LOG_NOTICE,"rtsp %s unusable transport %s\n",cam->url,
+			NULL == decode->transport ? "" : decode->transport);
+		rtsp_open_fail(co,cam,461);
+		return;
+	}
+	client->setup_media = client->setup_media->next;
+	rtsp_setup_next(co,cam);
+}
 
-	CHECK_AND_FREE(cmd.authorization);
-	osip_www_authenticate_free(auth);
-	free_decode_response(decode);
+/* one complete response, for the oldest request in flight */
+static void 
+rtsp_response(core *co,camera *cam,int ret)
+{
+	rtsp_client_t *client = cam->client;
+	rtsp_decode_t *decode = client->decode_response;
+	rtsp_method method;
+	int status = 0;
 	
-	return 0;
+	if( client->ninflight <= 0 ){
+		log(co,LOG_DEBUG,"rtsp %s unexpected response\n",cam->url);
+		return;
+	}
+	method = client->inflight[0];
+	client->ninflight--;
+	memmove(client->inflight,client->inflight+1,sizeof(int)*client->ninflight);
+	if( 0 == ret && NULL != decode )
+		status = atoi(decode->retcode);
+	
+	switch(method) {
+	case rtsp_method_describe:
+		rtsp_describe_done(co,cam,decode,status);
+		break;
+	case rtsp_method_setup:
+		rtsp_setup_done(co,cam,decode,status);
+		break;
+	case rtsp_method_play:
+		if( 2 != status/100 ){
+			log(co,LOG_DEBUG,"response to play is %d\n", status);
+		}else{
+			client->last_update = rtsp_systemtime_get(NULL);
+		}
+		break;
+	case rtsp_method_getparam:
+		if( 2 != status/100 ){
+			client->need_reconnect = 1;
+			log(co,LOG_DEBUG,"response to get_parameter is %d\n", status);
+		}else{
+			client->need_reconnect = 0;
+		}
+		break;
+	default:
+		if( 2 != status/100 )
+			log(co,LOG_DEBUG,"response to %s is %d\n",method_str[method],status);
+		break;
+	}
 }
 
-int 
-rtsp_pause(core *co)
+/* reactor callback: the control connection (mode -1) or a feed of cam is ready */
+void 
+rtsp_io(core *co,uint64_t key,uint32_t events)
 {
-	rtsp_command_t cmd;
-	rtsp_decode_t *decode = NULL;
-	int ret ;
-	char auth_str[HEAD_BUFF_DEFAULT_LEN]={0};
-	osip_www_authenticate_t *auth = NULL;
-	HASHHEX response;
+	camera *cam = camera_get(co,RTSP_IO_CAMERA(key));
+	rtsp_client_t *client = NULL;
+	socklen_t slen;
+	int err = 0;
+	int ret, len;
+	uint32_t off = 0;
+
+	if( NULL == cam || NULL == (client = cam->client) )
+		return;
+	if( RTSP_IO_MODE(key) >= 0 ){
+		if( RTSP_IO_MODE(key) < stream_max && client->feed_fds[RTSP_IO_MODE(key)] >= 0 )
+			rtsp_feed_io(co,cam,RTSP_IO_MODE(key));
+		return;
+	}
+	if( client->server_socket < 0 )
+		return;
 	
-	if( NULL == rtsp_client|| NULL == co )
-		return -1;
+	if( rtsp_connecting == client->state ){
+		slen = sizeof(err);
+		if( getsockopt(client->server_socket,SOL_SOCKET,SO_ERROR,&err,&slen) < 0 || 0 != err ){
+			log(co,LOG_WARNING,"Couldn't connect %s:%s\n",cam->url,strerror(err));
+			rtsp_open_fail(co,cam,404);
+			return;
+		}
+		client->state = rtsp_describing;
+	}
+	if( (events & EPOLLOUT) && 0 != rtsp_flush_out(co,cam) ){
+		events = EPOLLHUP;
+	}
+	if( !(events & (EPOLLIN|EPOLLHUP|EPOLLERR)) )
+		return;
 	
-	memset(&cmd, 0, sizeof(rtsp_command_t));
-	cmd.transport = NULL;
+	ret = recv(client->server_socket,client->in_buf+client->in_len,
+		sizeof(client->in_buf)-1-client->in_len,MSG_DONTWAIT);
+	if( ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) )
+		return;
+	if( ret <= 0 ){
+		log(co,LOG_NOTICE,"rtsp %s connection closed\n",cam->url);
+		if( rtsp_ready == client->state ){
+			rtsp_disconnect(co,cam);
+		}else{
+			rtsp_open_fail(co,cam,503);
+		}
+		return;
+	}
+	client->in_len += ret;
+	client->in_buf[client->in_len] = '\0';
 
-	if( NULL != rtsp_client->authorization){
-		osip_www_authenticate_init(&auth);
-		ret = osip_www_authenticate_parse(auth, rtsp_client->authorization);
+	/* responses and '$' <channel> <length:16> frames, in any order */
+	while( off < client->in_len ){
+		char *p = client->in_buf + off;
+		uint32_t left = client->in_len - off;
 		
-		ret = rtsp_compute_digest_response(co->rtsp_url, co->rtsp_username, co->rtsp_password,  auth->realm, auth->nonce,"PAUSE",response);
-		if( 0 == ret )	{
-			snprintf(auth_str,sizeof(auth_str)-1, auth_fmt, co->rtsp_username, auth->realm, auth->nonce,co->rtsp_url, response);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
+		if( '$' == *p ){
+			if( left < 4 )
+				break;
+			len = 4 + (((unsigned char)p[2] << 8) | (unsigned char)p[3]);
+			if( left < (uint32_t)len )
+				break;
+			if( (unsigned char)p[1] < stream_max && client->feed_fds[(unsigned char)p[1]] >= 0 )
+				send(client->feed_fds[(unsigned char)p[1]],p+4,len-4,MSG_DONTWAIT);
+			off += len;
+			continue;
+		}
+		
+		len = rtsp_response_length(p,left);
+		if( len <= 0 )
+			break;
+		ret = rtsp_parse_buffer(client,p,len);
+		off += len;
+		rtsp_response(co,cam,ret);
+		if( cam->client != client || client->server_socket < 0 )
+			return;
+	}
+	client->in_len -= off;
+	memmove(client->in_buf,client->in_buf+off,client->in_len);
+	client->in_buf[client->in_len] = '\0';
+	
+	if( client->in_len >= sizeof(client->in_buf)-1 ){
+		log(co,LOG_DEBUG,"rtsp %s response too large\n",cam->url);
+		if( rtsp_ready == client->state ){
+			rtsp_disconnect(co,cam);
+		}else{
+			rtsp_open_fail(co,cam,503);
 		}
 	}
-	ret = rtsp_send_aggregate_pause(rtsp_client,co->rtsp_url,&cmd,&decode);
-	if (ret != RTSP_RESPONSE_GOOD)
-		log(co,LOG_DEBUG,"response to play is %d\n", ret);
-
-	CHECK_AND_FREE(cmd.authorization);
-	osip_www_authenticate_free(auth);
-	free_decode_response(decode);
-	return 0;
-
 }
 
+/*
+* start DESCRIBE/SETUP for cam without waiting, done(co,cam,status) is 
+* called from the reactor once the session is ready (200) or failed.
+* an already open session calls done at once.
+*/
 int 
-rtsp_getparam(core *co)
+rtsp_open(core *co,camera *cam,char *video_host, uint16_t video_port, 
+	char *audio_host, uint16_t audio_port, 
+	void (*done)(core *co,camera *cam,int status))
 {
-	rtsp_command_t cmd;
-	rtsp_decode_t *decode = NULL ;
-	int ret;
-	char auth_str[HEAD_BUFF_DEFAULT_LEN]={0};
-	osip_www_authenticate_t *auth = NULL;
-	HASHHEX response;
+	rtsp_client_t *client = NULL;
+	int ret = 0;
 	
-	if( NULL == rtsp_client || NULL == co )
+	if( NULL == co || NULL == cam )
 		return -1;
 	
-	memset(&cmd, 0, sizeof(rtsp_command_t));
-	cmd.transport = NULL;
+	client = cam->client;
+	if( rtsp_alive(cam) ){
+		client->open_done = done;
+		if( rtsp_ready == client->state )
+			done(co,cam,200);
+		return 0;
+	}
+	
+	rtsp_close(co,cam);
+	client = cam->client = rtsp_create_client_common(co,cam->url,&ret);
+	if( NULL == client ){
+		done(co,cam,404);
+		return -1;
+	}
+	client->open_done = done;
 	
-	if( NULL != rtsp_client->authorization){
-		osip_www_authenticate_init(&auth);
-		ret = osip_www_authenticate_parse(auth, rtsp_client->authorization);
-		
-		ret = rtsp_compute_digest_response(co->rtsp_url, co->rtsp_username, 
-			co->rtsp_password,  auth->realm, auth->nonce,"GETPARAM",response);
-		if( 0 == ret )	{
-			snprintf(auth_str,sizeof(auth_str)-1, auth_fmt, co->rtsp_username, 
-				auth->realm, auth->nonce,co->rtsp_url, response);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
+	/* interleaved needs the relay's camera sockets to feed */
+	client->interleaved = cam->interleaved && core_rtpproxy_get(co);
+	client->multicast = cam->multicast && core_rtpproxy_get(co);
+	if( client->multicast ){
+		snprintf(client->video_transport_str,sizeof(client->video_transport_str)-1,"%s",multicast_str);
+		snprintf(client->audio_transport_str,sizeof(client->audio_transport_str)-1,"%s",multicast_str);
+	}else if( client->interleaved ){
+		snprintf(client->video_transport_str,sizeof(client->video_transport_str)-1,
+			interleaved_str,stream_video_rtp,stream_video_rtcp);
+		snprintf(client->audio_transport_str,sizeof(client->audio_transport_str)-1,
+			interleaved_str,stream_audio_rtp,stream_audio_rtcp);
+	}else{
+		snprintf(client->video_transport_str,sizeof(client->video_transport_str)-1,
+			transport_str,video_host,video_port,video_port+1);
+		snprintf(client->audio_transport_str,sizeof(client->audio_transport_str)-1,
+			transport_str,audio_host,audio_port,audio_port+1);
+		/* servers that do not know RTCP-mux ignore it and keep the pair */
+		if( co->rtcp_mux && core_rtpproxy_get(co) ){
+			strncat(client->video_transport_str,rtcp_mux_str,
+				sizeof(client->video_transport_str)-1-strlen(client->video_transport_str));
+			strncat(client->audio_transport_str,rtcp_mux_str,
+				sizeof(client->audio_transport_str)-1-strlen(client->audio_transport_str));
 		}
 	}
 	
-	ret = rtsp_send_get_parameter(rtsp_client,co->rtsp_url, &cmd, &decode);
-	if (ret != RTSP_RESPONSE_GOOD){
-		rtsp_client->need_reconnect = 1;
-		log(co,LOG_DEBUG,"response to get_parameter is %d\n", ret);
-	}else{
-		rtsp_client->need_reconnect = 0;
+	if( 0 != rtsp_create_socket_nonblocking(client) ){
+		log(co,LOG_WARNING,"Couldn't connect %s\n",cam->url);
+		client->state = rtsp_failed;
+		done(co,cam,404);
+		return -1;
 	}
+	client->state = rtsp_connecting;
+	rtsp_reactor_set(co,cam,EPOLL_CTL_ADD);
+	if( client->interleaved && 0 != rtsp_feeds_open(co,cam) ){
+		rtsp_open_fail(co,cam,503);
+		return -1;
+	}
+	
+	/* sent once connected */
+	if( 0 != rtsp_request(co,cam,rtsp_method_describe,client->url,NULL,NULL,NULL) ){
+		rtsp_open_fail(co,cam,503);
+		return -1;
+	}
+	return 0;
+}
 
-	CHECK_AND_FREE(cmd.authorization);
-	osip_www_authenticate_free(auth);
-	free_decode_response(decode);
+/* session open or opening, nothing to reconnect */
+int 
+rtsp_alive(camera *cam)
+{
+	if( NULL == cam || NULL == cam->client )
+		return 0;
+	return !cam->client->need_reconnect && rtsp_failed != cam->client->state;
+}
+
+/* sdp and transports of a ready session */
+int 
+rtsp_session_get(camera *cam,char *sdp_buff,int sdp_buff_len,
+	rtsp_transport_parse_t *video_transport,rtsp_transport_parse_t *audio_transport)
+{
+	if( NULL == cam || NULL == cam->client || rtsp_ready != cam->client->state )
+		return -1;
+	strncpy(sdp_buff,cam->client->sdp_buf,sdp_buff_len);
+	memcpy(video_transport,&cam->client->video_transport,sizeof(rtsp_transport_parse_t));
+	memcpy(audio_transport,&cam->client->audio_transport,sizeof(rtsp_transport_parse_t));
 	return 0;
+}
 
+int 
+rtsp_play(core *co,camera *cam)
+{
+	if( NULL == co || NULL == cam || NULL == cam->client || rtsp_ready != cam->client->state )
+		return -1;
+	return rtsp_request(co,cam,rtsp_method_play,cam->url,NULL,"npt=0.0-",cam->client->session);
 }
 
 int 
-rtsp_stop(core *co)
+rtsp_pause(core *co,camera *cam)
 {
-	rtsp_command_t cmd;
-	rtsp_decode_t *decode = NULL;
-	int ret;
-	char auth_str[HEAD_BUFF_DEFAULT_LEN]={0};
-	osip_www_authenticate_t *auth = NULL;
-	HASHHEX response;
-	
-	if( NULL == rtsp_client|| NULL == co )
+	if( NULL == co || NULL == cam || NULL == cam->client || rtsp_ready != cam->client->state )
+		return -1;
+	return rtsp_request(co,cam,rtsp_method_pause,cam->url,NULL,NULL,cam->client->session);
+}
+
+int 
+rtsp_getparam(core *co,camera *cam)
+{
+	if( NULL == co || NULL == cam || NULL == cam->client || rtsp_ready != cam->client->state )
+		return -1;
+	return rtsp_request(co,cam,rtsp_method_getparam,cam->url,NULL,NULL,cam->client->session);
+}
+
+/* forget the session without telling the camera */
+void 
+rtsp_close(core *co,camera *cam)
+{
+	if( NULL == cam || NULL == cam->client )
+		return;
+	rtsp_reactor_set(co,cam,EPOLL_CTL_DEL);
+	free_rtsp_client(cam->client);
+	cam->client = NULL;
+}
+
+/* TEARDOWN is sent but not waited for */
+int 
+rtsp_stop(core *co,camera *cam)
+{
+	if( NULL == co || NULL == cam || NULL == cam->client )
 		return -1;
 	
-	memset(&cmd, 0, sizeof(rtsp_command_t));
-	cmd.transport = NULL;
-	
-	if( NULL != rtsp_client->authorization){
-		osip_www_authenticate_init(&auth);
-		ret = osip_www_authenticate_parse(auth, rtsp_client->authorization);
-		
-		ret = rtsp_compute_digest_response(co->rtsp_url, co->rtsp_username,
-			co->rtsp_password,  auth->realm, auth->nonce,"TEARDOWN",response);
-		if( 0 == ret )	{
-			snprintf(auth_str,sizeof(auth_str)-1, auth_fmt, co->rtsp_username, 
-				auth->realm, auth->nonce,co->rtsp_url, response);
-			CHECK_AND_FREE(cmd.authorization);
-			cmd.authorization = strdup(auth_str);
-		}
+	if( rtsp_ready == cam->client->state ){
+		rtsp_request(co,cam,rtsp_method_teardown,cam->url,NULL,NULL,cam->client->session);
 	}
-	
-	ret = rtsp_send_aggregate_teardown(rtsp_client,co->rtsp_url,&cmd,&decode);
-	if (ret != RTSP_RESPONSE_GOOD)
-		log(co,LOG_DEBUG,"Teardown response %d\n", ret);
-	
-	osip_www_authenticate_free(auth);
-	CHECK_AND_FREE(cmd.authorization);
-	free_decode_response(decode);
-	free_rtsp_client(rtsp_client);
-	rtsp_client=NULL;
-	
+	rtsp_close(co,cam);
 	return 0;
 }
 
 
 int 
-rtsp_sessiontimeout_set(int timeout)
+rtsp_sessiontimeout_set(camera *cam,int timeout)
 {
-	if( NULL == rtsp_client || timeout <= 0)
+	if( NULL == cam->client || timeout <= 0)
 		return -1;
 	
-	if( rtsp_client->session_timeout <= 0 )
-		rtsp_client->session_timeout = timeout;
+	if( cam->client->session_timeout <= 0 )
+		cam->client->session_timeout = timeout;
 	
-	if( rtsp_client->session_timeout > timeout )
-		rtsp_client->session_timeout = timeout;
+	if( cam->client->session_timeout > timeout )
+		cam->client->session_timeout = timeout;
 
 	return 0;
 }
 
 int 
-rtsp_sessiontimeout_get(int *timeout)
+rtsp_sessiontimeout_get(camera *cam,int *timeout)
 {
-	if( NULL == rtsp_client )
+	if( NULL == cam->client )
 		return -1;
-	*timeout = rtsp_client->session_timeout;
+	*timeout = cam->client->session_timeout;
 	return 0;
 }
 
@@ -443,24 +742,40 @@ rtsp_systemtime_get(time_t * t)
 	return now_monotonic.tv_sec;
 }
 
+/* open timeouts and keepalive of every camera session */
 void 
 rtsp_automatic_action(core *co)
 {
 	time_t interval  = 0;
 	int session_timeout = 0;
-	 time_t now;
+	time_t now;
+	camera *cam = NULL;
+	int i;
 	  
-	if( NULL == rtsp_client || NULL == co )
+	if( NULL == co )
 		return;
 
-	rtsp_sessiontimeout_get(&session_timeout);	
-	if( session_timeout <= 0)
-		session_timeout =  co->session_timeout ;
 	now = rtsp_systemtime_get(NULL);
-	interval = now - rtsp_client->last_update;
-	if( interval >  (session_timeout/2) ){
-		rtsp_getparam(co);
-		rtsp_client->last_update = now;
+	for(i = 0; i < camera_count(co); i++) {
+		cam = camera_get(co,i);
+		if( NULL == cam->client )
+			continue;
+		if( rtsp_connecting == cam->client->state || rtsp_describing == cam->client->state ||
+			rtsp_setting_up == cam->client->state ){
+			if( now > cam->client->deadline )
+				rtsp_open_fail(co,cam,408);
+			continue;
+		}
+		if( rtsp_ready != cam->client->state )
+			continue;
+		session_timeout = 0;
+		rtsp_sessiontimeout_get(cam,&session_timeout);	
+		if( session_timeout <= 0)
+			session_timeout =  co->session_timeout ;
+		interval = now - cam->client->last_update;
+		if( interval >  (session_timeout/2) ){
+			rtsp_getparam(co,cam);
+			cam->client->last_update = now;
+		}
 	}
 }
-
@@ -25,20 +25,48 @@
 #include "rtsp_auth.h"
 #include "transport_parse.h"
 #include "core.h"
+#include "camera.h"
 
 
-int rtsp_open(core *co, int call_id,char *video_host, uint16_t video_port, 
-	char *audio_host, uint16_t audio_port , 
-	rtsp_transport_parse_t *video_transport,rtsp_transport_parse_t *audio_transport,
-	char *sdp_buff, int sdp_buff_len, int *status);
+/* signaling reactor key: camera index and stream mode (-1: control connection) */
+#define RTSP_IO_KEY(cam,mode)	((((uint64_t)(cam) + 1) << 8) | (uint64_t)((mode) + 1))
+#define RTSP_IO_CAMERA(key)	((int)((key) >> 8) - 1)
+#define RTSP_IO_MODE(key)	((int)((key) & 0xFF) - 1)
 
-int rtsp_play(core *co);
-int rtsp_pause(core *co);
-int rtsp_stop(core *co);
-int rtsp_getparam(core *co);
+typedef enum{
+	rtsp_idle = 0,
+	rtsp_connecting,	/* non-blocking connect in progress */
+	rtsp_describing,
+	rtsp_setting_up,	/* one SETUP per track */
+	rtsp_ready,		/* sdp and transports known */
+	rtsp_failed,
+}rtsp_state;
 
-int rtsp_sessiontimeout_set(int timeout);
-int rtsp_sessiontimeout_get(int *timeout);
+typedef enum{
+	rtsp_method_describe = 0,
+	rtsp_method_setup,
+	rtsp_method_play,
+	rtsp_method_pause,
+	rtsp_method_getparam,
+	rtsp_method_teardown,
+}rtsp_method;
+
+int rtsp_open(core *co, camera *cam,char *video_host, uint16_t video_port, 
+	char *audio_host, uint16_t audio_port, 
+	void (*done)(core *co,camera *cam,int status));
+int rtsp_session_get(camera *cam,char *sdp_buff,int sdp_buff_len,
+	rtsp_transport_parse_t *video_transport,rtsp_transport_parse_t *audio_transport);
+void rtsp_io(core *co,uint64_t key,uint32_t events);
+int rtsp_alive(camera *cam);
+
+int rtsp_play(core *co,camera *cam);
+int rtsp_pause(core *co,camera *cam);
+int rtsp_stop(core *co,camera *cam);
+void rtsp_close(core *co,camera *cam);
+int rtsp_getparam(core *co,camera *cam);
+
+int rtsp_sessiontimeout_set(camera *cam,int timeout);
+int rtsp_sessiontimeout_get(camera *cam,int *timeout);
 void rtsp_automatic_action(core *co);
 
 #endif
@@ -64,7 +64,7 @@ static int rtsp_get_server_address (rtsp_client_t *client)
 	return 0;
 }
 
-int rtsp_create_socket (rtsp_client_t *client)
+static int rtsp_connect_socket (rtsp_client_t *client, int nonblock)
 {
 #ifndef HAVE_IPv6
 	struct sockaddr_in sockaddr;
@@ -96,6 +96,10 @@ int rtsp_create_socket (rtsp_client_t *client)
 		log(client->co,LOG_DEBUG, "Couldn't create socket\n");
 		return (-1);
 	}
+	if (nonblock) {
+		fcntl(client->server_socket, F_SETFL,
+			fcntl(client->server_socket, F_GETFL, 0) | O_NONBLOCK);
+	}
 
 #ifndef HAVE_IPv6
 	sockaddr.sin_family = AF_INET;
@@ -112,14 +116,30 @@ int rtsp_create_socket (rtsp_client_t *client)
 		client->addr_info->ai_addrlen
 #endif
 		);
-	if (result < 0){
-		log(client->co,LOG_DEBUG, "Couldn't connect socket - error %s\n",strerror(result));
+	if (result < 0 && !(nonblock && errno == EINPROGRESS)){
+		log(client->co,LOG_DEBUG, "Couldn't connect socket - error %s\n",strerror(errno));
+		rtsp_close_socket(client);
 		return (-1);
 	}
 
 	return (0);
 }
 
+int rtsp_create_socket (rtsp_client_t *client)
+{
+	return rtsp_connect_socket(client, 0);
+}
+
+/*
+* rtsp_create_socket_nonblocking()
+* same as rtsp_create_socket, but the connect may still be in progress
+* on return: wait for the socket to become writable, then check SO_ERROR.
+*/
+int rtsp_create_socket_nonblocking (rtsp_client_t *client)
+{
+	return rtsp_connect_socket(client, 1);
+}
+
 
 /*
 * rtsp_send()
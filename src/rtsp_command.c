@@ -118,6 +118,37 @@ static int rtsp_build_common (char *buffer,
 	return (0);
 }
 
+/*
+* rtsp_build_request - format one complete request into buffer, without
+* sending it.  Used by the non-blocking client, which owns the socket.
+* Returns the request length, -1 if it does not fit.
+*/
+int rtsp_build_request (rtsp_client_t *client,
+						const char *method,
+						const char *url,
+						rtsp_command_t *cmd,
+						const char *session,
+						char *buffer,
+						uint32_t maxlen)
+{
+	uint32_t buflen;
+	int ret;
+
+	ret = snprintf(buffer, maxlen, "%s %s RTSP/1.0\r\n", method, url);
+	if (ret < 0 || (uint32_t)ret >= maxlen) {
+		return (-1);
+	}
+	buflen = ret;
+	if (rtsp_build_common(buffer, maxlen, &buflen, client, cmd, session) == -1) {
+		return (-1);
+	}
+	ret = snprintf(buffer + buflen, maxlen - buflen, "\r\n");
+	if (ret < 0 || buflen + ret >= maxlen) {
+		return (-1);
+	}
+	return (buflen + ret);
+}
+
 /*
 * rtsp_send_describe - send the describe client to a server
 */
@@ -50,6 +50,9 @@
 #define HOST_BUFF_DEFAULT_LEN 128
 #define HEAD_BUFF_DEFAULT_LEN 512
 #define RECV_BUFF_DEFAULT_LEN 2048
+#define RTSP_ASYNC_BUFF_LEN (4 * RECV_BUFF_DEFAULT_LEN)
+#define RTSP_IN_BUFF_LEN (4 + 0xFFFF)	/* one whole '$' interleaved frame */
+#define RTSP_INFLIGHT_MAX 8
 
 
 typedef enum{
@@ -70,6 +73,7 @@ typedef struct rtsp_transport_parse_t {
 	unsigned int  ssrc;
 	unsigned int interleave_port;
 	int use_interleaved;
+	int have_rtcp_mux;	/* rtcp on the rtp port */
 } rtsp_transport_parse_t;
 
 /*
@@ -88,6 +92,8 @@ struct rtsp_session_ {
 	char *url;
 };
 
+struct camera_t;
+
 /*
 * client main structure
 */
@@ -150,6 +156,36 @@ struct rtsp_client_ {
 	rtsp_transport_parse_t audio_transport;
 
 	int need_reconnect; 
+
+	/*
+	* non-blocking client, driven by the signaling thread reactor.
+	* requests are pipelined, responses come back in request order.
+	*/
+	int state;
+	time_t deadline;
+	int inflight[RTSP_INFLIGHT_MAX];
+	int ninflight;
+	int auth_tried;
+	session_desc_t *sdp;
+	media_desc_t *setup_media;
+	int setup_type;
+	char video_transport_str[HEAD_BUFF_DEFAULT_LEN];
+	char audio_transport_str[HEAD_BUFF_DEFAULT_LEN];
+	void (*open_done)(core *co, struct camera_t *cam, int status);
+	
+	/* 
+	* interleaved: rtp/rtcp come '$'-framed on the control connection,
+	* channel == stream_mode. feed_fds hand them to the camera side udp 
+	* sockets of the relay and take back what the relay sends the camera.
+	*/
+	int interleaved;
+	int feed_fds[stream_max];
+	int multicast;	/* SETUP asks for the camera's group, see stream_camera_join */
+	
+	uint32_t in_len;
+	char in_buf[RTSP_IN_BUFF_LEN + 1];
+	uint32_t out_len;
+	char out_buf[RTSP_ASYNC_BUFF_LEN];
 };
 
 #ifdef __cplusplus
@@ -164,6 +200,7 @@ extern "C" {
 	int rtsp_dissect_url(INOUT rtsp_client_t *rptr, IN const char *url);
 	/* communications routines */
 	int rtsp_create_socket(INOUT rtsp_client_t *client);
+	int rtsp_create_socket_nonblocking(INOUT rtsp_client_t *client);
 	void rtsp_close_socket(INOUT rtsp_client_t *client);
 
 	int rtsp_send2(IN rtsp_client_t *client, IN const char *buff, IN uint32_t len);
@@ -176,6 +213,10 @@ extern "C" {
 	int rtsp_setup_redirect(INOUT rtsp_client_t *client);
 
 	int rtsp_send_and_get(IN rtsp_client_t *client,IN char *buffer,IN uint32_t buflen);
+	int rtsp_build_request(IN rtsp_client_t *client,IN const char *method,IN const char *url,
+		IN rtsp_command_t *cmd,IN const char *session,OUT char *buffer,IN uint32_t maxlen);
+	int rtsp_response_length(IN const char *buffer,IN uint32_t len);
+	int rtsp_parse_buffer(INOUT rtsp_client_t *client,INOUT char *buffer,IN uint32_t len);
 
 	int rtsp_recv(IN rtsp_client_t *client, OUT char *buffer, IN uint32_t len);
 
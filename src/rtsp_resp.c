@@ -720,5 +720,139 @@ int rtsp_get_response (rtsp_client_t *client)
 	return (RTSP_RESPONSE_RECV_ERROR);
 }
 
+/*
+* rtsp_response_length - length of the first complete response in buffer
+* (headers, empty line and Content-Length bytes of body), 0 if more data
+* is needed.  buffer must be \0 terminated at len.
+*/
+int rtsp_response_length (const char *buffer, uint32_t len)
+{
+	const char *p, *end = NULL;
+	uint32_t content_length = 0;
+
+	for (p = buffer; p + 1 < buffer + len; p++) {
+		if (p[0] == '\n' && p[1] == '\n') {
+			end = p + 2;
+			break;
+		}
+		if (p + 3 < buffer + len && 
+			p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+			end = p + 4;
+			break;
+		}
+	}
+	if (end == NULL) {
+		return (0);
+	}
+	for (p = buffer; p < end; p++) {
+		if ((p == buffer || p[-1] == '\n') &&
+			strncasecmp(p, "Content-Length:", strlen("Content-Length:")) == 0) {
+			content_length = (uint32_t)strtoul(p + strlen("Content-Length:"), NULL, 10);
+			break;
+		}
+	}
+	if ((uint32_t)(end - buffer) + content_length > len) {
+		return (0);
+	}
+	return ((end - buffer) + content_length);
+}
+
+/*
+* rtsp_parse_buffer - decode one complete response already in memory
+* (see rtsp_response_length) into client->decode_response.  Nothing is
+* read from the socket; buffer is modified.
+*/
+int rtsp_parse_buffer (rtsp_client_t *client, char *buffer, uint32_t len)
+{
+	rtsp_decode_t *decode;
+	const char *seperator;
+	char *lptr, *next, *p;
+	char saved;
+	uint32_t seplen, bodylen;
+	int last_header = -1;
+	int ret = RTSP_RESPONSE_MALFORM_HEADER;
+
+	if (client->decode_response != NULL) {
+		clear_decode_response(client->decode_response);
+	} else {
+		client->decode_response = malloc(sizeof(rtsp_decode_t));
+		if (client->decode_response == NULL) {
+			return (RTSP_RESPONSE_RECV_ERROR);
+		}
+	}
+	decode = client->decode_response;
+	memset(decode, 0, sizeof(rtsp_decode_t));
+
+	saved = buffer[len];
+	buffer[len] = '\0';
+	log(client->co,LOG_NOTICE, "rtsp response <--\n%s\n", buffer);
+	seperator = find_seperator(buffer);
+	if (seperator == NULL) {
+		log(client->co,LOG_DEBUG, "Could not find seperator in header\n");
+		goto out;
+	}
+	seplen = strlen(seperator);
+
+	/* status line */
+	lptr = buffer;
+	while (strncmp(lptr, seperator, seplen) == 0) lptr += seplen;
+	next = strstr(lptr, seperator);
+	if (next == NULL) {
+		goto out;
+	}
+	*next = '\0';
+	if (strncasecmp(lptr, "RTSP/1.0", strlen("RTSP/1.0")) != 0) {
+		log(client->co,LOG_DEBUG, "RTSP/1.0 not found\n");
+		goto out;
+	}
+	p = lptr + strlen("RTSP/1.0");
+	ADV_SPACE(p);
+	if (*p < '1' || *p > '5' || strlen(p) < 3) {
+		log(client->co,LOG_DEBUG, "Bad error code %s\n", p);
+		goto out;
+	}
+	memcpy(decode->retcode, p, 3);
+	decode->retcode[3] = '\0';
+	p += 3;
+	ADV_SPACE(p);
+	if (*p != '\0') {
+		decode->retresp = strdup(p);
+	}
+
+	/* headers, up to the empty line */
+	lptr = next + seplen;
+	for (;;) {
+		next = strstr(lptr, seperator);
+		if (next == NULL) {
+			goto out;
+		}
+		*next = '\0';
+		if (*lptr == '\0') {
+			lptr = next + seplen;
+			break;
+		}
+		rtsp_decode_header(lptr, client, &last_header);
+		lptr = next + seplen;
+	}
+
+	/* body */
+	if (decode->content_length != 0) {
+		bodylen = MIN(decode->content_length, (uint32_t)(buffer + len - lptr));
+		decode->body = malloc(bodylen + 1);
+		if (decode->body != NULL) {
+			memcpy(decode->body, lptr, bodylen);
+			decode->body[bodylen] = '\0';
+		}
+	}
+	if (decode->cookie != NULL) {
+		CHECK_AND_FREE(client->cookie);
+		client->cookie = strdup(decode->cookie);
+	}
+	ret = 0;
+out:
+	buffer[len] = saved;
+	return (ret);
+}
+
 /* end file rtsp_resp.c */
 
@@ -0,0 +1,243 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <osip2/osip_mt.h>
+#include "send_queue.h"
+
+#define SEND_QUEUE_SLOT	(2048)	/* largest datagram the relay sends */
+
+typedef struct send_entry_t {
+	int slot;
+	size_t len;
+	uint32_t ts;
+	int nonref;		/* video nobody references, dropped first */
+} send_entry;
+
+struct send_queue_t {
+	int size;
+	int head;
+	int count;
+	send_entry *ring;
+	int *free_slots;
+	int nfree;
+	char *data;		/* size + 1 slots of SEND_QUEUE_SLOT, one to take the next push */
+	int resync;		/* drop until a keyframe starts */
+	int dropping;	/* drop the rest of frame drop_ts */
+	uint32_t drop_ts;
+};
+
+send_queue *
+send_queue_new(int packets)
+{
+	send_queue *q = (send_queue *)osip_malloc(sizeof(send_queue));
+	int i;
+
+	if(NULL == q)
+		return NULL;
+	memset(q,0,sizeof(send_queue));
+	q->size = packets;
+	q->ring = (send_entry *)osip_malloc(sizeof(send_entry) * packets);
+	q->free_slots = (int *)osip_malloc(sizeof(int) * (packets + 1));
+	q->data = (char *)osip_malloc((size_t)SEND_QUEUE_SLOT * (packets + 1));
+	if(NULL == q->ring || NULL == q->free_slots || NULL == q->data){
+		send_queue_free(q);
+		return NULL;
+	}
+	for(i = packets; i >= 0; i--) {
+		q->free_slots[q->nfree++] = i;
+	}
+	return q;
+}
+
+void 
+send_queue_free(send_queue *q)
+{
+	if(NULL == q)
+		return;
+	osip_free(q->ring);
+	osip_free(q->free_slots);
+	osip_free(q->data);
+	osip_free(q);
+}
+
+/* h264 nri 0, h265 sub-layer non-reference pictures */
+static int 
+send_queue_nonref(h26x_codec codec,const unsigned char *payload,size_t len)
+{
+	unsigned char type;
+
+	if(NULL == payload || len < 3)
+		return 0;
+	if(h26x_h264 == codec)
+		return 0 == (payload[0] & 0x60);
+	type = (payload[0] >> 1) & 0x3F;
+	if(49 == type)
+		type = payload[2] & 0x3F;
+	return type <= 14 && 0 == (type & 1);
+}
+
+/* 
+* keep only the entries not of frame ts (all_nonref: not of a nonref frame).
+* the rest of the newest frame evicted is still to come: drop it too.
+*/
+static void 
+send_queue_evict(send_queue *q,int all_nonref,uint32_t ts)
+{
+	send_entry *e = NULL;
+	int i, n = 0;
+
+	for(i = 0; i < q->count; i++) {
+		e = &q->ring[(q->head + i) % q->size];
+		if(all_nonref ? e->nonref : e->ts == ts){
+			q->free_slots[q->nfree++] = e->slot;
+			q->dropping = 1;
+			q->drop_ts = e->ts;
+			continue;
+		}
+		q->ring[(q->head + n) % q->size] = *e;
+		n++;
+	}
+	q->count = n;
+}
+
+static void 
+send_queue_clear(send_queue *q)
+{
+	while(q->count > 0) {
+		send_queue_pop(q);
+	}
+}
+
+/* 
+* the datagram in iov after the ones queued. codec h26x_none: the queue 
+* only ever drops the newest datagram.
+*/
+send_queue_result 
+send_queue_push(send_queue *q,h26x_codec codec,const struct iovec *iov,int iovcnt)
+{
+	const unsigned char *payload = NULL;
+	char *pkt = NULL;
+	size_t len = 0, plen = 0;
+	send_entry *e = NULL;
+	send_queue_result result = send_queue_queued;
+	h26x_kind kind = h26x_other;
+	uint32_t ts = 0;
+	int slot, nonref = 0, i;
+
+	/* a slot is always spare: gather into it, give it back if dropped */
+	slot = q->free_slots[--q->nfree];
+	pkt = q->data + (size_t)slot * SEND_QUEUE_SLOT;
+	/* the rewritten header and the payload are separate iovecs */
+	for(i = 0; i < iovcnt; i++) {
+		if(len + iov[i].iov_len > SEND_QUEUE_SLOT)
+			goto drop;
+		memcpy(pkt + len,iov[i].iov_base,iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	if(h26x_none != codec && len >= 12){
+		memcpy(&ts,pkt + 4,sizeof(ts));
+		payload = h26x_rtp_payload(pkt,len,&plen);
+		kind = h26x_payload_kind(codec,payload,plen);
+		nonref = send_queue_nonref(codec,payload,plen);
+	}
+
+	if(q->resync){
+		if(h26x_key != kind && h26x_param != kind)
+			goto drop;
+		q->resync = 0;
+	}
+	if(q->dropping && ts == q->drop_ts)
+		goto drop;
+	q->dropping = 0;
+
+	if(q->count == q->size){
+		if(h26x_none == codec)
+			goto drop;
+		if(nonref){
+			/* the whole frame goes, what is queued of it too */
+			q->dropping = 1;
+			q->drop_ts = ts;
+			send_queue_evict(q,0,ts);
+			goto drop;
+		}
+		send_queue_evict(q,1,0);
+		if(q->dropping && ts == q->drop_ts)
+			goto drop;
+		if(q->count == q->size){
+			send_queue_clear(q);
+			q->dropping = 0;
+			if(h26x_key != kind && h26x_param != kind){
+				q->resync = 1;
+				q->free_slots[q->nfree++] = slot;
+				return send_queue_resync;
+			}
+			result = send_queue_resync;
+		}
+	}
+
+	e = &q->ring[(q->head + q->count) % q->size];
+	e->slot = slot;
+	e->len = len;
+	e->ts = ts;
+	e->nonref = nonref;
+	q->count++;
+	return result;
+
+drop:
+	q->free_slots[q->nfree++] = slot;
+	return send_queue_dropped;
+}
+
+int 
+send_queue_count(const send_queue *q)
+{
+	return (NULL == q) ? 0 : q->count;
+}
+
+/* sending around the queue would reorder or break a frame */
+int 
+send_queue_blocked(const send_queue *q)
+{
+	return NULL != q && (q->count > 0 || q->resync || q->dropping);
+}
+
+const char *
+send_queue_peek(const send_queue *q,size_t *len)
+{
+	const send_entry *e = NULL;
+
+	if(NULL == q || 0 == q->count)
+		return NULL;
+	e = &q->ring[q->head];
+	*len = e->len;
+	return q->data + (size_t)e->slot * SEND_QUEUE_SLOT;
+}
+
+void 
+send_queue_pop(send_queue *q)
+{
+	if(NULL == q || 0 == q->count)
+		return;
+	q->free_slots[q->nfree++] = q->ring[q->head].slot;
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+}
@@ -0,0 +1,60 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __SEND_QUEUE_H__
+#define __SEND_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "h26x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* datagrams waiting for one slow sip peer's socket to drain. when it is
+* full, video gives up whole non-reference frames first; if that is not
+* enough everything queued goes and nothing is taken until the next
+* keyframe, so the peer never gets a frame whose references it lacks.
+* relay thread only, no locking.
+*/
+typedef struct send_queue_t send_queue;
+
+typedef enum {
+	send_queue_dropped = 0,	/* not queued, by policy */
+	send_queue_queued,
+	send_queue_resync		/* flushed, waiting for a keyframe */
+} send_queue_result;
+
+send_queue *send_queue_new(int packets);
+void send_queue_free(send_queue *q);
+send_queue_result send_queue_push(send_queue *q,h26x_codec codec,const struct iovec *iov,int iovcnt);
+int send_queue_count(const send_queue *q);
+int send_queue_blocked(const send_queue *q);
+const char *send_queue_peek(const send_queue *q,size_t *len);
+void send_queue_pop(send_queue *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,9 +19,14 @@
  */
 
 #include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
 #include "rtsp_client.h"
 #include "rtpproxy.h"
 #include "sip.h"
+#include "stats.h"
+
+#define SIP_EPOLL_EVENTS 64
 
 struct eXosip_t *excontext = NULL;
 
@@ -30,7 +35,6 @@ static int sip_uas_process_acl(core *co,struct eXosip_t *context,eXosip_event_t
 static int sip_uas_process_invite(core *co,struct eXosip_t *context,eXosip_event_t *je);
 static int sip_uas_process_terminated(core *co,struct eXosip_t *context,eXosip_event_t *je);
 static int sip_uas_process_other(core *co,struct eXosip_t *context,eXosip_event_t *je);
-static int sdp_message_media_pt_process(core *co,int callid,sdp_message_t *sdp,int pos);
 static int sip_sdp_answer(IN core *co, int callid,INOUT sdp_message_t  *rtsp_sdp,
 	IN rtsp_transport_parse_t *video_transport, IN rtsp_transport_parse_t *audio_transport);
 
@@ -106,107 +110,6 @@ sdp_message_a_attr_value_get_with_pt(sdp_message_t *sdp,
 	return NULL;
 }
 
-static int 
-sdp_message_media_pt_process(core *co,int callid,sdp_message_t *sdp,int pos)
-{
-	int i,tmppt = 0,scanned = 0;
-	char *tmp = NULL;
-	sdp_attribute_t *attr = NULL;
-	char *number = NULL;
-	int pt_new = -1;
-	int pt_old = -1;
-	char pt_str[32] = {0};
-	char *mtype = NULL;
-
-	if(NULL == co || NULL == sdp)
-		return -1;
-	
-	mtype = sdp_message_m_media_get(sdp, pos);
-	if(NULL == mtype)
-		return -1;
-	
-	if(0 == strncasecmp("audio", mtype, strlen("audio"))){
-		core_payload_get(co,callid,stream_audio_rtp,side_sip,NULL,0, &pt_new);
-	}else if(0 == strncasecmp("video", mtype, strlen("video"))){
-		core_payload_get(co,callid,stream_video_rtp,side_sip,NULL,0, &pt_new);
-	}else{
-		return 0;
-	}
-	number = sdp_message_m_payload_get(sdp, pos, 0);
-	if(NULL == number )
-		return -1;
-	pt_old = atoi(number);
-	if(pt_old == pt_new){
-		return 0;
-	}
-	
-	/* m= */
-	snprintf(pt_str, sizeof (pt_str)-1, "%i", pt_new);	
-	log(co,LOG_DEBUG,"meida payload %s=>%s\n", number, pt_str);
-	
-	sdp_message_m_payload_del(sdp,pos,0);
-	sdp_message_m_payload_add(sdp,pos, osip_strdup(pt_str));
-	
-	/* a= */			
-	for(i=0;(attr=sdp_message_attribute_get(sdp,pos,i))!=NULL;i++){
-		if( attr->a_att_value!=NULL){
-			int nb = sscanf(attr->a_att_value,"%i %n",&tmppt,&scanned);
-			/* the return value may depend on how %n is interpreted by the libc:see manpage*/
-			if(nb == 1 || nb == 2 ){
-				if(pt_old == tmppt){ 
-					tmp=attr->a_att_value+scanned;
-					char buff[1024]={0};
-					if(strlen(tmp)>0){
-						snprintf(buff, sizeof(buff)-1, "%i %s", pt_new,tmp);
-						log(co,LOG_DEBUG,"attribute %s %s->%s\n",attr->a_att_field,attr->a_att_value,buff);
-						osip_free(attr->a_att_value);
-						attr->a_att_value = osip_strdup(buff);
-					}
-				}
-			}
-		}
-	}
-	return 0;
-}
-
-static int 
-rtsp_media_process(core *co,int callid,sdp_message_t *rtsp_sdp)
-{
-	int i,j;
-	char *mtype = NULL,*number = NULL;
-
-	if(NULL == co || NULL == rtsp_sdp)
-		return -1;
-
-	for(i = 0; !sdp_message_endof_media(rtsp_sdp,i) ; i++){
-		mtype = sdp_message_m_media_get(rtsp_sdp,i);
-		
-		/* for each payload type */
-		for(j=0;(number=sdp_message_m_payload_get(rtsp_sdp,i,j)) != NULL; j++){
-			char *p = NULL;
-			const char *rtpmap=NULL;
-			char mime_type[64]= {0};
-			int ptn = atoi(number);
-			 
-			/* get the rtpmap associated to this codec, if any */
-			rtpmap = sdp_message_a_attr_value_get_with_pt(rtsp_sdp,i,ptn,"rtpmap");
-			if(NULL != rtpmap) 
-				strncpy(mime_type,rtpmap,sizeof(mime_type)-1);
-			p = strchr(mime_type,'/');
-			if(p)  *p='\0';
-
-			if(0 == strcasecmp("video", mtype)){
-				core_payload_set(co,callid,stream_video_rtp,side_rtsp,mime_type,ptn);
-				break;
-			}else if(0 == strcasecmp("audio", mtype)){
-				core_payload_set(co,callid,stream_audio_rtp,side_rtsp,mime_type,ptn);
-				break;
-			}
-		}
-	}
-	return 0;
-}
-
 static int 
 sip_media_process(core *co,int callid,sdp_message_t *sip_sdp)
 {
@@ -221,9 +124,15 @@ sip_media_process(core *co,int callid,sdp_message_t *sip_sdp)
 	sdp_attribute_t *attr = NULL;
 	stream_dir video_dir = stream_sendrecv;
 	stream_dir audio_dir = stream_sendrecv;
+	int video_mux = 0;
+	int audio_mux = 0;
+	sipcall *call = NULL;
 				
 	if(NULL == co || NULL == sip_sdp )
 		return -1;
+	call = core_sipcall_get(co,callid);
+	if(NULL == call)
+		return -1;
 	
 	c_addr = sdp_message_c_addr_get(sip_sdp, -1, 0);
 	if(c_addr){
@@ -249,18 +158,24 @@ sip_media_process(core *co,int callid,sdp_message_t *sip_sdp)
 					video_dir = stream_recvonly;
 				}else if(strncmp("inactive",attr->a_att_field, strlen("inactive"))==0){
 					video_dir = stream_inactive;
+				}else if(strcmp("rtcp-mux",attr->a_att_field)==0){
+					video_mux = co->rtcp_mux;
 				}
 			}
 
-			/* rtpproxy sip video */
-			sock_pair_create(co,callid,stream_video_rtp,side_sip);
+			/* rtpproxy sip video, a re-INVITE keeps the sockets it has */
+			if(video_mux)
+				sock_mux_create(co,callid,stream_video_rtp);
+			else
+				sock_pair_create(co,callid,stream_video_rtp,side_sip);
+			video_mux = STREAM_MUXED(call->fds,stream_video_rtp);
 			video_port = atoi(med->m_port);
 			if(NULL != conn && NULL != conn->c_addr)
 				snprintf(video_host, sizeof(video_host)-1,"%s",conn->c_addr);
 			core_remote_addr_set(co,callid,stream_video_rtp,side_sip,video_host,0);
 			core_remote_addr_set(co,callid,stream_video_rtcp,side_sip,video_host,0);
 			core_remote_addr_set(co,callid,stream_video_rtp,side_sip,NULL,video_port);
-			core_remote_addr_set(co,callid,stream_video_rtcp,side_sip,NULL,video_port+1);
+			core_remote_addr_set(co,callid,stream_video_rtcp,side_sip,NULL,video_port + (video_mux ? 0 : 1));
 		}else if(0 == strcasecmp("audio", mtype)){
 			for(j = 0;(attr = sdp_message_attribute_get(sip_sdp,i,j))!=NULL;j++){
 				if(strncmp("sendrecv",attr->a_att_field, strlen("sendrecv"))==0){
@@ -271,17 +186,23 @@ sip_media_process(core *co,int callid,sdp_message_t *sip_sdp)
 					audio_dir = stream_recvonly;
 				}else if(strncmp("inactive",attr->a_att_field, strlen("inactive"))==0){
 					audio_dir = stream_inactive;
+				}else if(strcmp("rtcp-mux",attr->a_att_field)==0){
+					audio_mux = co->rtcp_mux;
 				}
 			}
 			/* rtpproxy sip audio */
-			sock_pair_create(co,callid,stream_audio_rtp,side_sip);
+			if(audio_mux)
+				sock_mux_create(co,callid,stream_audio_rtp);
+			else
+				sock_pair_create(co,callid,stream_audio_rtp,side_sip);
+			audio_mux = STREAM_MUXED(call->fds,stream_audio_rtp);
 			audio_port = atoi(med->m_port);
 			if(NULL != conn && NULL != conn->c_addr)
 				snprintf(audio_host, sizeof(audio_host)-1,"%s",conn->c_addr);	
 			core_remote_addr_set(co,callid,stream_audio_rtp,side_sip,audio_host,0);
 			core_remote_addr_set(co,callid,stream_audio_rtcp,side_sip,audio_host,0);
 			core_remote_addr_set(co,callid,stream_audio_rtp,side_sip,NULL,audio_port);
-			core_remote_addr_set(co,callid,stream_audio_rtcp,side_sip,NULL,audio_port+1);
+			core_remote_addr_set(co,callid,stream_audio_rtcp,side_sip,NULL,audio_port + (audio_mux ? 0 : 1));
 		}
 		
 		/* for each payload type */
@@ -346,27 +267,6 @@ sip_media_process(core *co,int callid,sdp_message_t *sip_sdp)
 	return 0;
 }
 
-static int 
-rtpproxy_media_process(core *co,int callid,sdp_message_t *sip_sdp,sdp_message_t *rtsp_sdp)
-{
-	int rtpproxy = 1;
-	
-	if(NULL == co )
-		return 0;
-	
-	rtpproxy = core_rtpproxy_get(co);
-	if( !rtpproxy )
-		return 0;
-
-	/* 1. rtsp */
-	rtsp_media_process(co,callid,rtsp_sdp);
-	
-	/* 2. sip */
-	sip_media_process(co,callid,sip_sdp);
-
-	return 0;
-}
-
 static int 
 sip_sdp_mediainfo_get(core *co,int callid,sdp_message_t *sip_sdp, 
 	OUT char *video_host, IN int video_host_len, OUT int *video_port, 
@@ -452,6 +352,7 @@ sip_sdp_mediainfo_get(core *co,int callid,sdp_message_t *sip_sdp,
 	return 0;
 }
 
+/* no rtpproxy: the caller gets the camera's own addresses */
 static int 
 sip_sdp_answer(IN core *co, IN int callid,INOUT sdp_message_t *rtsp_sdp,
 	IN rtsp_transport_parse_t *video_transport,IN rtsp_transport_parse_t *audio_transport)
@@ -461,237 +362,446 @@ sip_sdp_answer(IN core *co, IN int callid,INOUT sdp_message_t *rtsp_sdp,
 	sdp_media_t *med = NULL;
 	char *mtype = NULL;
 	char tohost[HOST_BUFF_DEFAULT_LEN] = {0};
-	int audio_index = -1;
-	int video_index = -1;
-	sdp_media_t *audio_media = NULL;
-	sdp_media_t *video_media = NULL;
-	int rtpproxy = 1;
-	char *o_addr = NULL;
+	rtsp_transport_parse_t *transport = NULL;
+	camera *cam = NULL;
 
 	if(NULL == co || NULL == rtsp_sdp)
 		return -1;
-	rtpproxy = core_rtpproxy_get(co);
+	cam = camera_of_call(co,callid);
+	if(NULL == cam)
+		return -1;
 	
-	rtsp_url_split(NULL,0,NULL,0,tohost,sizeof(tohost),NULL,NULL,0,co->rtsp_url);
-
-	if(rtpproxy){
-		/* o= */	
-		o_addr = sdp_message_o_addr_get(rtsp_sdp);
-		if(o_addr) {
-			log(co,LOG_DEBUG,"o=%s->%s\n",rtsp_sdp->o_addr,co->sip_localip);
-			osip_free(rtsp_sdp->o_addr);
-		}
-		rtsp_sdp->o_addr = osip_strdup(co->sip_localip);
-
-		/* c= */
-		conn = sdp_message_connection_get(rtsp_sdp, -1, 0);
-		if(conn) {
-			log(co,LOG_DEBUG,"c=%s->%s\n",conn->c_addr,co->sip_localip);
-			osip_free(conn->c_addr);
-			conn->c_addr = osip_strdup(co->sip_localip);
-		}else{
-			log(co,LOG_DEBUG,"add c=%s\n",co->sip_localip);
-			sdp_message_c_connection_add(rtsp_sdp,-1,osip_strdup("IN"),osip_strdup("IP4"),
-				osip_strdup(co->sip_localip), NULL, NULL);
-		}
-	}
+	rtsp_url_split(NULL,0,NULL,0,tohost,sizeof(tohost),NULL,NULL,0,cam->url);
 	
 	/* m= */
 	for(i=0; !sdp_message_endof_media(rtsp_sdp, i) ; i++){
 		mtype = sdp_message_m_media_get(rtsp_sdp, i);
 		conn = sdp_message_connection_get(rtsp_sdp, i, 0);
 		med = osip_list_get(&rtsp_sdp->m_medias, i);
-		if(med != NULL){
+		if(NULL == med)
+			continue;
+		if(strncasecmp("video", mtype, strlen("video")) == 0){
+			transport = video_transport;
+		}else if(strncasecmp("audio", mtype, strlen("audio")) == 0 ){
+			transport = audio_transport;
+		}else{
+			continue;
+		}
+		if(0 == atoi(med->m_port)){
 			char port_str[16]={0};
-			int port = 0;
-			if(strncasecmp("video", mtype, strlen("video")) == 0){
-				video_index = i;
-				video_media = med;
-				if(rtpproxy){ /* rtpproxy */
-					osip_free(med->m_port);
-					core_local_addr_get(co,callid,stream_video_rtp,side_sip,NULL,0,&port);
-					snprintf(port_str, sizeof(port_str)-1, "%i", port);	
-					med->m_port= osip_strdup(port_str); 
-					sdp_message_media_pt_process(co,callid,rtsp_sdp,i);
-
-					if(video_transport->source[0] == '\0'){
-						core_remote_addr_set(co,callid,stream_video_rtp,side_rtsp,tohost,0);
-						core_remote_addr_set(co,callid,stream_video_rtcp,side_rtsp,tohost,0);
-					}else{
-						core_remote_addr_set(co,callid,stream_video_rtp,side_rtsp,video_transport->source,0);
-						core_remote_addr_set(co,callid,stream_video_rtcp,side_rtsp,video_transport->source,0);
-					}
-					core_remote_addr_set(co,callid,stream_video_rtp,side_rtsp,NULL,video_transport->server_port);
-					core_remote_addr_set(co,callid,stream_video_rtcp,side_rtsp,NULL,video_transport->server_port+1);
-						
-					if(NULL != conn){
-						osip_free(conn->c_addr);
-						conn->c_addr = osip_strdup(co->sip_localip);
-					}else{
-						sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(co->sip_localip),NULL,NULL);
-					}
-				}else { /* no rtpproxy */
-					port = atoi(med->m_port);
-					if(0 == port)	{	
-	  					osip_free(med->m_port);
-						snprintf(port_str, sizeof (port_str)-1, "%i", video_transport->server_port);	
-						med->m_port = osip_strdup(port_str);  
-					}
-					if(NULL != conn){
-						osip_free(conn->c_addr);
-						/* live555rtspproxy RTSP_ALLOW_CLIENT_DESTINATION_SETTING */
-						if(video_transport->source[0] != '\0' ) {
-							conn->c_addr = osip_strdup(video_transport->source);
-						}else{ /* camera ? */
-							conn->c_addr = osip_strdup(tohost);
-						}
-					}else{
-						if(video_transport->source[0] != '\0' ){
-							sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(video_transport->source),NULL,NULL);
-						}else{
-							sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(tohost),NULL,NULL);
-						}
-					}	
-				}
-			}
-			if(strncasecmp("audio", mtype, strlen("audio")) == 0 ){
-				audio_index = i;
-				audio_media = med;
-				if(rtpproxy){ /* rtpproxy */
-					osip_free(med->m_port);
-					core_local_addr_get(co,callid,stream_audio_rtp,side_sip,NULL,0,&port);
-					snprintf(port_str, sizeof (port_str)-1, "%i", port);	
-					med->m_port= osip_strdup(port_str);  
-					sdp_message_media_pt_process(co,callid,rtsp_sdp,i);
-					if(audio_transport->source[0] == '\0' ){
-						core_remote_addr_set(co,callid,stream_audio_rtp,side_rtsp,tohost,0);
-						core_remote_addr_set(co,callid,stream_audio_rtcp,side_rtsp,tohost,0);
-					}else{
-						core_remote_addr_set(co,callid,stream_audio_rtp,side_rtsp,audio_transport->source,0);
-						core_remote_addr_set(co,callid,stream_audio_rtcp,side_rtsp,audio_transport->source,0);
-					}
-					core_remote_addr_set(co,callid,stream_audio_rtp,side_rtsp,NULL,audio_transport->server_port);
-					core_remote_addr_set(co,callid,stream_audio_rtcp,side_rtsp,NULL,audio_transport->server_port+1);
-
-					if(NULL != conn){
-						osip_free(conn->c_addr);
-						conn->c_addr = osip_strdup(co->sip_localip);
-					}else{
-						sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(co->sip_localip),NULL,NULL);
-					}
-				}else{ /* no rtpproxy */
-					port = atoi(med->m_port);
-					if(0 == port){
-	  					osip_free(med->m_port);
-						snprintf(port_str, sizeof(port_str)-1, "%i", audio_transport->server_port);		
-						med->m_port= osip_strdup(port_str);  
-					}
-					if(NULL != conn)	{
-						osip_free(conn->c_addr);
-						/* live555rtspproxy RTSP_ALLOW_CLIENT_DESTINATION_SETTING */
-						if(audio_transport->source[0] != '\0' ) {
-							conn->c_addr = osip_strdup(audio_transport->source);
-						}else{ /* camera ? */
-							conn->c_addr = osip_strdup(tohost);
-						}
-					}else{
-						if(audio_transport->source[0] != '\0' ){
-							sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(audio_transport->source),NULL,NULL);
-						}else{
-							sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
-								osip_strdup(tohost),NULL,NULL);
-						}
-					}
-				}
-			}	
-		}
-	}
-
-	/* sip only audio or video */
-	if(rtpproxy){ /* rtpproxy */
-		char video_host[HOST_BUFF_DEFAULT_LEN]={0};
-		char audio_host[HOST_BUFF_DEFAULT_LEN]={0};
-		int video_port = -1;
-		int audio_port = -1;
-		core_remote_addr_get(co,callid,stream_video_rtp,side_sip,video_host,sizeof(video_host),&video_port);
-		core_remote_addr_get(co,callid,stream_audio_rtp,side_sip,audio_host,sizeof(audio_host),&audio_port);
-		if(video_port <= 0 ){/* sip no video */
-			if(video_index >= 0){
-				osip_list_remove(&rtsp_sdp->m_medias,video_index);
-				log(co,LOG_INFO,"sip no video,remove rtsp video=%d\n",video_index);
-				video_index = -1;
+			osip_free(med->m_port);
+			snprintf(port_str, sizeof (port_str)-1, "%i", transport->server_port);	
+			med->m_port = osip_strdup(port_str);  
+		}
+		/* live555rtspproxy RTSP_ALLOW_CLIENT_DESTINATION_SETTING, else the camera */
+		if(NULL != conn){
+			osip_free(conn->c_addr);
+			conn->c_addr = osip_strdup(transport->source[0] != '\0' ? transport->source : tohost);
+		}else{
+			sdp_message_c_connection_add(rtsp_sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
+				osip_strdup(transport->source[0] != '\0' ? transport->source : tohost),NULL,NULL);
+		}
+	}
+	return 0;
+}
+
+/*
+* rtpproxy answer templates, compiled once per camera sdp.
+* every call gets the same text but for its own sip side ports and 
+* payload numbers, which sit in the text as SDP_SLOT_MARK + slot.
+*/
+#define SDP_SLOT_MARK		'\001'
+#define SDP_ANSWER_VARIANTS	16	/* bit0/1: sip has audio/video, bit2/3: muxed */
+#define SDP_ANSWER_AUDIO	1
+#define SDP_ANSWER_VIDEO	2
+#define SDP_ANSWER_AUDIO_MUX	4
+#define SDP_ANSWER_VIDEO_MUX	8
+#define SDP_ANSWER_BUFF_LEN	(2 * RECV_BUFF_DEFAULT_LEN)
+
+typedef enum{
+	slot_audio_port = 0,
+	slot_audio_pt,
+	slot_video_port,
+	slot_video_pt,
+	slot_max,
+}sdp_slot;
+
+typedef struct sip_answer_t {
+	char *rtsp_sdp;		/* camera sdp the texts were built from */
+	char audio_mime[64];
+	int audio_pt;
+	char video_mime[64];
+	int video_pt;
+	char *text[SDP_ANSWER_VARIANTS];
+} sip_answer;
+static sip_answer *answers = NULL;	/* one per camera */
+
+static void 
+sip_answer_clear(sip_answer *ans)
+{
+	int i;
+	
+	osip_free(ans->rtsp_sdp);
+	for(i = 0; i < SDP_ANSWER_VARIANTS; i++) {
+		osip_free(ans->text[i]);
+	}
+	memset(ans,0,sizeof(sip_answer));
+	ans->audio_pt = -1;
+	ans->video_pt = -1;
+}
+
+static void 
+sip_answers_free(core *co)
+{
+	int i;
+	
+	if(NULL == answers)
+		return;
+	for(i = 0; i < camera_count(co); i++) {
+		sip_answer_clear(&answers[i]);
+	}
+	osip_free(answers);
+	answers = NULL;
+}
+
+/* the camera sends the first payload of each media */
+static void 
+sip_answer_payloads(sip_answer *ans,sdp_message_t *rtsp_sdp)
+{
+	int i;
+	char *mtype = NULL,*number = NULL,*p = NULL;
+	const char *rtpmap = NULL;
+	char mime_type[64] = {0};
+	
+	for(i = 0; !sdp_message_endof_media(rtsp_sdp,i) ; i++){
+		mtype = sdp_message_m_media_get(rtsp_sdp,i);
+		number = sdp_message_m_payload_get(rtsp_sdp,i,0);
+		if(NULL == mtype || NULL == number)
+			continue;
+		memset(mime_type,0,sizeof(mime_type));
+		rtpmap = sdp_message_a_attr_value_get_with_pt(rtsp_sdp,i,atoi(number),"rtpmap");
+		if(NULL != rtpmap) 
+			strncpy(mime_type,rtpmap,sizeof(mime_type)-1);
+		p = strchr(mime_type,'/');
+		if(p)  *p='\0';
+		if(0 == strcasecmp("video", mtype)){
+			strcpy(ans->video_mime,mime_type);
+			ans->video_pt = atoi(number);
+		}else if(0 == strcasecmp("audio", mtype)){
+			strcpy(ans->audio_mime,mime_type);
+			ans->audio_pt = atoi(number);
+		}
+	}
+}
+
+static char *
+sip_slot_str(sdp_slot slot,const char *rest)
+{
+	char buff[1024] = {0};
+	
+	snprintf(buff,sizeof(buff)-1,"%c%c%s%s",SDP_SLOT_MARK,'0'+slot,
+		NULL == rest ? "" : " ",NULL == rest ? "" : rest);
+	return osip_strdup(buff);
+}
+
+/* payload number of media pos => slot, in m= and in its a= lines */
+static void 
+sip_answer_pt_slot(sdp_message_t *sdp,int pos,sdp_slot slot)
+{
+	int i,tmppt = 0,scanned = 0,pt_old = -1;
+	sdp_attribute_t *attr = NULL;
+	char *number = NULL;
+	
+	number = sdp_message_m_payload_get(sdp, pos, 0);
+	if(NULL == number )
+		return;
+	pt_old = atoi(number);
+	sdp_message_m_payload_del(sdp,pos,0);
+	sdp_message_m_payload_add(sdp,pos,sip_slot_str(slot,NULL));
+	
+	for(i=0;(attr=sdp_message_attribute_get(sdp,pos,i))!=NULL;i++){
+		if( attr->a_att_value!=NULL){
+			int nb = sscanf(attr->a_att_value,"%i %n",&tmppt,&scanned);
+			/* the return value may depend on how %n is interpreted by the libc:see manpage*/
+			if((nb == 1 || nb == 2) && pt_old == tmppt && strlen(attr->a_att_value+scanned) > 0){
+				char *value = sip_slot_str(slot,attr->a_att_value+scanned);
+				osip_free(attr->a_att_value);
+				attr->a_att_value = value;
 			}
 		}
-		if(audio_port <= 0){/* sip no audio */
-			if(audio_index >= 0){
-				osip_list_remove(&rtsp_sdp->m_medias,audio_index);
-				log(co,LOG_INFO,"sip no audio,remove rtsp audio=%d\n",audio_index);	
-				audio_index = -1;
+	}
+}
+
+/* one variant: sip side addresses, slots, sip-less media dropped, audio first */
+static char *
+sip_answer_compile(core *co,const char *rtsp_sdp_str,int variant)
+{
+	sdp_message_t *sdp = NULL;
+	sdp_connection_t *conn = NULL;
+	sdp_media_t *med = NULL;
+	sdp_media_t *audio_media = NULL;
+	int audio_index = -1;
+	int video_index = -1;
+	char *mtype = NULL;
+	char *text = NULL;
+	int i;
+	
+	sdp_message_init(&sdp);
+	if(NULL == sdp)
+		return NULL;
+	if(0 != sdp_message_parse(sdp,rtsp_sdp_str)){
+		sdp_message_free(sdp);
+		return NULL;
+	}
+	
+	/* o= c= */
+	osip_free(sdp->o_addr);
+	sdp->o_addr = osip_strdup(co->sip_localip);
+	conn = sdp_message_connection_get(sdp, -1, 0);
+	if(conn) {
+		osip_free(conn->c_addr);
+		conn->c_addr = osip_strdup(co->sip_localip);
+	}else{
+		sdp_message_c_connection_add(sdp,-1,osip_strdup("IN"),osip_strdup("IP4"),
+			osip_strdup(co->sip_localip), NULL, NULL);
+	}
+	
+	/* m= */
+	for(i=0; !sdp_message_endof_media(sdp, i) ; ){
+		mtype = sdp_message_m_media_get(sdp, i);
+		med = osip_list_get(&sdp->m_medias, i);
+		if(0 == strncasecmp("video", mtype, strlen("video"))){
+			if(!(variant & SDP_ANSWER_VIDEO)){
+				osip_list_remove(&sdp->m_medias,i);
+				sdp_media_free(med);
+				continue;
+			}
+			osip_free(med->m_port);
+			med->m_port = sip_slot_str(slot_video_port,NULL);
+			sip_answer_pt_slot(sdp,i,slot_video_pt);
+			if(variant & SDP_ANSWER_VIDEO_MUX)
+				sdp_message_a_attribute_add(sdp,i,osip_strdup("rtcp-mux"),NULL);
+			video_index = i;
+		}else if(0 == strncasecmp("audio", mtype, strlen("audio"))){
+			if(!(variant & SDP_ANSWER_AUDIO)){
+				osip_list_remove(&sdp->m_medias,i);
+				sdp_media_free(med);
+				continue;
 			}
+			osip_free(med->m_port);
+			med->m_port = sip_slot_str(slot_audio_port,NULL);
+			sip_answer_pt_slot(sdp,i,slot_audio_pt);
+			if(variant & SDP_ANSWER_AUDIO_MUX)
+				sdp_message_a_attribute_add(sdp,i,osip_strdup("rtcp-mux"),NULL);
+			audio_index = i;
+			audio_media = med;
 		}
-		
-		/* audio before video */
-		if(video_index >= 0 && audio_index >=0 && video_index < audio_index ){
-			log(co,LOG_INFO,"video=%d(%p) before audio=%d(%p),reverse!\n",
-				video_index,video_media,audio_index,audio_media);	
-			osip_list_remove(&rtsp_sdp->m_medias,audio_index);
-			osip_list_add(&rtsp_sdp->m_medias,audio_media, 0);
+		conn = sdp_message_connection_get(sdp, i, 0);
+		if(NULL != conn){
+			osip_free(conn->c_addr);
+			conn->c_addr = osip_strdup(co->sip_localip);
+		}else{
+			sdp_message_c_connection_add(sdp,i,osip_strdup("IN"),osip_strdup("IP4"),
+				osip_strdup(co->sip_localip),NULL,NULL);
 		}
+		i++;
 	}
 	
-	return 0;
+	/* audio before video */
+	if(video_index >= 0 && audio_index >= 0 && video_index < audio_index){
+		osip_list_remove(&sdp->m_medias,audio_index);
+		osip_list_add(&sdp->m_medias,audio_media,0);
+	}
+	sdp_message_to_str(sdp,&text);
+	sdp_message_free(sdp);
+	return text;
 }
 
+/* templates of cam, rebuilt only when the camera sdp changed */
+static sip_answer *
+sip_answer_get(core *co,camera *cam,const char *rtsp_sdp_str)
+{
+	sip_answer *ans = NULL;
+	sdp_message_t *sdp = NULL;
+	int i;
+	
+	if(NULL == answers){
+		answers = (sip_answer *)osip_malloc(sizeof(sip_answer) * camera_count(co));
+		if(NULL == answers)
+			return NULL;
+		memset(answers,0,sizeof(sip_answer) * camera_count(co));
+	}
+	ans = &answers[cam->index];
+	if(NULL != ans->rtsp_sdp && 0 == strcmp(ans->rtsp_sdp,rtsp_sdp_str))
+		return ans;
+	
+	sip_answer_clear(ans);
+	sdp_message_init(&sdp);
+	if(NULL == sdp || 0 != sdp_message_parse(sdp,rtsp_sdp_str)){
+		log(co,LOG_ERR,"camera(%d) rtsp sdp parse failed\n",cam->index);
+		sdp_message_free(sdp);
+		return NULL;
+	}
+	sip_answer_payloads(ans,sdp);
+	sdp_message_free(sdp);
+	for(i = 0; i < SDP_ANSWER_VARIANTS; i++) {
+		ans->text[i] = sip_answer_compile(co,rtsp_sdp_str,i);
+		if(NULL == ans->text[i]){
+			sip_answer_clear(ans);
+			return NULL;
+		}
+	}
+	ans->rtsp_sdp = osip_strdup(rtsp_sdp_str);
+	log(co,LOG_DEBUG,"camera(%d) sip answer templates built\n",cam->index);
+	return ans;
+}
+
+/* per call: only the slots of the template are filled, no allocation */
 static int 
-sip_uas_process_invite(core *co,struct eXosip_t *context,eXosip_event_t *je)
+sip_answer_fill(core *co,int callid,sip_answer *ans,char *buff,int len)
+{
+	int slot[slot_max];
+	int variant = 0;
+	int port = -1;
+	const char *p = NULL;
+	int n = 0;
+	int ret;
+	sipcall *call = core_sipcall_get(co,callid);
+	
+	if(NULL == call)
+		return -1;
+	core_remote_addr_get(co,callid,stream_audio_rtp,side_sip,NULL,0,&port);
+	if(port > 0)  variant |= SDP_ANSWER_AUDIO;
+	port = -1;
+	core_remote_addr_get(co,callid,stream_video_rtp,side_sip,NULL,0,&port);
+	if(port > 0)  variant |= SDP_ANSWER_VIDEO;
+	if(STREAM_MUXED(call->fds,stream_audio_rtp))  variant |= SDP_ANSWER_AUDIO_MUX;
+	if(STREAM_MUXED(call->fds,stream_video_rtp))  variant |= SDP_ANSWER_VIDEO_MUX;
+	
+	core_local_addr_get(co,callid,stream_audio_rtp,side_sip,NULL,0,&slot[slot_audio_port]);
+	core_local_addr_get(co,callid,stream_video_rtp,side_sip,NULL,0,&slot[slot_video_port]);
+	slot[slot_audio_pt] = -1;
+	slot[slot_video_pt] = -1;
+	core_payload_get(co,callid,stream_audio_rtp,side_sip,NULL,0,&slot[slot_audio_pt]);
+	core_payload_get(co,callid,stream_video_rtp,side_sip,NULL,0,&slot[slot_video_pt]);
+	if(slot[slot_audio_pt] < 0)  slot[slot_audio_pt] = ans->audio_pt;
+	if(slot[slot_video_pt] < 0)  slot[slot_video_pt] = ans->video_pt;
+
+	for(p = ans->text[variant]; '\0' != *p && n < len-1; p++) {
+		if(SDP_SLOT_MARK != *p){
+			buff[n++] = *p;
+			continue;
+		}
+		p++;
+		if(*p < '0' || *p >= '0'+slot_max)
+			return -1;
+		ret = snprintf(buff+n,len-n,"%d",slot[*p-'0']);
+		if(ret < 0 || ret >= len-n)
+			return -1;
+		n += ret;
+	}
+	buff[n] = '\0';
+	return '\0' == *p ? n : -1;
+}
+
+/* camera side of the call: payloads from the template, addresses from SETUP */
+static void 
+sip_rtsp_media_set(core *co,int callid,camera *cam,sip_answer *ans,
+	rtsp_transport_parse_t *video_transport,rtsp_transport_parse_t *audio_transport)
+{
+	char tohost[HOST_BUFF_DEFAULT_LEN] = {0};
+	
+	rtsp_url_split(NULL,0,NULL,0,tohost,sizeof(tohost),NULL,NULL,0,cam->url);
+	if(ans->video_pt >= 0){
+		core_payload_set(co,callid,stream_video_rtp,side_rtsp,ans->video_mime,ans->video_pt);
+		core_remote_addr_set(co,callid,stream_video_rtp,side_rtsp,
+			video_transport->source[0] != '\0' ? video_transport->source : tohost,0);
+		core_remote_addr_set(co,callid,stream_video_rtcp,side_rtsp,
+			video_transport->source[0] != '\0' ? video_transport->source : tohost,0);
+		core_remote_addr_set(co,callid,stream_video_rtp,side_rtsp,NULL,video_transport->server_port);
+		core_remote_addr_set(co,callid,stream_video_rtcp,side_rtsp,NULL,
+			video_transport->server_port + (video_transport->have_rtcp_mux ? 0 : 1));
+	}
+	if(ans->audio_pt >= 0){
+		core_payload_set(co,callid,stream_audio_rtp,side_rtsp,ans->audio_mime,ans->audio_pt);
+		core_remote_addr_set(co,callid,stream_audio_rtp,side_rtsp,
+			audio_transport->source[0] != '\0' ? audio_transport->source : tohost,0);
+		core_remote_addr_set(co,callid,stream_audio_rtcp,side_rtsp,
+			audio_transport->source[0] != '\0' ? audio_transport->source : tohost,0);
+		core_remote_addr_set(co,callid,stream_audio_rtp,side_rtsp,NULL,audio_transport->server_port);
+		core_remote_addr_set(co,callid,stream_audio_rtcp,side_rtsp,NULL,
+			audio_transport->server_port + (audio_transport->have_rtcp_mux ? 0 : 1));
+	}
+}
+
+/* INVITEs waiting for their camera's rtsp session */
+typedef struct sip_pending_t {
+	int callid;
+	int tid;
+	sdp_message_t *offer;
+	struct sip_pending_t *next;
+} sip_pending;
+static sip_pending *pending = NULL;
+
+static void 
+sip_uas_answer(core *co,struct eXosip_t *context,int tid,int status,char *sdp_answer)
 {
-	int ret = 0;
-	int status = 603;
 	osip_message_t *answer = NULL;
-	sdp_message_t  *sip_sdp = NULL;
+	
+	eXosip_lock(context);
+	eXosip_call_build_answer(context,tid,status,&answer);
+	if(answer){
+		if( NULL != sdp_answer){
+			osip_message_set_body(answer, sdp_answer, strlen(sdp_answer));
+			osip_message_set_content_type(answer, "application/sdp");
+		}
+		eXosip_call_send_answer(context,tid,status,answer);
+		log(co,LOG_NOTICE,"<--sip response %d\n%s\n",status,sdp_answer==NULL?"":sdp_answer);
+	}
+	eXosip_unlock(context);
+}
+
+/* answer one pending INVITE from the ready rtsp session of cam */
+static int 
+sip_uas_answer_pending(core *co,camera *cam,sip_pending *p)
+{
+	int ret = 0;
+	int status = 503;
 	sdp_message_t  *rtsp_sdp = NULL;
-	int video_port = 0;
-	int audio_port = 0;
-	char video_host[HOST_BUFF_DEFAULT_LEN] = {0};
-	char audio_host[HOST_BUFF_DEFAULT_LEN] = {0};
 	char rtsp_sdp_buff[RECV_BUFF_DEFAULT_LEN] = {0};
-	char *sdp_offer = NULL;
+	char answer_buff[SDP_ANSWER_BUFF_LEN] = {0};
 	char *sdp_answer = NULL;
+	sip_answer *ans = NULL;
 	rtsp_transport_parse_t video_transport;
 	rtsp_transport_parse_t audio_transport;
-	int callid = -1;
 
 	memset(&video_transport,0,sizeof(video_transport));
 	memset(&audio_transport,0,sizeof(audio_transport));
 	
-	/* sip request */ 
-	eXosip_lock(context);
-	sip_sdp = eXosip_get_remote_sdp(context,je->did);
-	callid = je->cid;
-	eXosip_unlock(context);
-	if( NULL == sip_sdp) {
-		goto go_out;
-	}
-	
-	sdp_message_to_str(sip_sdp,&sdp_offer);	
-	log(co,LOG_NOTICE, "-->sip invite\n%s\n",sdp_offer);
-	
-	sip_sdp_mediainfo_get(co,callid,sip_sdp,video_host,sizeof(video_host)-1,&video_port,
-		audio_host,sizeof(audio_host)-1,&audio_port);
-
-	/* rtsp request & response */
-	ret = rtsp_open(co,callid,video_host,video_port,audio_host,audio_port, 
-		&video_transport,&audio_transport,rtsp_sdp_buff,sizeof(rtsp_sdp_buff),&status);
+	ret = rtsp_session_get(cam,rtsp_sdp_buff,sizeof(rtsp_sdp_buff)-1,
+		&video_transport,&audio_transport);
 	if(0 != ret ){
 		goto go_out;
 	}
 
-	/* sip response */
+	if(core_rtpproxy_get(co)){
+		/* camera sdp => template, sip offer => slots */
+		ans = sip_answer_get(co,cam,rtsp_sdp_buff);
+		if(NULL == ans){
+			goto go_out;
+		}
+		sip_rtsp_media_set(co,p->callid,cam,ans,&video_transport,&audio_transport);
+		sip_media_process(co,p->callid,p->offer);
+		if(sip_answer_fill(co,p->callid,ans,answer_buff,sizeof(answer_buff)) < 0){
+			log(co,LOG_ERR,"call(%d) sip answer too long\n",p->callid);
+			goto go_out;
+		}
+		stream_call_update(co,p->callid);
+		sip_uas_answer(co,excontext,p->tid,200,answer_buff);
+		return 0;
+	}
+	
+	/* no rtpproxy: camera sdp with the camera's addresses */
 	sdp_message_init(&rtsp_sdp);
 	if( NULL == rtsp_sdp ) {
 		goto go_out;
@@ -701,46 +811,141 @@ sip_uas_process_invite(core *co,struct eXosip_t *context,eXosip_event_t *je)
 		log(co,LOG_ERR, "rtsp_sdp parse ret=%d\n",ret);
 		goto go_out;
 	}
-
-	/* set ip/port/payload */
-	rtpproxy_media_process(co,callid,sip_sdp,rtsp_sdp);
-
-	/* replace ip/port/payload */
-	sip_sdp_answer(co,callid,rtsp_sdp,&video_transport,&audio_transport);
-
+	sip_sdp_answer(co,p->callid,rtsp_sdp,&video_transport,&audio_transport);
 	sdp_message_to_str(rtsp_sdp,&sdp_answer);
 	status = 200;
 	
 go_out:
 	sdp_message_free(rtsp_sdp);
-	sdp_message_free(sip_sdp);
-	answer = NULL;
-	eXosip_lock(context);
-	eXosip_call_build_answer(context,je->tid,status,&answer);
-	if(answer){
-		if( NULL != sdp_answer){
-			osip_message_set_body(answer, sdp_answer, strlen(sdp_answer));
-			osip_message_set_content_type(answer, "application/sdp");
+	sip_uas_answer(co,excontext,p->tid,status,sdp_answer);
+	osip_free(sdp_answer);
+	return status == 200 ? 0 : -1;
+}
+
+/* rtsp_open completion: answer every INVITE waiting on cam */
+static void 
+sip_rtsp_opened(core *co,camera *cam,int status)
+{
+	sip_pending **pp = &pending;
+	sip_pending *p = NULL;
+	int play = 0;
+	
+	while( NULL != (p = *pp) ){
+		if( camera_of_call(co,p->callid) != cam ){
+			pp = &p->next;
+			continue;
 		}
-		eXosip_call_send_answer(context,je->tid,status,answer);
-		log(co,LOG_NOTICE,"<--sip response %d\n%s\n",status,sdp_answer==NULL?"":sdp_answer);
-		
+		*pp = p->next;
+		if( 200 == status ){
+			if( 0 == sip_uas_answer_pending(co,cam,p) )
+				play = 1;
+		}else{
+			sip_uas_answer(co,excontext,p->tid,status,NULL);
+		}
+		sdp_message_free(p->offer);
+		osip_free(p);
+	}
+	if( play ){
+		rtsp_play(co,cam);
+		core_show(co);
+	}
+}
+
+/* a call gone before its answer: its INVITE is no longer waiting on the camera */
+void 
+sip_pending_remove(int callid)
+{
+	sip_pending **pp = &pending;
+	sip_pending *p = NULL;
+	
+	while( NULL != (p = *pp) ){
+		if( p->callid != callid ){
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		sdp_message_free(p->offer);
+		osip_free(p);
 	}
+}
+
+/* 
+* check the offer and start the camera's rtsp session, the INVITE is 
+* answered from sip_rtsp_opened once the session is ready.
+*/
+static int 
+sip_uas_process_invite(core *co,struct eXosip_t *context,eXosip_event_t *je)
+{
+	int status = 603;
+	sdp_message_t  *sip_sdp = NULL;
+	int video_port = 0;
+	int audio_port = 0;
+	char video_host[HOST_BUFF_DEFAULT_LEN] = {0};
+	char audio_host[HOST_BUFF_DEFAULT_LEN] = {0};
+	char *sdp_offer = NULL;
+	int callid = -1;
+	camera *cam = NULL;
+	sip_pending *p = NULL;
+
+	/* sip request */ 
+	eXosip_lock(context);
+	sip_sdp = eXosip_get_remote_sdp(context,je->did);
+	callid = je->cid;
 	eXosip_unlock(context);
-	osip_free(sdp_answer);
+	if( NULL == sip_sdp) {
+		goto go_out;
+	}
+	
+	sdp_message_to_str(sip_sdp,&sdp_offer);	
+	log(co,LOG_NOTICE, "-->sip invite\n%s\n",sdp_offer);
 	osip_free(sdp_offer);
-	return status == 200 ? 0 : -1;
+
+	/* camera: request-uri user, a reinvite keeps the camera of the call */
+	cam = camera_of_call(co,callid);
+	if(NULL == cam && NULL != je->request && NULL != je->request->req_uri){
+		cam = camera_find(co,je->request->req_uri->username,je->request->req_uri->host);
+	}
+	if(NULL == cam || 0 != camera_call_join(co,callid,cam)){
+		log(co,LOG_NOTICE,"call(%d) no camera for this request-uri\n",callid);
+		status = 404;
+		goto go_out;
+	}
+	if(0 != stream_camera_start(co,callid)){
+		status = 503;
+		goto go_out;
+	}
+	
+	sip_sdp_mediainfo_get(co,callid,sip_sdp,video_host,sizeof(video_host)-1,&video_port,
+		audio_host,sizeof(audio_host)-1,&audio_port);
+
+	p = (sip_pending *)osip_malloc(sizeof(sip_pending));
+	if( NULL == p ){
+		status = 503;
+		goto go_out;
+	}
+	sip_pending_remove(callid);
+	p->callid = callid;
+	p->tid = je->tid;
+	p->offer = sip_sdp;
+	p->next = pending;
+	pending = p;
+
+	/* rtsp request, answered from sip_rtsp_opened */
+	rtsp_open(co,cam,video_host,video_port,audio_host,audio_port,sip_rtsp_opened);
+	return 0;
+	
+go_out:
+	sdp_message_free(sip_sdp);
+	sip_uas_answer(co,context,je->tid,status,NULL);
+	return -1;
 }
 
 static int 
 sip_uas_process_terminated(core *co,struct eXosip_t *context,eXosip_event_t *je)
 {
-	int callnum = -1;
+	/* the last call on a camera stops it */
+	sip_pending_remove(je->cid);
 	core_sipcall_release(co,je->cid);
-	callnum = core_sipcallnum_get(co);
-	if(callnum <= 0 ){
-		rtsp_stop(co);
-	}
 	return 0;
 }
 
@@ -792,6 +997,12 @@ sip_init(core *co)
 		return ret;
 	}
 	
+	co->epfd = epoll_create(SIP_EPOLL_EVENTS);
+	if( co->epfd < 0 ){
+		log(co,LOG_ERR, "epoll_create failed:%s\n",strerror(errno));
+		return -1;
+	}
+	
 	excontext = eXosip_malloc();
 	if( NULL == excontext ){
 		log(co,LOG_ERR, "eXosip_malloc failed\n");
@@ -870,74 +1081,112 @@ try_bind:
 	return 0;
 }
 
+static void 
+sip_uas_event(core *co,eXosip_event_t *je)
+{
+	int ret;
+	
+	log(co,LOG_INFO,"sip(%d-%d-%d-%d) %d(%s)\n",
+		je->cid,je->did,je->tid,je->rid,je->type,je->textinfo);
+		
+	eXosip_lock(excontext);
+	eXosip_automatic_action(excontext);
+	eXosip_unlock(excontext);
+	
+	switch(je->type) {
+	case EXOSIP_REGISTRATION_SUCCESS:
+		break;
+	case EXOSIP_REGISTRATION_FAILURE:
+		break;
+	case EXOSIP_CALL_ACK:
+		break;
+	case EXOSIP_CALL_CLOSED:
+	case EXOSIP_CALL_CANCELLED:
+	case EXOSIP_CALL_RELEASED:	
+		sip_uas_process_terminated(co,excontext,je);
+		core_show(co);
+		break;
+	case EXOSIP_CALL_INVITE:
+		ret = sip_uas_process_acl(co,excontext,je);
+		if(0 != ret) 	break;
+		ret = sip_uas_process_calls(co,excontext,je);
+		if(0 != ret) 	break;
+		sip_uas_process_invite(co,excontext,je);
+		break;
+	case EXOSIP_CALL_REINVITE:	
+		sip_uas_process_invite(co,excontext,je);
+		break;
+	case EXOSIP_CALL_MESSAGE_NEW:
+	case EXOSIP_MESSAGE_NEW:
+	case EXOSIP_IN_SUBSCRIPTION_NEW:
+	case EXOSIP_SUBSCRIPTION_NOTIFY:
+		sip_uas_process_other(co,excontext,je);
+		break;
+	default:
+		log(co,LOG_DEBUG, "recieved unknown sip event\n");
+		break;
+	}
+}
+
+/*
+* one reactor for signaling: the eXosip event socket and every rtsp 
+* control connection, media is relayed by its own thread.
+*/
 int 
 sip_uas_loop(core *co)
 {
-	int ret;
+	int i, n;
 	eXosip_event_t *je = NULL;
+	struct epoll_event ev;
+	struct epoll_event events[SIP_EPOLL_EVENTS];
+	time_t last = 0;
+	time_t now = 0;
+	
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	if( epoll_ctl(co->epfd,EPOLL_CTL_ADD,eXosip_event_geteventsocket(excontext),&ev) < 0 ){
+		log(co,LOG_ERR,"sip event socket epoll_ctl failed:%s\n",strerror(errno));
+		return -1;
+	}
 	
 	for(;;) {
-		if(!(je = eXosip_event_wait(excontext,0,0))) {
-			
+		n = epoll_wait(co->epfd,events,SIP_EPOLL_EVENTS,50);
+		if( n < 0 && EINTR != errno ){
+			log(co,LOG_ERR,"sip epoll_wait failed:%s\n",strerror(errno));
+			break;
+		}
+		for(i = 0; i < n; i++) {
+			if( STATS_IO_IS(events[i].data.u64) )
+				stats_io(co,events[i].data.u64,events[i].events);
+			else if( 0 != events[i].data.u64 )
+				rtsp_io(co,events[i].data.u64,events[i].events);
+		}
+		
+		/* the event socket only wakes us, drain everything queued */
+		while( NULL != (je = eXosip_event_wait(excontext,0,0)) ){
+			sip_uas_event(co,je);
+			eXosip_event_free(je);
+		}
+		
+		/* answers are out, bind what call setup took from the pool */
+		if( co->rtpproxy )
+			stream_prebind_refill(co);
+		
+		now = time(NULL);
+		if( now != last ){
+			last = now;
 			eXosip_lock(excontext);
 			eXosip_automatic_refresh(excontext); /* auto send register */
 			eXosip_unlock(excontext);	
 
-			streams_loop(co);
 			rtsp_automatic_action(co);	
-			continue;
+			camera_automatic_action(co);
+			stats_automatic_action(co);
 		}
-		log(co,LOG_INFO,"sip(%d-%d-%d-%d) %d(%s)\n",
-			je->cid,je->did,je->tid,je->rid,je->type,je->textinfo);
-			
-		eXosip_lock(excontext);
-		eXosip_automatic_action(excontext);
-		eXosip_unlock(excontext);
-		
-		switch(je->type) {
-		case EXOSIP_REGISTRATION_SUCCESS:
-			break;
-		case EXOSIP_REGISTRATION_FAILURE:
-			break;
-		case EXOSIP_CALL_ACK:
-			break;
-		case EXOSIP_CALL_CLOSED:
-		case EXOSIP_CALL_CANCELLED:
-		case EXOSIP_CALL_RELEASED:	
-			sip_uas_process_terminated(co,excontext,je);
-			core_show(co);
-			break;
-		case EXOSIP_CALL_INVITE:
-			ret = sip_uas_process_acl(co,excontext,je);
-			if(0 != ret) 	break;
-			ret = sip_uas_process_calls(co,excontext,je);
-			if(0 != ret) 	break;
-			ret = sip_uas_process_invite(co,excontext,je);
-			if(0 != ret) 	break;
-			rtsp_play(co);
-			core_show(co);
-			break;
-		case EXOSIP_CALL_REINVITE:	
-			ret = sip_uas_process_invite(co,excontext,je);
-			if( 0 == ret ){
-				rtsp_play(co);
-				core_show(co);
-			}	
-			break;
-		case EXOSIP_CALL_MESSAGE_NEW:
-		case EXOSIP_MESSAGE_NEW:
-		case EXOSIP_IN_SUBSCRIPTION_NEW:
-		case EXOSIP_SUBSCRIPTION_NOTIFY:
-			sip_uas_process_other(co,excontext,je);
-			break;
-		default:
-			log(co,LOG_DEBUG, "recieved unknown sip event\n");
-			break;
-		}
-		eXosip_event_free(je);
 	}
+	sip_answers_free(co);
 	eXosip_quit(excontext);
 	
 	return 0;
 }
-
@@ -29,6 +29,7 @@ extern "C" {
 
 int 	sip_init(core *co);
 int 	sip_uas_loop(core *co);
+void 	sip_pending_remove(int callid);
 	
 #ifdef __cplusplus
 }
@@ -0,0 +1,375 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include "rtsp_client.h"
+#include "rtpproxy.h"
+#include "camera.h"
+#include "stats.h"
+#include "log.h"
+
+#define STATS_UNIX_PREFIX	"unix:"
+#define STATS_BUFF_LEN		(16 * 1024)
+#define STATS_REQ_LEN		(1024)
+#define STATS_TIMEOUT_SECS	(5)		/* a scrape not done by then is closed */
+
+/*
+* [stats] listen=127.0.0.1:9464 or unix:/path, prometheus text format
+* over plain http. scrapes are non-blocking connections of the signaling
+* reactor: the request is read as it comes, the answer written on EPOLLOUT.
+*/
+
+/* one scrape in progress, fd -1: free */
+typedef struct stats_conn_t {
+	int fd;
+	time_t start;
+	char req[STATS_REQ_LEN];
+	size_t rlen;
+	char *out;		/* NULL while the request is read */
+	size_t olen;
+	size_t off;
+} stats_conn;
+
+static stats_conn conns[STATS_CONNS];
+
+int
+stats_printf(stats_buf *sb,const char *format,...)
+{
+	va_list ap;
+	char *data = NULL;
+	size_t want = 256;
+	int n;
+
+	for(;;) {
+		if(NULL == sb->data || sb->size - sb->len < want){
+			want = want > STATS_BUFF_LEN ? want : STATS_BUFF_LEN;
+			data = (char *)osip_realloc(sb->data,sb->size + want);
+			if(NULL == data)
+				return -1;
+			sb->data = data;
+			sb->size += want;
+		}
+		va_start(ap,format);
+		n = vsnprintf(sb->data + sb->len,sb->size - sb->len,format,ap);
+		va_end(ap);
+		if(n < 0)
+			return -1;
+		if((size_t)n < sb->size - sb->len){
+			sb->len += n;
+			return n;
+		}
+		want = n + 1;	/* longer than what is left, grow and retry */
+	}
+}
+
+static int
+stats_listen_inet(core *co,const char *listen_addr)
+{
+	struct sockaddr_in addr;
+	char host[HOST_BUFF_DEFAULT_LEN] = {0};
+	const char *colon = strrchr(listen_addr,':');
+	int sock = -1;
+	int on = 1;
+
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	if(NULL == colon){
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(atoi(listen_addr));
+	}else{
+		snprintf(host,sizeof(host),"%.*s",(int)(colon - listen_addr),listen_addr);
+		addr.sin_addr.s_addr = '\0' == host[0] ? htonl(INADDR_LOOPBACK) : inet_addr(host);
+		addr.sin_port = htons(atoi(colon + 1));
+	}
+	sock = socket(AF_INET,SOCK_STREAM,0);
+	if(sock < 0)
+		return -1;
+	setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	if(bind(sock,(struct sockaddr *)&addr,sizeof(addr)) < 0){
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int
+stats_listen_unix(core *co,const char *path)
+{
+	struct sockaddr_un addr;
+	int sock = -1;
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path,path);
+	sock = socket(AF_UNIX,SOCK_STREAM,0);
+	if(sock < 0)
+		return -1;
+	unlink(path);	/* left over by a previous run */
+	if(bind(sock,(struct sockaddr *)&addr,sizeof(addr)) < 0){
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static void
+stats_conn_close(core *co,stats_conn *conn)
+{
+	epoll_ctl(co->epfd,EPOLL_CTL_DEL,conn->fd,NULL);
+	close(conn->fd);
+	osip_free(conn->out);
+	conn->out = NULL;
+	conn->fd = -1;
+}
+
+int
+stats_init(core *co)
+{
+	struct epoll_event ev;
+	const char *listen_addr = co->stats_listen;
+	int sock = -1;
+	int k;
+
+	co->stats_fd = -1;
+	for(k = 0; k < STATS_CONNS; k++) {
+		conns[k].fd = -1;
+	}
+	if(NULL == listen_addr || '\0' == *listen_addr)
+		return 0;
+	if(0 == strncmp(listen_addr,STATS_UNIX_PREFIX,strlen(STATS_UNIX_PREFIX))){
+		sock = stats_listen_unix(co,listen_addr + strlen(STATS_UNIX_PREFIX));
+	}else{
+		sock = stats_listen_inet(co,listen_addr);
+	}
+	if(sock < 0 || listen(sock,8) < 0){
+		log(co,LOG_ERR,"stats listen %s failed:%s\n",listen_addr,strerror(errno));
+		if(sock >= 0)  close(sock);
+		return -1;
+	}
+	sock_noblocking_set(sock);
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = STATS_IO_KEY;
+	if(epoll_ctl(co->epfd,EPOLL_CTL_ADD,sock,&ev) < 0){
+		log(co,LOG_ERR,"stats epoll_ctl failed:%s\n",strerror(errno));
+		close(sock);
+		return -1;
+	}
+	co->stats_fd = sock;
+	log(co,LOG_INFO,"stats on %s\n",listen_addr);
+	return 0;
+}
+
+void
+stats_exit(core *co)
+{
+	const char *listen_addr = co->stats_listen;
+	int k;
+
+	if(co->stats_fd < 0)
+		return;
+	for(k = 0; k < STATS_CONNS; k++) {
+		if(conns[k].fd >= 0)
+			stats_conn_close(co,&conns[k]);
+	}
+	close(co->stats_fd);
+	co->stats_fd = -1;
+	if(0 == strncmp(listen_addr,STATS_UNIX_PREFIX,strlen(STATS_UNIX_PREFIX)))
+		unlink(listen_addr + strlen(STATS_UNIX_PREFIX));
+}
+
+/* what the signaling thread knows: calls and rtsp sessions */
+static void
+stats_render_cameras(core *co,stats_buf *sb)
+{
+	camera *cam = NULL;
+	int c;
+
+	stats_printf(sb,"# HELP sip2rtsp_calls Active sip calls.\n"
+		"# TYPE sip2rtsp_calls gauge\n"
+		"sip2rtsp_calls %d\n",core_sipcallnum_get(co));
+	stats_printf(sb,"# HELP sip2rtsp_log_dropped_total Log lines lost to a full log ring.\n"
+		"# TYPE sip2rtsp_log_dropped_total counter\n"
+		"sip2rtsp_log_dropped_total %lu\n",log_dropped(co));
+	stats_printf(sb,"# HELP sip2rtsp_camera_up Camera rtsp session open.\n"
+		"# TYPE sip2rtsp_camera_up gauge\n");
+	for(c = 0; c < camera_count(co); c++) {
+		cam = camera_get(co,c);
+		stats_printf(sb,"sip2rtsp_camera_up{camera=\"%s\"} %d\n",
+			camera_label(cam),rtsp_alive(cam) ? 1 : 0);
+	}
+	stats_printf(sb,"# HELP sip2rtsp_camera_calls Sip calls on the camera.\n"
+		"# TYPE sip2rtsp_camera_calls gauge\n");
+	for(c = 0; c < camera_count(co); c++) {
+		cam = camera_get(co,c);
+		stats_printf(sb,"sip2rtsp_camera_calls{camera=\"%s\"} %d\n",
+			camera_label(cam),cam->refcount);
+	}
+}
+
+/* answer once the request head is in, -1: not yet; out stays NULL if it failed */
+static int
+stats_conn_answer(core *co,stats_conn *conn)
+{
+	stats_buf sb;
+	char head[256];
+	int hlen;
+
+	conn->req[conn->rlen] = '\0';
+	if(NULL == strstr(conn->req,"\r\n\r\n") && NULL == strstr(conn->req,"\n\n") &&
+		conn->rlen < STATS_REQ_LEN - 1)
+		return -1;
+	memset(&sb,0,sizeof(sb));
+	if(0 != strncmp(conn->req,"GET ",4)){
+		stats_printf(&sb,"HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+	}else{
+		stats_render_cameras(co,&sb);
+		streams_metrics(co,&sb);
+		hlen = snprintf(head,sizeof(head),"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %lu\r\n"
+			"Connection: close\r\n\r\n",(unsigned long)sb.len);
+		/* the body is rendered first for its length, the head goes in front */
+		if(stats_printf(&sb,"%s",head) < 0){
+			osip_free(sb.data);
+			return 0;
+		}
+		memmove(sb.data + hlen,sb.data,sb.len - hlen);
+		memcpy(sb.data,head,hlen);
+	}
+	conn->out = sb.data;
+	conn->olen = sb.len;
+	conn->off = 0;
+	return 0;
+}
+
+/* 1: the connection is done with */
+static int
+stats_conn_io(core *co,stats_conn *conn,uint32_t events)
+{
+	struct epoll_event ev;
+	ssize_t n;
+
+	while(NULL == conn->out) {
+		n = recv(conn->fd,conn->req + conn->rlen,STATS_REQ_LEN - 1 - conn->rlen,0);
+		if(n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			return 0;
+		if(n <= 0)
+			return 1;
+		conn->rlen += n;
+		if(0 == stats_conn_answer(co,conn) && NULL == conn->out)
+			return 1;
+	}
+	while(conn->off < conn->olen) {
+		n = send(conn->fd,conn->out + conn->off,conn->olen - conn->off,MSG_NOSIGNAL);
+		if(n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)){
+			if(!(events & EPOLLOUT)){
+				memset(&ev,0,sizeof(ev));
+				ev.events = EPOLLOUT;
+				ev.data.u64 = STATS_CONN_KEY(conn - conns);
+				epoll_ctl(co->epfd,EPOLL_CTL_MOD,conn->fd,&ev);
+			}
+			return 0;
+		}
+		if(n <= 0)
+			return 1;
+		conn->off += n;
+	}
+	return 1;
+}
+
+static void
+stats_accept(core *co)
+{
+	struct epoll_event ev;
+	stats_conn *conn = NULL;
+	int sock = -1;
+	int k;
+
+	for(;;) {
+		sock = accept(co->stats_fd,NULL,NULL);
+		if(sock < 0){
+			if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+				log(co,LOG_WARNING,"stats accept failed:%s\n",strerror(errno));
+			return;
+		}
+		for(k = 0; k < STATS_CONNS && conns[k].fd >= 0; k++);
+		if(STATS_CONNS == k){
+			log(co,LOG_DEBUG,"stats %d scrapes in progress, connection closed\n",STATS_CONNS);
+			close(sock);
+			continue;
+		}
+		sock_noblocking_set(sock);	/* not inherited from the listener everywhere */
+		conn = &conns[k];
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = STATS_CONN_KEY(k);
+		if(epoll_ctl(co->epfd,EPOLL_CTL_ADD,sock,&ev) < 0){
+			close(sock);
+			continue;
+		}
+		conn->fd = sock;
+		conn->start = time(NULL);
+		conn->rlen = 0;
+		/* the request is usually there already */
+		if(stats_conn_io(co,conn,0))
+			stats_conn_close(co,conn);
+	}
+}
+
+/* the listener or a scrape connection is ready */
+void
+stats_io(core *co,uint64_t key,uint32_t events)
+{
+	stats_conn *conn = NULL;
+
+	if(STATS_IO_KEY == key){
+		stats_accept(co);
+		return;
+	}
+	conn = &conns[STATS_CONN_INDEX(key)];
+	if(conn->fd < 0)
+		return;
+	if(stats_conn_io(co,conn,events))
+		stats_conn_close(co,conn);
+}
+
+/* once a second: scrapers that stall are not waited for */
+void
+stats_automatic_action(core *co)
+{
+	time_t now = time(NULL);
+	int k;
+
+	for(k = 0; co->stats_fd >= 0 && k < STATS_CONNS; k++) {
+		if(conns[k].fd >= 0 && now - conns[k].start >= STATS_TIMEOUT_SECS){
+			log(co,LOG_DEBUG,"stats scrape timed out\n");
+			stats_conn_close(co,&conns[k]);
+		}
+	}
+}
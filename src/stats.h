@@ -0,0 +1,54 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* signaling reactor keys of the metrics listener and its scrapes, below every RTSP_IO_KEY */
+#define STATS_IO_KEY	(0xFF)
+#define STATS_CONNS		(8)		/* scrapes served at once */
+#define STATS_CONN_KEY(k)	((uint64_t)STATS_IO_KEY - 1 - (k))
+#define STATS_CONN_INDEX(key)	((int)(STATS_IO_KEY - 1 - (key)))
+#define STATS_IO_IS(key)	((key) <= STATS_IO_KEY && (key) >= STATS_IO_KEY - STATS_CONNS)
+
+/* prometheus text being built, grows as needed */
+typedef struct stats_buf_t {
+	char *data;
+	size_t len;
+	size_t size;
+} stats_buf;
+
+int stats_printf(stats_buf *sb,const char *format,...);
+int stats_init(core *co);
+void stats_io(core *co,uint64_t key,uint32_t events);
+void stats_automatic_action(core *co);
+void stats_exit(core *co);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
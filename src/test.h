@@ -0,0 +1,67 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <string.h>
+
+/* make check: one test program per module, checks counted, 1 on any failure */
+
+static int failed = 0;
+
+#define CHECK(expr) do{ \
+	if(!(expr)){ \
+		printf("%s:%d: check failed: %s\n",__FILE__,__LINE__,#expr); \
+		failed++; \
+	} \
+}while(0)
+
+static unsigned short test_seq = 100;	/* next rtp sequence number */
+
+/* rtp packet in b: fixed header, then the payload pl */
+static size_t 
+test_rtp(unsigned char *b,int marker,unsigned int ts,const unsigned char *pl,size_t plen)
+{
+	memset(b,0,12);
+	b[0] = 0x80;
+	b[1] = 96 | (marker ? 0x80 : 0);
+	b[2] = test_seq >> 8;
+	b[3] = test_seq & 0xFF;
+	test_seq++;
+	b[4] = ts >> 24;
+	b[5] = ts >> 16;
+	b[6] = ts >> 8;
+	b[7] = ts;
+	b[11] = 1;
+	memcpy(b + 12,pl,plen);
+	return 12 + plen;
+}
+
+static int 
+test_result(void)
+{
+	if(failed > 0)
+		printf("%d checks failed\n",failed);
+	return failed > 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include "h26x.h"
+#include "gop_cache.h"
+#include "test.h"
+
+/* make check: h264/h265 payload parsing, the gop cache */
+
+static h26x_kind 
+kind_of(h26x_codec codec,const unsigned char *pl,size_t plen)
+{
+	unsigned char b[256];
+	const unsigned char *payload = NULL;
+	size_t len = test_rtp(b,0,0,pl,plen), n = 0;
+
+	payload = h26x_rtp_payload((const char *)b,len,&n);
+	return h26x_payload_kind(codec,payload,n);
+}
+
+static void 
+test_h26x(void)
+{
+	unsigned char b[64];
+	const unsigned char idr[] = {0x65,0x88};
+	const unsigned char p[] = {0x41,0x9a};
+	const unsigned char sei[] = {0x06,0x05};
+	const unsigned char fu_idr_start[] = {0x7c,0x85,0x88};
+	const unsigned char fu_idr_mid[] = {0x7c,0x05,0x88};
+	const unsigned char stap[] = {0x18,0x00,0x02,0x67,0x42,0x00,0x02,0x68,0xce};
+	const unsigned char h265_idr[] = {19 << 1,1,0xaf};
+	const unsigned char h265_vps[] = {32 << 1,1,0x0c};
+	const unsigned char h265_fu[] = {49 << 1,1,0x80 | 19,0xaf};
+	const unsigned char h265_trail[] = {1 << 1,1,0xd0};
+	const unsigned char *payload = NULL;
+	size_t len, plen = 0;
+
+	CHECK(h26x_h264 == h26x_codec_of("H264/90000"));
+	CHECK(h26x_h265 == h26x_codec_of("H265/90000"));
+	CHECK(h26x_h265 == h26x_codec_of("hevc"));
+	CHECK(h26x_none == h26x_codec_of("PCMA/8000"));
+	CHECK(h26x_none == h26x_codec_of(NULL));
+
+	CHECK(h26x_key == kind_of(h26x_h264,idr,sizeof(idr)));
+	CHECK(h26x_slice == kind_of(h26x_h264,p,sizeof(p)));
+	CHECK(h26x_other == kind_of(h26x_h264,sei,sizeof(sei)));
+	CHECK(h26x_key == kind_of(h26x_h264,fu_idr_start,sizeof(fu_idr_start)));
+	CHECK(h26x_other == kind_of(h26x_h264,fu_idr_mid,sizeof(fu_idr_mid)));
+	CHECK(h26x_param == kind_of(h26x_h264,stap,sizeof(stap)));
+	CHECK(h26x_key == kind_of(h26x_h265,h265_idr,sizeof(h265_idr)));
+	CHECK(h26x_param == kind_of(h26x_h265,h265_vps,sizeof(h265_vps)));
+	CHECK(h26x_key == kind_of(h26x_h265,h265_fu,sizeof(h265_fu)));
+	CHECK(h26x_slice == kind_of(h26x_h265,h265_trail,sizeof(h265_trail)));
+
+	/* one csrc and padding are skipped */
+	len = test_rtp(b,0,0,idr,sizeof(idr));
+	memmove(b + 16,b + 12,sizeof(idr));
+	b[0] |= 0x20 | 1;
+	b[16 + sizeof(idr)] = 0;
+	b[16 + sizeof(idr) + 1] = 2;
+	len += 4 + 2;
+	payload = h26x_rtp_payload((const char *)b,len,&plen);
+	CHECK(NULL != payload && payload == b + 16 && sizeof(idr) == plen);
+	/* not rtp version 2, nothing after the header */
+	b[0] = 0x40;
+	CHECK(NULL == h26x_rtp_payload((const char *)b,len,&plen));
+	CHECK(NULL == h26x_rtp_payload((const char *)b,12,&plen));
+}
+
+static size_t 
+nal(unsigned char *b,unsigned char n0,unsigned char n1,size_t plen)
+{
+	unsigned char pl[2048];
+
+	memset(pl,0,plen);
+	pl[0] = n0;
+	pl[1] = n1;
+	return test_rtp(b,0,0,pl,plen);
+}
+
+static void 
+test_gop_cache(void)
+{
+	gop_cache *gc = gop_cache_new(4096);
+	unsigned char b[2048];
+	unsigned long gen;
+	size_t len;
+
+	gop_cache_reset(gc,h26x_h264);
+	len = nal(b,0x41,0,100);
+	gop_cache_add(gc,(const char *)b,len);
+	CHECK(0 == gop_cache_count(gc));
+
+	gen = gop_cache_gen(gc);
+	len = nal(b,0x67,0,20);
+	gop_cache_add(gc,(const char *)b,len);
+	len = nal(b,0x7c,0x85,1000);	/* fu-a idr start */
+	gop_cache_add(gc,(const char *)b,len);
+	len = nal(b,0x7c,0x45,500);
+	gop_cache_add(gc,(const char *)b,len);
+	len = nal(b,0x41,0,300);
+	gop_cache_add(gc,(const char *)b,len);
+	CHECK(4 == gop_cache_count(gc));
+	CHECK(32 + 1012 + 512 + 312 == gop_cache_bytes(gc));
+	CHECK(gen != gop_cache_gen(gc));
+	CHECK(NULL != gop_cache_packet(gc,0,&len) && 32 == len);
+	CHECK(NULL == gop_cache_packet(gc,4,&len));
+
+	/* outgrown: the group goes, the cache waits for the next keyframe */
+	gen = gop_cache_gen(gc);
+	len = nal(b,0x41,0,1400);
+	gop_cache_add(gc,(const char *)b,len);
+	len = nal(b,0x41,0,1400);
+	gop_cache_add(gc,(const char *)b,len);
+	CHECK(0 == gop_cache_count(gc) && 0 == gop_cache_bytes(gc));
+	CHECK(gen != gop_cache_gen(gc));
+	len = nal(b,0x65,0,100);
+	gop_cache_add(gc,(const char *)b,len);
+	CHECK(1 == gop_cache_count(gc));
+
+	gop_cache_reset(gc,h26x_none);
+	CHECK(0 == gop_cache_count(gc));
+	gop_cache_free(gc);
+}
+
+int 
+main(void)
+{
+	test_h26x();
+	test_gop_cache();
+	return test_result();
+}
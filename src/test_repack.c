@@ -0,0 +1,146 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include "h26x.h"
+#include "repack.h"
+#include "test.h"
+
+/* make check: h264/h265 repacketization to the sip side mtu */
+
+static unsigned short 
+seq_of(const unsigned char *o)
+{
+	return (o[2] << 8) | o[3];
+}
+
+static void 
+test_repack(void)
+{
+	unsigned char b[2048], pl[2048];
+	const unsigned char *o = NULL;
+	repack *rp = repack_new(500);
+	size_t len, total = 0;
+	unsigned short seq;
+	int n, k;
+
+	test_seq = 100;
+	repack_reset(rp,h26x_none);
+	len = test_rtp(b,0,1000,pl,100);
+	CHECK(-1 == repack_push(rp,(const char *)b,len));
+
+	/* sps and pps of one timestamp go out as one stap-a with the idr */
+	repack_reset(rp,h26x_h264);
+	pl[0] = 0x67;
+	memset(pl + 1,1,20);
+	len = test_rtp(b,0,1000,pl,21);
+	CHECK(0 == repack_push(rp,(const char *)b,len));
+	pl[0] = 0x68;
+	len = test_rtp(b,0,1000,pl,5);
+	CHECK(0 == repack_push(rp,(const char *)b,len));
+
+	/* an idr over the limit: the stap-a, then fu-a fragments */
+	pl[0] = 0x65;
+	memset(pl + 1,2,1400);
+	len = test_rtp(b,1,1000,pl,1401);
+	n = repack_push(rp,(const char *)b,len);
+	CHECK(n >= 4);
+	o = (const unsigned char *)repack_packet(rp,0,&len);
+	CHECK(NULL != o && 24 == (o[12] & 0x1F) && 0x60 == (o[12] & 0x60));
+	CHECK(0 == (o[1] & 0x80));
+	seq = seq_of(o);
+	for(k = 1; k < n; k++) {
+		o = (const unsigned char *)repack_packet(rp,k,&len);
+		CHECK(len <= 500);
+		CHECK(28 == (o[12] & 0x1F) && 5 == (o[13] & 0x1F));
+		CHECK((1 == k) == (0 != (o[13] & 0x80)));
+		CHECK((n - 1 == k) == (0 != (o[13] & 0x40)));
+		CHECK((n - 1 == k) == (0 != (o[1] & 0x80)));
+		CHECK(seq_of(o) == (unsigned short)(seq + k));
+		total += len - 14;
+	}
+	CHECK(1400 == total);
+	CHECK(NULL == repack_packet(rp,n,&len));
+
+	/* a camera gap of two stays a gap of two */
+	seq = seq_of((const unsigned char *)repack_packet(rp,n - 1,&len));
+	test_seq += 2;
+	pl[0] = 0x41;
+	len = test_rtp(b,1,2000,pl,100);
+	CHECK(1 == repack_push(rp,(const char *)b,len));
+	o = (const unsigned char *)repack_packet(rp,0,&len);
+	CHECK(seq_of(o) == (unsigned short)(seq + 3));
+	CHECK(112 == len && 0x41 == o[12]);
+
+	/* a duplicate goes nowhere */
+	test_seq--;
+	CHECK(0 == repack_push(rp,(const char *)b,len));
+	repack_free(rp);
+}
+
+/* bigger than the relay ever cut: fragments, and a cut that cannot fit goes out renumbered */
+static void 
+test_repack_large(void)
+{
+	static unsigned char b[65536], pl[65536];
+	const unsigned char *o = NULL;
+	repack *rp = repack_new(520);
+	unsigned short seq;
+	size_t len, total = 0;
+	int n, k;
+
+	test_seq = 100;
+	repack_reset(rp,h26x_h264);
+	pl[0] = 0x65;
+	memset(pl + 1,3,60000);
+	len = test_rtp(b,1,1000,pl,60001);
+	n = repack_push(rp,(const char *)b,len);
+	CHECK(n > 100);
+	o = (const unsigned char *)repack_packet(rp,0,&len);
+	seq = seq_of(o);
+	for(k = 0; k < n; k++) {
+		o = (const unsigned char *)repack_packet(rp,k,&len);
+		CHECK(len <= 520);
+		CHECK(seq_of(o) == (unsigned short)(seq + k));
+		total += len - 14;
+	}
+	CHECK(60000 == total);
+
+	/* a stap-a of 12000 one byte units would be 12000 packets */
+	pl[0] = 24;
+	for(k = 0; k < 12000; k++) {
+		pl[1 + 3*k] = 0;
+		pl[2 + 3*k] = 1;
+		pl[3 + 3*k] = 0x41;
+	}
+	len = test_rtp(b,1,2000,pl,1 + 3 * 12000);
+	CHECK(1 == repack_push(rp,(const char *)b,len));
+	o = (const unsigned char *)repack_packet(rp,0,&len);
+	CHECK(12 + 1 + 3 * 12000 == len && 24 == o[12]);
+	CHECK(seq_of(o) == (unsigned short)(seq + n));
+	repack_free(rp);
+}
+
+int 
+main(void)
+{
+	test_repack();
+	test_repack_large();
+	return test_result();
+}
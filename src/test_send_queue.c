@@ -0,0 +1,190 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *
+ * Contributor(s):
+ *              larkguo@gmail.com
+ */
+
+#include <sys/uio.h>
+#include "send_queue.h"
+#include "test.h"
+
+/* make check: frame dropping and resync of the per viewer send queue */
+
+/* h264 rtp of timestamp ts whose payload starts with nal header byte nal */
+static send_queue_result 
+push(send_queue *q,h26x_codec codec,unsigned int ts,unsigned char nal)
+{
+	unsigned char b[12 + 64];
+	unsigned char payload[64];
+	struct iovec iov[2];
+
+	memset(payload,0x11,sizeof(payload));
+	payload[0] = nal;
+	test_rtp(b,0,ts,payload,sizeof(payload));
+	/* header and payload apart, the way the relay hands them over */
+	iov[0].iov_base = b;
+	iov[0].iov_len = 12;
+	iov[1].iov_base = b + 12;
+	iov[1].iov_len = sizeof(payload);
+	return send_queue_push(q,codec,iov,2);
+}
+
+static unsigned int 
+peek_ts(send_queue *q)
+{
+	const unsigned char *pkt = NULL;
+	size_t len = 0;
+
+	pkt = (const unsigned char *)send_queue_peek(q,&len);
+	if(NULL == pkt || len < 12)
+		return 0;
+	return (pkt[4] << 24) | (pkt[5] << 16) | (pkt[6] << 8) | pkt[7];
+}
+
+static void 
+test_fifo(void)
+{
+	send_queue *q = send_queue_new(4);
+	size_t len = 0;
+
+	CHECK(!send_queue_blocked(q));
+	CHECK(send_queue_queued == push(q,h26x_none,1,0));
+	CHECK(send_queue_queued == push(q,h26x_none,2,0));
+	CHECK(send_queue_blocked(q));
+	CHECK(NULL != send_queue_peek(q,&len) && 76 == len);
+	CHECK(1 == peek_ts(q));
+	send_queue_pop(q);
+	CHECK(2 == peek_ts(q));
+	send_queue_pop(q);
+	CHECK(0 == send_queue_count(q) && !send_queue_blocked(q));
+	/* not video: the newest datagram is what goes */
+	push(q,h26x_none,1,0);
+	push(q,h26x_none,2,0);
+	push(q,h26x_none,3,0);
+	push(q,h26x_none,4,0);
+	CHECK(send_queue_dropped == push(q,h26x_none,5,0));
+	CHECK(4 == send_queue_count(q) && 1 == peek_ts(q));
+	send_queue_free(q);
+}
+
+static void 
+test_nonref_frame(void)
+{
+	send_queue *q = send_queue_new(4);
+
+	push(q,h26x_h264,1,0x65);	/* idr */
+	push(q,h26x_h264,2,0x01);	/* non-reference frame 2 */
+	push(q,h26x_h264,2,0x01);
+	push(q,h26x_h264,3,0x41);
+	/* full: non-reference frame 4 is not queued, none of it */
+	CHECK(send_queue_dropped == push(q,h26x_h264,4,0x01));
+	CHECK(4 == send_queue_count(q));
+	CHECK(send_queue_dropped == push(q,h26x_h264,4,0x01));
+	/* a reference frame makes room by evicting frame 2 */
+	CHECK(send_queue_queued == push(q,h26x_h264,5,0x41));
+	CHECK(3 == send_queue_count(q));
+	CHECK(1 == peek_ts(q));
+	send_queue_pop(q);
+	CHECK(3 == peek_ts(q));
+	send_queue_pop(q);
+	CHECK(5 == peek_ts(q));
+	send_queue_free(q);
+}
+
+static void 
+test_evicted_frame_rest(void)
+{
+	send_queue *q = send_queue_new(4);
+
+	push(q,h26x_h264,1,0x65);
+	push(q,h26x_h264,1,0x65);
+	push(q,h26x_h264,2,0x01);	/* first half of a non-reference frame */
+	push(q,h26x_h264,2,0x01);
+	/* a reference packet makes room by evicting frame 2 */
+	CHECK(send_queue_queued == push(q,h26x_h264,3,0x41));
+	CHECK(3 == send_queue_count(q));
+	/* the rest of frame 2 would be a torn frame */
+	push(q,h26x_h264,3,0x41);
+	CHECK(4 == send_queue_count(q));
+	send_queue_pop(q);
+	CHECK(send_queue_queued == push(q,h26x_h264,4,0x41));
+	send_queue_free(q);
+
+	q = send_queue_new(3);
+	push(q,h26x_h264,1,0x65);
+	push(q,h26x_h264,2,0x01);
+	push(q,h26x_h264,2,0x01);
+	CHECK(send_queue_queued == push(q,h26x_h264,3,0x41));
+	send_queue_pop(q);
+	send_queue_pop(q);
+	CHECK(send_queue_dropped == push(q,h26x_h264,2,0x01));
+	send_queue_free(q);
+}
+
+static void 
+test_resync(void)
+{
+	send_queue *q = send_queue_new(4);
+
+	push(q,h26x_h264,1,0x65);
+	push(q,h26x_h264,2,0x41);
+	push(q,h26x_h264,3,0x41);
+	push(q,h26x_h264,4,0x41);
+	/* only reference frames queued: everything goes, wait for a keyframe */
+	CHECK(send_queue_resync == push(q,h26x_h264,5,0x41));
+	CHECK(0 == send_queue_count(q) && send_queue_blocked(q));
+	CHECK(send_queue_dropped == push(q,h26x_h264,6,0x41));
+	CHECK(send_queue_dropped == push(q,h26x_h264,7,0x01));
+	CHECK(0 == send_queue_count(q));
+	CHECK(send_queue_queued == push(q,h26x_h264,8,0x67));	/* sps */
+	CHECK(send_queue_queued == push(q,h26x_h264,8,0x65));
+	CHECK(send_queue_queued == push(q,h26x_h264,9,0x41));
+	CHECK(3 == send_queue_count(q) && 8 == peek_ts(q));
+	send_queue_free(q);
+
+	/* a keyframe arriving at a full queue starts over at once */
+	q = send_queue_new(2);
+	push(q,h26x_h264,1,0x65);
+	push(q,h26x_h264,2,0x41);
+	CHECK(send_queue_resync == push(q,h26x_h264,3,0x65));
+	CHECK(1 == send_queue_count(q) && 3 == peek_ts(q));
+	send_queue_free(q);
+}
+
+static void 
+test_h265_nonref(void)
+{
+	send_queue *q = send_queue_new(2);
+
+	push(q,h26x_h265,1,19 << 1);	/* idr_w_radl */
+	push(q,h26x_h265,2,0 << 1);	/* trail_n */
+	CHECK(send_queue_dropped == push(q,h26x_h265,3,0 << 1));
+	CHECK(send_queue_queued == push(q,h26x_h265,4,1 << 1));	/* trail_r */
+	CHECK(2 == send_queue_count(q) && 1 == peek_ts(q));
+	send_queue_free(q);
+}
+
+int 
+main(void)
+{
+	test_fifo();
+	test_nonref_frame();
+	test_evicted_frame_rest();
+	test_resync();
+	test_h265_nonref();
+	return test_result();
+}
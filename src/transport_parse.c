@@ -73,6 +73,19 @@ TRANSPORT_PARSE(multicast)
 	return (transport);
 }
 
+TRANSPORT_PARSE(rtcp_mux)
+{
+	ADV_SPACE(transport);
+	r->have_rtcp_mux = 1;
+	if (*transport == '\0') return (transport);
+
+	if (*transport != ';')
+		return (NULL);
+	transport++;
+	ADV_SPACE(transport);
+	return (transport);
+}
+
 TRANSPORT_PARSE(client_port)
 {
 	uint32_t fromport, toport;
@@ -250,6 +263,7 @@ struct {
 {
 	TTYPE("unicast", transport_parse_unicast),
 	TTYPE("multicast", transport_parse_multicast),
+	TTYPE("RTCP-mux", transport_parse_rtcp_mux),
 	TTYPE("client_port", transport_parse_client_port),
 	TTYPE("server_port", transport_parse_server_port),
 	TTYPE("port", transport_parse_server_port),